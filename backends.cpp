@@ -0,0 +1,77 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    VCS backends linked into the portable core, for the platforms
+             without the second level plugin DLLs (see vcs.cpp)
+*****************************************************************************/
+
+#include "vcsdata.h"
+#include "cvsentries.h"
+
+using namespace std;
+
+TSFileSet DirtyDirs;
+TSFileSet OutdatedFiles;
+
+namespace
+{
+    /// <summary>
+    /// CVS working directory, local status only. The remote operations need
+    /// the cvs client and are left to the FAR plugin.
+    /// </summary>
+    class CvsLocalData final : public VcsData<CvsLocalData>
+    {
+    public:
+        explicit CvsLocalData(const tstring& sDir, TSFileSet& DirtyDirs, TSFileSet& OutdatedFiles) :
+            VcsData(sDir, DirtyDirs, OutdatedFiles)
+        {
+            TCHAR cTagType;
+            tstring sTag;
+
+            if (ReadCvsTagFile(sDir, cTagType, sTag))
+                setTag(sTag.c_str());
+        }
+
+        static const TCHAR *GetAdminDirName() { return _T("CVS"); }
+        static bool IsVcsDir(const tstring& sDir) { return IsCvsDir(sDir); }
+
+        void self_destroy() override { delete this; }
+
+        bool UpdateStatus(bool) override { return false; }
+        bool UpdateStatusSince(tstring&, bool&) override { return false; }
+        bool Update(bool) override { return false; }
+        bool Annotate(const tstring&, const tstring&) override { return false; }
+        bool GetRevisionTemp(const tstring&, const tstring&, const tstring&) override { return false; }
+        bool Status(const tstring&, tstring&) override { return false; }
+        bool Status(const vector<tstring>&, VcsFileStatuses&) override { return false; }
+        bool ReportsDirtyDirs() const override { return false; }
+
+    protected:
+        void GetVcsEntriesOnly() const override
+        {
+            m_Entries.clear();
+            ReadCvsEntriesFile(getDir(), false, m_Entries);
+            ReadCvsEntriesFile(getDir(), true, m_Entries);
+        }
+
+        void AdjustVcsEntry(VcsEntry& entry, const WIN32_FIND_DATA& findData) const override
+        {
+            entry.status = GetCvsLocalStatus(entry, findData);
+
+            if (entry.status == fsNormal && IsOutdatedEntry(findData.cFileName))
+                entry.status = fsOutdated;
+        }
+    };
+}
+
+bool IsVcsDir(const tstring& sDir)
+{
+    return CvsLocalData::IsVcsDir(sDir);
+}
+
+boost::intrusive_ptr<IVcsData> GetVcsData(const tstring& sDir)
+{
+    if (CvsLocalData::IsVcsDir(sDir))
+        return new CvsLocalData(sDir, DirtyDirs, OutdatedFiles);
+
+    return 0;
+}
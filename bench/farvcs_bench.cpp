@@ -0,0 +1,592 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Macro benchmark of the status engine over a synthetic working
+             copy. Prints a JSON object per line for every measured phase.
+*****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cachefile.h"
+#include "dirlist.h"
+#include "entriescache.h"
+#include "vcs.h"
+#include "wcgen.h"
+
+using namespace std;
+
+//==========================================================================>>
+// Allocation counting: every operator new of the process is counted, so
+// that a phase can tell how many heap allocations it has made. The array,
+// sized, nothrow and aligned forms are replaced too, so that none of them
+// goes uncounted or reaches the library's allocator with a block from
+// malloc or the other way round.
+//==========================================================================>>
+
+namespace
+{
+    atomic<unsigned long long> nAllocations(0);
+
+    void *Allocate(size_t n) noexcept
+    {
+        nAllocations.fetch_add(1, memory_order_relaxed);
+        return malloc(n != 0 ? n : 1);
+    }
+
+    // Not inlined into the operators, so that GCC does not see a free of a
+    // block from operator new (-Wmismatched-new-delete): here both ends are
+    // malloc and free by design.
+
+    __attribute__((noinline)) void Release(void *p) noexcept
+    {
+        free(p);
+    }
+
+#ifdef __cpp_aligned_new
+    void *AllocateAligned(size_t n, align_val_t al) noexcept
+    {
+        nAllocations.fetch_add(1, memory_order_relaxed);
+
+        // aligned_alloc wants a multiple of the alignment
+
+        size_t nAlign = static_cast<size_t>(al);
+        return aligned_alloc(nAlign, n != 0 ? (n + nAlign - 1) / nAlign * nAlign : nAlign);
+    }
+#endif
+}
+
+void *operator new(size_t n)
+{
+    if (void *p = Allocate(n))
+        return p;
+
+    throw bad_alloc();
+}
+
+void *operator new[](size_t n)
+{
+    return operator new(n);
+}
+
+void *operator new(size_t n, const nothrow_t&) noexcept
+{
+    return Allocate(n);
+}
+
+void *operator new[](size_t n, const nothrow_t&) noexcept
+{
+    return Allocate(n);
+}
+
+void operator delete(void *p) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void *p, const nothrow_t&) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p, const nothrow_t&) noexcept
+{
+    Release(p);
+}
+
+#ifdef __cpp_aligned_new
+void *operator new(size_t n, align_val_t al)
+{
+    if (void *p = AllocateAligned(n, al))
+        return p;
+
+    throw bad_alloc();
+}
+
+void *operator new[](size_t n, align_val_t al)
+{
+    return operator new(n, al);
+}
+
+void *operator new(size_t n, align_val_t al, const nothrow_t&) noexcept
+{
+    return AllocateAligned(n, al);
+}
+
+void *operator new[](size_t n, align_val_t al, const nothrow_t&) noexcept
+{
+    return AllocateAligned(n, al);
+}
+
+void operator delete(void *p, align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p, align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void *p, size_t, align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p, size_t, align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void *p, align_val_t, const nothrow_t&) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void *p, align_val_t, const nothrow_t&) noexcept
+{
+    Release(p);
+}
+#endif
+
+namespace
+{
+    const char cszUsage[] =
+        "Usage: farvcs_bench [options]\n"
+        "  --vcs cvs          Working copy format (only CVS has a local backend in the core)\n"
+        "  --depth N          Levels of subdirectories below the root (3)\n"
+        "  --fanout N         Subdirectories per directory (4)\n"
+        "  --files N          Files per directory (20)\n"
+        "  --dirty R          Share of the locally modified files (0.05)\n"
+        "  --outdated R       Share of the files changed in the repository (0.02)\n"
+        "  --seed N           Seed of the generator (1)\n"
+        "  --iterations N     Repetitions of every phase (5)\n"
+        "  --dir PATH         Where to generate the working copy (a temporary directory)\n"
+        "  --keep             Do not remove the working copy afterwards\n"
+        "For the enumeration of a large flat directory: --depth 0 --files 100000\n";
+
+    struct Options
+    {
+        Options() : nIterations(5), bKeep(false) {}
+
+        WorkingCopyParams params;
+        int nIterations;
+        tstring sDir;
+        bool bKeep;
+    };
+
+    bool ParseOptions(int argc, char *argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            string sArg = argv[i];
+
+            if (sArg == "--keep")
+            {
+                options.bKeep = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                return false;
+
+            const char *szValue = argv[++i];
+
+            if (sArg == "--vcs")
+            {
+                if (strcmp(szValue, "cvs") != 0)
+                    return false;
+            }
+            else if (sArg == "--depth")      options.params.nDepth = atoi(szValue);
+            else if (sArg == "--fanout")     options.params.nFanOut = atoi(szValue);
+            else if (sArg == "--files")      options.params.nFilesPerDir = atoi(szValue);
+            else if (sArg == "--dirty")      options.params.dDirtyRatio = atof(szValue);
+            else if (sArg == "--outdated")   options.params.dOutdatedRatio = atof(szValue);
+            else if (sArg == "--seed")       options.params.nSeed = strtoul(szValue, 0, 10);
+            else if (sArg == "--iterations") options.nIterations = atoi(szValue);
+            else if (sArg == "--dir")        options.sDir = szValue;
+            else
+                return false;
+        }
+
+        return options.params.nDepth >= 0 && options.params.nFanOut >= 0 && options.params.nFilesPerDir >= 0 && options.nIterations > 0;
+    }
+
+    //==========================================================================>>
+    // Timing and reporting
+    //==========================================================================>>
+
+    typedef chrono::steady_clock Clock;
+
+    double ElapsedMs(Clock::time_point tStart)
+    {
+        return chrono::duration<double, milli>(Clock::now() - tStart).count();
+    }
+
+    class Reporter
+    {
+    public:
+        explicit Reporter(const Options& options) : m_options(options) {}
+
+        /// <summary>
+        /// Prints the line for a phase: the parameters of the run, the number
+        /// of the items the phase has processed and the timings in ms, and the
+        /// heap allocations if counted.
+        /// </summary>
+        void Report(const char *szPhase, size_t nItems, vector<double> vTimes, long long nPhaseAllocations = -1) const
+        {
+            sort(vTimes.begin(), vTimes.end());
+
+            double dTotal = 0;
+            for (double d : vTimes)
+                dTotal += d;
+
+            const WorkingCopyParams& params = m_options.params;
+
+            printf("{\"suite\":\"farvcs\",\"vcs\":\"cvs\",\"phase\":\"%s\","
+                   "\"depth\":%d,\"fanout\":%d,\"files\":%d,\"dirty\":%g,\"outdated\":%g,\"seed\":%lu,"
+                   "\"items\":%lu,\"iterations\":%lu,\"min_ms\":%.3f,\"median_ms\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f",
+                   szPhase,
+                   params.nDepth, params.nFanOut, params.nFilesPerDir, params.dDirtyRatio, params.dOutdatedRatio, params.nSeed,
+                   static_cast<unsigned long>(nItems), static_cast<unsigned long>(vTimes.size()),
+                   vTimes.front(), vTimes[vTimes.size() / 2], dTotal / vTimes.size(), vTimes.back());
+
+            if (nPhaseAllocations >= 0)
+                printf(",\"allocations\":%lld,\"allocations_per_item\":%.3f", nPhaseAllocations, nItems != 0 ? double(nPhaseAllocations) / nItems : 0.0);
+
+            printf("}\n");
+
+            fflush(stdout);
+        }
+
+    private:
+        const Options& m_options;
+    };
+
+    template <typename F> vector<double> Measure(int nIterations, F f)
+    {
+        vector<double> vTimes;
+
+        for (int i = 0; i < nIterations; ++i)
+        {
+            Clock::time_point tStart = Clock::now();
+            f();
+            vTimes.push_back(ElapsedMs(tStart));
+        }
+
+        return vTimes;
+    }
+
+    //==========================================================================>>
+    // Model of the panel items: the same allocations and copies as
+    // W32FindDataToPluginPanelItem and VcsPlugin::DecoratePanelItem do for
+    // the FAR PluginPanelItem, which is not available outside the plugin
+    //==========================================================================>>
+
+    const int nCustomColumns = 4;
+    const int nRevColumnWidth = 9;
+    const int nOptColumnWidth = 3;
+
+    TCHAR cszEmptyLine[] = _T("");
+
+    struct PanelItem
+    {
+        FILETIME CreationTime;
+        FILETIME LastAccessTime;
+        FILETIME LastWriteTime;
+        unsigned long long FileSize;
+        DWORD FileAttributes;
+        TCHAR *FileName;
+        TCHAR *AlternateFileName;
+        TCHAR **CustomColumnData;
+    };
+
+    TCHAR *DupString(const TCHAR *sz)
+    {
+        size_t len = _tcslen(sz);
+        TCHAR *szDup = new TCHAR[len + 1];
+        memcpy(szDup, sz, (len + 1) * sizeof(TCHAR));
+        return szDup;
+    }
+
+    PanelItem MakePanelItem(const VcsEntry& entry, const tstring& sTag)
+    {
+        const WIN32_FIND_DATA& findData = entry.fileFindData;
+
+        PanelItem pi;
+        memset(&pi, 0, sizeof pi);
+
+        pi.CreationTime = findData.ftCreationTime;
+        pi.LastAccessTime = findData.ftLastAccessTime;
+        pi.LastWriteTime = findData.ftLastWriteTime;
+        pi.FileSize = static_cast<unsigned long long>(findData.nFileSizeHigh) << 32 | findData.nFileSizeLow;
+        pi.FileAttributes = findData.dwFileAttributes | (entry.bDir ? FILE_ATTRIBUTE_DIRECTORY : 0);
+        pi.FileName = DupString(findData.cFileName);
+        pi.AlternateFileName = DupString(findData.cAlternateFileName);
+
+        pi.CustomColumnData = new TCHAR*[nCustomColumns];
+
+        for (int i = 0; i < nCustomColumns; ++i)
+            pi.CustomColumnData[i] = cszEmptyLine;
+
+        if (!IsVcsFile(entry.status))
+            return pi;
+
+        if (!entry.sRevision.empty())
+            pi.CustomColumnData[1] = DupString(sformat(_T("%*s"), nRevColumnWidth, entry.sRevision.c_str()).c_str());
+
+        if (!entry.sOptions.empty())
+            pi.CustomColumnData[2] = DupString(sformat(_T("%-*s"), nOptColumnWidth, entry.sOptions.c_str()).c_str());
+
+        if (entry.bDir && !sTag.empty())
+            pi.CustomColumnData[3] = DupString(sTag.c_str());
+        else if (!entry.bDir && !entry.sTagdate.empty())
+            pi.CustomColumnData[3] = DupString(entry.sTagdate.c_str() + 1);
+
+        return pi;
+    }
+
+    void FreePanelItem(PanelItem& pi)
+    {
+        delete[] pi.FileName;
+        delete[] pi.AlternateFileName;
+
+        for (int i = 0; i < nCustomColumns; ++i)
+            if (pi.CustomColumnData[i] != cszEmptyLine)
+                delete[] pi.CustomColumnData[i];
+
+        delete[] pi.CustomColumnData;
+    }
+
+    size_t FileSize(const tstring& sFile)
+    {
+        ifstream is(sFile.c_str(), ios::binary | ios::ate);
+        return is ? static_cast<size_t>(is.tellg()) : 0;
+    }
+
+    int Run(const Options& options)
+    {
+        Reporter reporter(options);
+
+        tstring sRoot = options.sDir;
+
+        if (sRoot.empty())
+        {
+            sRoot = GetTempFileName(_T("fvb"));
+            remove(sRoot.c_str()); // Only the unique name is needed
+        }
+
+        // Generate the working copy and record what the cvs client would have
+        // reported as outdated
+
+        WorkingCopyInfo info;
+
+        Clock::time_point tStart = Clock::now();
+        info = GenerateCvsWorkingCopy(sRoot, options.params);
+        reporter.Report("generate", info.nFiles, vector<double>(1, ElapsedMs(tStart)));
+
+        for (const auto& sFile : info.vOutdatedFiles)
+            OutdatedFiles.Add(sFile);
+
+        // Enumeration of every directory: per entry and in blocks
+
+        size_t nFound = 0;
+
+        reporter.Report("dir_iterator", info.vDirs.size(), Measure(options.nIterations, [&]
+        {
+            nFound = 0;
+
+            for (const auto& sDir : info.vDirs)
+                for (dir_iterator p(sDir, true); p != dir_iterator(); ++p)
+                    ++nFound;
+        }));
+
+        reporter.Report("list_directory", info.vDirs.size(), Measure(options.nIterations, [&]
+        {
+            FileInfos files;
+
+            for (const auto& sDir : info.vDirs)
+            {
+                files.clear();
+                ListDirectory(sDir, files, true);
+            }
+        }));
+
+        // Reading the entries of every directory, each time from scratch, and
+        // then from the retained entries, as navigation does when nothing has
+        // changed. The rest of the phases run without retaining.
+
+        size_t nEntries = 0;
+
+        GetEntriesCacheBudget().nBudgetBytes = 0;
+
+        reporter.Report("lazy_load_entries", info.vDirs.size(), Measure(options.nIterations, [&]
+        {
+            nEntries = 0;
+
+            for (const auto& sDir : info.vDirs)
+                nEntries += GetVcsData(sDir)->entries().size();
+        }));
+
+        GetEntriesCacheBudget().nBudgetBytes = EntriesCacheBudget::cnDefaultBytes;
+
+        for (const auto& sDir : info.vDirs)
+            GetVcsData(sDir)->entries();
+
+        reporter.Report("lazy_load_entries_retained", info.vDirs.size(), Measure(options.nIterations, [&]
+        {
+            for (const auto& sDir : info.vDirs)
+                GetVcsData(sDir)->entries();
+        }));
+
+        ModuleEntriesCache().Clear();
+        GetEntriesCacheBudget().nBudgetBytes = 0;
+
+        // Walking the tree as the FAR Traversal does
+
+        bool bTraversed = true;
+
+        reporter.Report("traversal", info.vDirs.size(), Measure(options.nIterations, [&]
+        {
+            DirtyDirs.Clear();
+            bTraversed &= TraverseDirtyDirs(sRoot, TraversalProgress());
+        }));
+
+        size_t nDirtyDirs = DirtyDirs.Size();
+
+        // The allocations of a traversal beyond those of loading the entries
+        // of its directories, per entry: visiting the entries should add none
+
+        DirtyDirs.Clear();
+
+        unsigned long long nLoadStart = nAllocations;
+
+        for (const auto& sDir : info.vDirs)
+            GetVcsData(sDir)->entries();
+
+        unsigned long long nLoadAllocations = nAllocations - nLoadStart;
+
+        DirtyDirs.Clear();
+
+        unsigned long long nTraversalStart = nAllocations;
+        Clock::time_point tTraversalStart = Clock::now();
+
+        bTraversed &= TraverseDirtyDirs(sRoot, TraversalProgress());
+
+        double dTraversalMs = ElapsedMs(tTraversalStart);
+        unsigned long long nTraversalAllocations = nAllocations - nTraversalStart;
+
+        reporter.Report("traversal_allocations", nEntries, vector<double>(1, dTraversalMs),
+                        static_cast<long long>(nTraversalAllocations) - static_cast<long long>(nLoadAllocations));
+
+        // The flat list of all the changes, from the directories found dirty
+        // and those of the outdated files
+
+        reporter.Report("all_changes", nDirtyDirs + OutdatedFiles.Size(), Measure(options.nIterations, [&]
+        {
+            CollectChanges(sRoot);
+        }));
+
+        // The cache file
+
+        tstring sCacheFile = CatPath(sRoot.c_str(), _T("farvcs.csh"));
+        RemoteMarkerMap remoteMarkers;
+
+        reporter.Report("cache_save", DirtyDirs.Size() + OutdatedFiles.Size(), Measure(options.nIterations, [&]
+        {
+            SaveCacheFile(sCacheFile, DirtyDirs, OutdatedFiles, remoteMarkers, SlowDirs);
+        }));
+
+        size_t nCacheBytes = FileSize(sCacheFile);
+
+        reporter.Report("cache_load", nCacheBytes, Measure(options.nIterations, [&]
+        {
+            TSFileSet dirtyDirs, outdatedFiles;
+            DirCostTable slowDirs;
+            LoadCacheFile(sCacheFile, dirtyDirs, outdatedFiles, remoteMarkers, slowDirs);
+        }));
+
+        remove(sCacheFile.c_str());
+
+        // Panel items of every directory, from the already loaded entries
+
+        vector<boost::intrusive_ptr<IVcsData>> vVcsData;
+
+        for (const auto& sDir : info.vDirs)
+        {
+            vVcsData.push_back(GetVcsData(sDir));
+            vVcsData.back()->entries();
+        }
+
+        reporter.Report("panel_items", nEntries, Measure(options.nIterations, [&]
+        {
+            vector<PanelItem> v;
+
+            for (const auto& pVcsData : vVcsData)
+            {
+                v.clear();
+
+                for (const auto& entry : pVcsData->entries())
+                    v.push_back(MakePanelItem(entry.second, pVcsData->getTag()));
+
+                for (auto& pi : v)
+                    FreePanelItem(pi);
+            }
+        }));
+
+        vVcsData.clear();
+
+        if (!options.bKeep)
+            RemoveTree(sRoot);
+
+        // The engine must have found exactly the dirty directories generated
+
+        if (!bTraversed || nDirtyDirs != info.vDirtyDirs.size())
+        {
+            fprintf(stderr, "farvcs_bench: %lu dirty directories found, %lu expected\n",
+                    static_cast<unsigned long>(nDirtyDirs), static_cast<unsigned long>(info.vDirtyDirs.size()));
+            return 1;
+        }
+
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        fputs(cszUsage, stderr);
+        return 2;
+    }
+
+    try
+    {
+        return Run(options);
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "farvcs_bench: %s\n", e.what());
+        return 1;
+    }
+}
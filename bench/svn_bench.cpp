@@ -0,0 +1,493 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    svn_bench: times the libsvn calls the SVN module makes for
+             Update, Status, Annotate and GetRevisionTemp against running
+             svn.exe for the same operations, over a file:// repository
+*****************************************************************************/
+
+#include <windows.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#undef _CRT_SECURE_NO_DEPRECATE
+
+#include "svn_client.h"
+#include "svn_cmdline.h"
+#include "svn_config.h"
+#include "svn_diff.h"
+#include "svn_fs.h"
+#include "svn_path.h"
+#include "svn_pools.h"
+
+using namespace std;
+
+// Prints one JSON object per phase and method, like farvcs_bench:
+//   {"suite":"farvcs","vcs":"svn","phase":"status","method":"libsvn",...}
+// The libsvn calls take the arguments SvnData passes them, over a single
+// client context created up front, as the module does. The repository, its
+// history and the two working copies are set up with svn.exe and svnadmin.
+
+namespace
+{
+    const char cszUsage[] =
+        "Usage: svn_bench [options]\n"
+        "  --files N          Files in the working copy (50)\n"
+        "  --lines N          Lines per file (200)\n"
+        "  --revisions N      Revisions committed after the import (20)\n"
+        "  --iterations N     Timed runs of every operation and method (5)\n"
+        "  --dir DIR          Where to create the repository (a new directory in %TEMP%)\n"
+        "  --keep             Leave the repository and the working copies in place\n"
+        "svn.exe and svnadmin.exe are looked for in PATH.\n";
+
+    struct Options
+    {
+        Options() : nFiles(50), nLines(200), nRevisions(20), nIterations(5), bKeep(false) {}
+
+        int nFiles;
+        int nLines;
+        int nRevisions;
+        int nIterations;
+        string sDir;
+        bool bKeep;
+    };
+
+    bool ParseOptions(int argc, char *argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            string sArg = argv[i];
+
+            if (sArg == "--keep")
+            {
+                options.bKeep = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+                return false;
+
+            const char *szValue = argv[++i];
+
+            if (sArg == "--files")           options.nFiles = atoi(szValue);
+            else if (sArg == "--lines")      options.nLines = atoi(szValue);
+            else if (sArg == "--revisions")  options.nRevisions = atoi(szValue);
+            else if (sArg == "--iterations") options.nIterations = atoi(szValue);
+            else if (sArg == "--dir")        options.sDir = szValue;
+            else
+                return false;
+        }
+
+        return options.nFiles > 0 && options.nLines > 0 && options.nRevisions >= 0 && options.nIterations > 0;
+    }
+
+    //==========================================================================>>
+    // svn.exe
+    //==========================================================================>>
+
+    // Runs the command line with the output thrown away, as the timings are
+    // about the operation rather than the console. Returns the exit code, or
+    // -1 if the process could not be started.
+
+    int Run(const string& sCmdLine)
+    {
+        SECURITY_ATTRIBUTES sa = { sizeof sa, 0, TRUE };
+        HANDLE hNul = ::CreateFileA("NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, 0);
+
+        STARTUPINFOA si = { sizeof si };
+        si.dwFlags    = STARTF_USESTDHANDLES;
+        si.hStdInput  = hNul;
+        si.hStdOutput = hNul;
+        si.hStdError  = hNul;
+
+        vector<char> cmdLine(sCmdLine.begin(), sCmdLine.end());
+        cmdLine.push_back(0);
+
+        PROCESS_INFORMATION pi;
+        BOOL bStarted = ::CreateProcessA(0, &cmdLine[0], 0, 0, TRUE, CREATE_NO_WINDOW, 0, 0, &si, &pi);
+
+        ::CloseHandle(hNul);
+
+        if (!bStarted)
+            return -1;
+
+        ::WaitForSingleObject(pi.hProcess, INFINITE);
+
+        DWORD dwExitCode = 1;
+        ::GetExitCodeProcess(pi.hProcess, &dwExitCode);
+
+        ::CloseHandle(pi.hThread);
+        ::CloseHandle(pi.hProcess);
+
+        return static_cast<int>(dwExitCode);
+    }
+
+    string Quote(const string& s)
+    {
+        return '"' + s + '"';
+    }
+
+    void WriteFile(const string& sPath, const string& sText)
+    {
+        if (FILE *pFile = fopen(sPath.c_str(), "wb"))
+        {
+            fwrite(sText.data(), 1, sText.size(), pFile);
+            fclose(pFile);
+        }
+    }
+
+    //==========================================================================>>
+    // The repository: the files are imported, then every revision changes a
+    // few lines of some of them from the second working copy, so that the
+    // first one is out of date and the blame has a history to walk
+    //==========================================================================>>
+
+    string FileName(int i)
+    {
+        char szName[32];
+        sprintf(szName, "file%03d.txt", i);
+        return szName;
+    }
+
+    string FileText(int nLines, int nRevision, int nFile)
+    {
+        string sText;
+        char szLine[96];
+
+        for (int i = 0; i < nLines; ++i)
+        {
+            // Every revision rewrites one line in ten, a different one each time
+
+            int nChanged = i % 10 == nRevision % 10 ? nRevision : 0;
+            sprintf(szLine, "line %d of file %d, revision %d\n", i, nFile, nChanged);
+            sText += szLine;
+        }
+
+        return sText;
+    }
+
+    bool BuildRepository(const Options& options, const string& sUrl)
+    {
+        string sImport = options.sDir + "\\import";
+
+        if (Run("svnadmin create " + Quote(options.sDir + "\\repo")) != 0 || !::CreateDirectoryA(sImport.c_str(), 0))
+            return false;
+
+        for (int i = 0; i < options.nFiles; ++i)
+            WriteFile(sImport + '\\' + FileName(i), FileText(options.nLines, 0, i));
+
+        if (Run("svn import -q -m import " + Quote(sImport) + ' ' + sUrl) != 0 ||
+            Run("svn checkout -q " + sUrl + ' ' + Quote(options.sDir + "\\wc")) != 0 ||
+            Run("svn checkout -q " + sUrl + ' ' + Quote(options.sDir + "\\other")) != 0)
+            return false;
+
+        for (int nRevision = 1; nRevision <= options.nRevisions; ++nRevision)
+        {
+            for (int i = 0; i < options.nFiles; i += 1 + nRevision % 3)
+                WriteFile(options.sDir + "\\other\\" + FileName(i), FileText(options.nLines, nRevision, i));
+
+            if (Run("svn commit -q -m change " + Quote(options.sDir + "\\other")) != 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    //==========================================================================>>
+    // libsvn, set up the way SvnClient does
+    //==========================================================================>>
+
+    class Client
+    {
+    public:
+        Client() : m_pool(0), m_ctx(0)
+        {
+            if (svn_cmdline_init("svn_bench", stderr) != EXIT_SUCCESS)
+                return;
+
+            m_pool = svn_pool_create(0);
+
+            if (!Check(svn_fs_initialize(m_pool)) ||
+                !Check(svn_config_ensure(0, m_pool)) ||
+                !Check(svn_client_create_context(&m_ctx, m_pool)) ||
+                !Check(svn_config_get_config(&m_ctx->config, 0, m_pool)))
+                m_ctx = 0;
+        }
+
+        ~Client()
+        {
+            if (m_pool)
+                apr_pool_destroy(m_pool);
+
+            apr_terminate();
+        }
+
+        bool IsValid() const { return m_ctx != 0; }
+
+        svn_client_ctx_t *ctx() { return m_ctx; }
+        apr_pool_t *pool()      { return m_pool; }
+
+        static bool Check(svn_error_t *perr)
+        {
+            if (!perr)
+                return true;
+
+            svn_handle_error2(perr, stderr, FALSE, "svn_bench: ");
+            svn_error_clear(perr);
+            return false;
+        }
+
+    private:
+        apr_pool_t *m_pool;
+        svn_client_ctx_t *m_ctx;
+    };
+
+    void IgnoreStatus(void *, const char *, svn_wc_status2_t *)
+    {
+    }
+
+    svn_error_t *WriteToFile(void *baton, const char *data, apr_size_t *len)
+    {
+        if (fwrite(data, 1, *len, reinterpret_cast<FILE *>(baton)) != *len)
+            return svn_error_create(SVN_ERR_IO_WRITE_ERROR, 0, "Cannot write the temporary file");
+
+        return SVN_NO_ERROR;
+    }
+
+    svn_error_t *BlameReceiver(void *baton, apr_int64_t, svn_revnum_t revision, const char *author, const char *,
+                               svn_revnum_t, const char *, const char *, const char *, const char *line, apr_pool_t *)
+    {
+        if (fprintf(reinterpret_cast<FILE *>(baton), "%6ld %10s %s\n", static_cast<long>(revision), author ? author : "-", line) < 0)
+            return svn_error_create(SVN_ERR_IO_WRITE_ERROR, 0, "Cannot write the temporary file");
+
+        return SVN_NO_ERROR;
+    }
+
+    svn_error_t *Status(Client& client, const char *szDir, apr_pool_t *pool)
+    {
+        svn_revnum_t result_rev;
+        svn_opt_revision_t requested_rev = { svn_opt_revision_head };
+
+        return svn_client_status2(&result_rev, szDir, &requested_rev, IgnoreStatus, 0,
+                                  true,  // recurse
+                                  false, // get_all
+                                  true,  // update
+                                  false, // no_ignore
+                                  true,  // ignore_externals
+                                  client.ctx(), pool);
+    }
+
+    svn_error_t *Update(Client& client, const char *szDir, apr_pool_t *pool)
+    {
+        apr_array_header_t *paths = apr_array_make(pool, 1, sizeof(const char *));
+        APR_ARRAY_PUSH(paths, const char *) = szDir;
+
+        svn_opt_revision_t revision = { svn_opt_revision_head };
+
+        return svn_client_update3(0, paths, &revision, svn_depth_unknown, false, false, false, client.ctx(), pool);
+    }
+
+    svn_error_t *Annotate(Client& client, const char *szFile, FILE *pOut, apr_pool_t *pool)
+    {
+        svn_opt_revision_t start = { svn_opt_revision_number }, base = { svn_opt_revision_base };
+        start.value.number = 0;
+
+        return svn_client_blame4(szFile, &base, &start, &base, svn_diff_file_options_create(pool), false, false, BlameReceiver, pOut, client.ctx(), pool);
+    }
+
+    svn_error_t *Cat(Client& client, const char *szFile, FILE *pOut, apr_pool_t *pool)
+    {
+        svn_opt_revision_t revision = { svn_opt_revision_base };
+
+        svn_stream_t *out = svn_stream_create(pOut, pool);
+        svn_stream_set_write(out, WriteToFile);
+
+        return svn_client_cat2(out, szFile, &revision, &revision, client.ctx(), pool);
+    }
+
+    //==========================================================================>>
+    // Timing and reporting
+    //==========================================================================>>
+
+    typedef chrono::steady_clock Clock;
+
+    double ElapsedMs(Clock::time_point tStart)
+    {
+        return chrono::duration<double, milli>(Clock::now() - tStart).count();
+    }
+
+    void Report(const Options& options, const char *szPhase, const char *szMethod, vector<double> vTimes)
+    {
+        if (vTimes.empty())
+        {
+            fprintf(stderr, "svn_bench: %s through %s failed\n", szPhase, szMethod);
+            return;
+        }
+
+        sort(vTimes.begin(), vTimes.end());
+
+        double dTotal = 0;
+        for (double d : vTimes)
+            dTotal += d;
+
+        printf("{\"suite\":\"farvcs\",\"vcs\":\"svn\",\"phase\":\"%s\",\"method\":\"%s\","
+               "\"files\":%d,\"lines\":%d,\"revisions\":%d,"
+               "\"iterations\":%lu,\"min_ms\":%.3f,\"median_ms\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f}\n",
+               szPhase, szMethod,
+               options.nFiles, options.nLines, options.nRevisions,
+               static_cast<unsigned long>(vTimes.size()),
+               vTimes.front(), vTimes[vTimes.size() / 2], dTotal / vTimes.size(), vTimes.back());
+
+        fflush(stdout);
+    }
+
+    // Times fOperation, which returns false on failure, after an untimed
+    // fPrepare each time. A failure ends the series and empties it.
+
+    template <typename Prepare, typename Operation>
+    vector<double> Time(int nIterations, const Prepare& fPrepare, const Operation& fOperation)
+    {
+        vector<double> vTimes;
+
+        for (int i = 0; i < nIterations; ++i)
+        {
+            if (!fPrepare())
+                return vector<double>();
+
+            Clock::time_point tStart = Clock::now();
+
+            if (!fOperation())
+                return vector<double>();
+
+            vTimes.push_back(ElapsedMs(tStart));
+        }
+
+        return vTimes;
+    }
+
+    bool Nothing() { return true; }
+
+    int RunBench(const Options& options)
+    {
+        Client client;
+
+        if (!client.IsValid())
+        {
+            fputs("svn_bench: cannot initialize libsvn\n", stderr);
+            return 2;
+        }
+
+        // file:///C:/... for a local path
+
+        string sRepo = options.sDir + "\\repo";
+        replace(sRepo.begin(), sRepo.end(), '\\', '/');
+        string sUrl = "file:///" + sRepo;
+
+        if (!BuildRepository(options, sUrl))
+        {
+            fputs("svn_bench: cannot set up the repository; are svn and svnadmin in PATH?\n", stderr);
+            return 2;
+        }
+
+        const string sWc = options.sDir + "\\wc";
+        const string sFile = sWc + '\\' + FileName(0);
+        const string sOut = options.sDir + "\\out.txt";
+
+        const char *szWc = svn_path_internal_style(sWc.c_str(), client.pool());
+        const char *szFile = svn_path_internal_style(sFile.c_str(), client.pool());
+
+        // Every operation gets a scratch pool, as a session of the module does
+
+        auto fLibsvn = [&](const function<svn_error_t *(apr_pool_t *)>& fCall)
+        {
+            return [&client, fCall]() -> bool
+            {
+                apr_pool_t *pool = svn_pool_create(client.pool());
+                bool bResult = Client::Check(fCall(pool));
+                svn_pool_destroy(pool);
+                return bResult;
+            };
+        };
+
+        auto fToOut = [&](const function<svn_error_t *(FILE *, apr_pool_t *)>& fCall)
+        {
+            return fLibsvn([&sOut, fCall](apr_pool_t *pool) -> svn_error_t *
+            {
+                FILE *pOut = fopen(sOut.c_str(), "wt");
+
+                if (!pOut)
+                    return svn_error_create(SVN_ERR_IO_WRITE_ERROR, 0, "Cannot create the output file");
+
+                svn_error_t *perr = fCall(pOut, pool);
+                fclose(pOut);
+                return perr;
+            });
+        };
+
+        auto fCommand = [](const string& sCmdLine) { return [sCmdLine]() { return Run(sCmdLine) == 0; }; };
+
+        // The working copy is taken back to the first revision before each update
+
+        auto fBackdate = fCommand("svn update -q -r 1 " + Quote(sWc));
+
+        Report(options, "update", "subprocess", Time(options.nIterations, fBackdate, fCommand("svn update -q " + Quote(sWc))));
+        Report(options, "update", "libsvn", Time(options.nIterations, fBackdate, fLibsvn([&](apr_pool_t *pool) { return Update(client, szWc, pool); })));
+
+        // The other operations run out of date, as the panel usually does
+
+        fBackdate();
+
+        Report(options, "status", "subprocess", Time(options.nIterations, Nothing, fCommand("svn status -u " + Quote(sWc))));
+        Report(options, "status", "libsvn", Time(options.nIterations, Nothing, fLibsvn([&](apr_pool_t *pool) { return Status(client, szWc, pool); })));
+
+        Run("svn update -q " + Quote(sWc)); // The blame walks the whole history then
+
+        Report(options, "annotate", "subprocess", Time(options.nIterations, Nothing, fCommand("svn blame " + Quote(sFile))));
+        Report(options, "annotate", "libsvn", Time(options.nIterations, Nothing, fToOut([&](FILE *pOut, apr_pool_t *pool) { return Annotate(client, szFile, pOut, pool); })));
+
+        Report(options, "cat", "subprocess", Time(options.nIterations, Nothing, fCommand("svn cat -r BASE " + Quote(sFile))));
+        Report(options, "cat", "libsvn", Time(options.nIterations, Nothing, fToOut([&](FILE *pOut, apr_pool_t *pool) { return Cat(client, szFile, pOut, pool); })));
+
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        fputs(cszUsage, stderr);
+        return 2;
+    }
+
+    bool bOwnDir = options.sDir.empty();
+
+    if (bOwnDir)
+    {
+        char szTemp[MAX_PATH];
+        ::GetTempPathA(MAX_PATH, szTemp);
+
+        char szDir[MAX_PATH];
+        sprintf(szDir, "%ssvn_bench.%lu", szTemp, ::GetCurrentProcessId());
+        options.sDir = szDir;
+    }
+
+    if (!::CreateDirectoryA(options.sDir.c_str(), 0) && ::GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        fprintf(stderr, "svn_bench: cannot create %s\n", options.sDir.c_str());
+        return 2;
+    }
+
+    int nResult = RunBench(options);
+
+    if (bOwnDir && !options.bKeep)
+        Run("cmd /c rd /s /q " + Quote(options.sDir));
+
+    return nResult;
+}
@@ -0,0 +1,177 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Generator of deterministic synthetic working copies for the
+             benchmarks
+*****************************************************************************/
+
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <time.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+#include "cvsentries.h"
+#include "wcgen.h"
+
+using namespace std;
+
+namespace
+{
+    const time_t cnBaseTime = 1262304000; // 2010-01-01, the file times are spread over the following year
+    const char cszCvsRoot[] = ":pserver:bench@localhost:/cvsroot";
+
+    void MakeDir(const tstring& sDir)
+    {
+#ifdef _WIN32
+        if (_tmkdir(sDir.c_str()) != 0)
+#else
+        if (::mkdir(sDir.c_str(), 0777) != 0)
+#endif
+            throw runtime_error("Cannot create directory " + sDir);
+    }
+
+    void SetFileTime(const tstring& sFile, time_t t)
+    {
+#ifdef _WIN32
+        struct _utimbuf times = { t, t };
+        _tutime(sFile.c_str(), &times);
+#else
+        struct utimbuf times = { t, t };
+        ::utime(sFile.c_str(), &times);
+#endif
+    }
+
+    void WriteFile(const tstring& sFile, const string& sContents)
+    {
+        ofstream os(sFile.c_str(), ios::binary);
+        os << sContents;
+
+        if (!os)
+            throw runtime_error("Cannot write " + sFile);
+    }
+
+    class Generator
+    {
+    public:
+        Generator(const WorkingCopyParams& params, WorkingCopyInfo& info) :
+            m_params(params),
+            m_info(info),
+            m_rng(params.nSeed)
+        {}
+
+        void Generate(const tstring& sDir, const string& sModule, int nLevel)
+        {
+            MakeDir(sDir);
+            MakeDir(CatPath(sDir.c_str(), _T("CVS")));
+
+            m_info.vDirs.push_back(sDir);
+
+            string sEntries;
+            bool bDirty = false;
+
+            for (int i = 0; i < m_params.nFilesPerDir; ++i)
+            {
+                tstring sName = sformat(_T("file%03d.c"), i);
+                tstring sPathName = CatPath(sDir.c_str(), sName.c_str());
+
+                time_t tWrite = cnBaseTime + static_cast<time_t>(m_rng() % (365 * 86400));
+                bool bModified = Chance(m_params.dDirtyRatio);
+
+                WriteFile(sPathName, sformat("/* %s/%s */\nint f%d(void) { return %d; }\n", sModule.c_str(), sName.c_str(), i, i));
+                SetFileTime(sPathName, tWrite);
+
+                // A modified file is the one written after the checkout
+
+                sEntries += sformat("/%s/1.%u/%s//\n", sName.c_str(), 1 + m_rng() % 20, FormatCvsTime(bModified ? tWrite - 86400 : tWrite).c_str());
+
+                if (bModified)
+                {
+                    bDirty = true;
+                    ++m_info.nDirtyFiles;
+                }
+                else if (Chance(m_params.dOutdatedRatio))
+                    m_info.vOutdatedFiles.push_back(sPathName);
+
+                ++m_info.nFiles;
+            }
+
+            if (bDirty)
+                m_info.vDirtyDirs.push_back(sDir);
+
+            if (nLevel < m_params.nDepth)
+            {
+                for (int i = 0; i < m_params.nFanOut; ++i)
+                {
+                    tstring sName = sformat(_T("dir%02d"), i);
+
+                    sEntries += sformat("D/%s////\n", sName.c_str());
+                    Generate(CatPath(sDir.c_str(), sName.c_str()), sModule + "/" + sName, nLevel + 1);
+                }
+            }
+
+            sEntries += "D\n";
+
+            tstring sAdminDir = CatPath(sDir.c_str(), _T("CVS"));
+
+            WriteFile(CatPath(sAdminDir.c_str(), _T("Entries")), sEntries);
+            WriteFile(CatPath(sAdminDir.c_str(), _T("Repository")), sModule + "\n");
+            WriteFile(CatPath(sAdminDir.c_str(), _T("Root")), string(cszCvsRoot) + "\n");
+        }
+
+    private:
+        // Not uniform_real_distribution: its results differ between the
+        // standard libraries, and the trees must not
+
+        bool Chance(double dRatio)
+        {
+            return m_rng() < dRatio * 4294967296.0;
+        }
+
+        const WorkingCopyParams& m_params;
+        WorkingCopyInfo& m_info;
+        mt19937 m_rng;
+    };
+}
+
+WorkingCopyInfo GenerateCvsWorkingCopy(const tstring& sRoot, const WorkingCopyParams& params)
+{
+    WorkingCopyInfo info;
+
+    Generator(params, info).Generate(sRoot, "bench", 0);
+
+    return info;
+}
+
+void RemoveTree(const tstring& sDir)
+{
+    vector<tstring> vSubDirs;
+
+    for (dir_iterator p(sDir); p != dir_iterator(); ++p)
+    {
+        tstring sPathName = CatPath(sDir.c_str(), p->cFileName);
+
+        if (p->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            vSubDirs.push_back(sPathName);
+        else
+#ifdef _WIN32
+            _tunlink(sPathName.c_str());
+#else
+            ::unlink(sPathName.c_str());
+#endif
+    }
+
+    for (const auto& sSubDir : vSubDirs)
+        RemoveTree(sSubDir);
+
+#ifdef _WIN32
+    _trmdir(sDir.c_str());
+#else
+    ::rmdir(sDir.c_str());
+#endif
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Generator of deterministic synthetic working copies for the
+             benchmarks
+*****************************************************************************/
+
+#include <vector>
+#include "vcs.h"
+
+/// <summary>
+/// Shape of a synthetic working copy. The same parameters and seed always
+/// give the same tree, the same file times and the same dirty and outdated
+/// files.
+/// </summary>
+struct WorkingCopyParams
+{
+    WorkingCopyParams() :
+        nDepth(3),
+        nFanOut(4),
+        nFilesPerDir(20),
+        dDirtyRatio(0.05),
+        dOutdatedRatio(0.02),
+        nSeed(1)
+    {}
+
+    int nDepth;            // Levels of subdirectories below the root
+    int nFanOut;           // Subdirectories of each directory above the last level
+    int nFilesPerDir;
+    double dDirtyRatio;    // Share of the files modified locally
+    double dOutdatedRatio; // Share of the unmodified files changed in the repository
+    unsigned long nSeed;
+};
+
+/// <summary>
+/// What has been generated, to check the results of the engine against.
+/// </summary>
+struct WorkingCopyInfo
+{
+    WorkingCopyInfo() : nFiles(0), nDirtyFiles(0) {}
+
+    std::vector<tstring> vDirs;          // All the directories, the root first
+    std::vector<tstring> vDirtyDirs;     // The directories with modified files
+    std::vector<tstring> vOutdatedFiles; // Full pathnames
+    size_t nFiles;
+    size_t nDirtyFiles;
+};
+
+/// <summary>
+/// Creates a CVS working copy in <paramref name="sRoot"/>, which must not
+/// exist. The outdated files are only reported, as <c>cvs -n up</c> would;
+/// the caller puts them in <c>OutdatedFiles</c>.
+/// </summary>
+/// <exception cref="std::runtime_error">Thrown if a file or directory cannot be created.</exception>
+WorkingCopyInfo GenerateCvsWorkingCopy(const tstring& sRoot, const WorkingCopyParams& params);
+
+/// <summary>
+/// Removes the directory with all its contents.
+/// </summary>
+void RemoveTree(const tstring& sDir);
@@ -0,0 +1,87 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    The status cache file shared by the plugin and the command line
+             tools: DirtyDirs, OutdatedFiles, the remote status markers and
+             the costliest directories
+*****************************************************************************/
+
+#include <fstream>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+#include "cachefile.h"
+#include "trace.h"
+
+using namespace std;
+
+namespace
+{
+    const TCHAR cszCacheFile[] = _T("farvcs.csh");
+}
+
+tstring GetDefaultCacheFile()
+{
+    return CatPath(GetLocalAppDataFolder().c_str(), cszCacheFile);
+}
+
+bool LoadCacheFile(const tstring& sFile, TSFileSet& dirtyDirs, TSFileSet& outdatedFiles, RemoteMarkerMap& remoteMarkers, DirCostTable& slowDirs)
+{
+    TraceSpan span("LoadCacheFile", "cache", sFile);
+
+    ifstream is(sFile.c_str(), ios::binary);
+
+    if (!is)
+        return false;
+
+    try
+    {
+        boost::archive::text_iarchive ia(is);
+
+        ia >> dirtyDirs;
+        ia >> outdatedFiles;
+
+        try
+        {
+            ia >> remoteMarkers;
+        }
+        catch (...)
+        {
+            remoteMarkers.clear(); // Written by an older version
+        }
+
+        try
+        {
+            ia >> slowDirs;
+        }
+        catch (...)
+        {
+            slowDirs.Clear(); // Ditto
+        }
+    }
+    catch (...)
+    {
+        dirtyDirs.Clear();
+        outdatedFiles.Clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool SaveCacheFile(const tstring& sFile, const TSFileSet& dirtyDirs, const TSFileSet& outdatedFiles, const RemoteMarkerMap& remoteMarkers, const DirCostTable& slowDirs)
+{
+    TraceSpan span("SaveCacheFile", "cache", sFile);
+
+    ofstream os(sFile.c_str(), ios::binary);
+
+    if (!os)
+        return false;
+
+    boost::archive::text_oarchive oa(os);
+
+    oa << dirtyDirs;
+    oa << outdatedFiles;
+    oa << remoteMarkers;
+    oa << slowDirs;
+
+    return static_cast<bool>(os);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    The status cache file shared by the plugin and the command line
+             tools: DirtyDirs, OutdatedFiles, the remote status markers and
+             the costliest directories
+*****************************************************************************/
+
+#include <map>
+#include "tsset.h"
+#include "dircosts.h"
+
+/// <summary>
+/// Markers returned by <c>IVcsData::UpdateStatusSince</c>, keyed by the
+/// directory the status has been updated for.
+/// </summary>
+typedef std::map<tstring, tstring, LessNoCase> RemoteMarkerMap;
+
+/// <summary>
+/// The cache file in the per-user data folder.
+/// </summary>
+tstring GetDefaultCacheFile();
+
+/// <summary>
+/// Reads the cache file. A missing file leaves the sets as they are; an
+/// unreadable one clears them. The markers and the directory costs are
+/// cleared if the file has been written by a version not saving them.
+/// </summary>
+/// <returns><c>true</c> if the sets have been read.</returns>
+bool LoadCacheFile(const tstring& sFile, TSFileSet& dirtyDirs, TSFileSet& outdatedFiles, RemoteMarkerMap& remoteMarkers, DirCostTable& slowDirs);
+
+/// <returns><c>false</c> if the file cannot be written.</returns>
+bool SaveCacheFile(const tstring& sFile, const TSFileSet& dirtyDirs, const TSFileSet& outdatedFiles, const RemoteMarkerMap& remoteMarkers, const DirCostTable& slowDirs);
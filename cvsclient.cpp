@@ -0,0 +1,726 @@
+/*****************************************************************************
+ File name:  cvsclient.cpp
+ Project:    FarVCS plugin
+ Purpose:    In-process client for the CVS client/server protocol
+ Compiler:   MS Visual C++ 8.0
+ Authors:    Michael Steinhaus
+ Dependencies: STL, Win32 or POSIX
+*****************************************************************************/
+
+#include <map>
+#include <fstream>
+#include <iterator>
+#include "cvsclient.h"
+#include "cvsentries.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+//==========================================================================>>
+// Parses CVSROOT. Recognized forms:
+//   :method:[user@]host:/path
+//   :method:/path          (local methods)
+//   /path or d:/path       (same as :local:)
+//==========================================================================>>
+
+bool CvsRoot::Parse( const string& sRoot, CvsRoot& root )
+{
+    root = CvsRoot();
+
+    if ( sRoot.empty() )
+        return false;
+
+    if ( sRoot[0] != ':' )
+    {
+        root.sMethod = "local";
+        root.sPath = sRoot;
+        return true;
+    }
+
+    size_t iMethodEnd = sRoot.find( ':', 1 );
+    if ( iMethodEnd == string::npos )
+        return false;
+
+    root.sMethod = sRoot.substr( 1, iMethodEnd-1 );
+    string sRest = sRoot.substr( iMethodEnd+1 );
+
+    if ( root.sMethod == "local" || root.sMethod == "fork" )
+    {
+        root.sPath = sRest;
+        return !root.sPath.empty();
+    }
+
+    size_t iAt = sRest.find( '@' );
+    if ( iAt != string::npos )
+    {
+        root.sUser = sRest.substr( 0, iAt );
+        sRest.erase( 0, iAt+1 );
+    }
+
+    size_t iHostEnd = sRest.find( ':' );
+    if ( iHostEnd == string::npos )
+        return false;
+
+    root.sHost = sRest.substr( 0, iHostEnd );
+    root.sPath = sRest.substr( iHostEnd+1 );
+
+    // Port numbers (host:2401:/path) are only meaningful for pserver which we don't speak anyway
+
+    size_t iSlash = root.sPath.find( '/' );
+    if ( iSlash != string::npos && iSlash > 0 && root.sPath.find_first_not_of( "0123456789" ) == iSlash )
+        root.sPath.erase( 0, iSlash );
+
+    return !root.sHost.empty() && !root.sPath.empty();
+}
+
+//==========================================================================>>
+// 'Modified' request carries the contents of the file
+//==========================================================================>>
+
+bool CvsRequest::Modified( const string& sName, const string& sFullPathName )
+{
+    ifstream f( sFullPathName.c_str(), ios::binary );
+
+    if ( !f )
+        return false;
+
+    string sContents( (istreambuf_iterator<char>(f)), istreambuf_iterator<char>() );
+
+    m_s += "Modified " + sName + '\n';
+    m_s += "u=rw,g=r,o=r\n";
+    m_s += sformat( "%lu\n", (unsigned long)sContents.size() );
+    m_s += sContents;
+    return true;
+}
+
+//==========================================================================>>
+// Session pool
+//==========================================================================>>
+
+namespace
+{
+    CriticalSection PoolCs;
+    map<string, CvsSession*> Pool; // Keyed by CVSROOT as written in CVS/Root
+
+    string GetEnv( const char *szName, const char *szDefault )
+    {
+#ifdef _WIN32
+        char szBuf[MAX_PATH];
+        DWORD dwLen = ::GetEnvironmentVariableA( szName, szBuf, _countof(szBuf) );
+        return dwLen > 0 && dwLen < _countof(szBuf) ? szBuf : szDefault;
+#else
+        const char *szValue = ::getenv( szName );
+        return szValue && *szValue ? szValue : szDefault;
+#endif
+    }
+
+    // The responses we are prepared to receive. We never send requests modifying
+    // the working copy, but the server insists on some of them being listed.
+
+    const char cszValidResponses[] =
+        "Valid-responses ok error Valid-requests M MT E F Checked-in New-entry Checksum Copy-file "
+        "Updated Created Update-existing Merged Patched Rcs-diff Mode Mod-time Removed Remove-entry "
+        "Set-static-directory Clear-static-directory Set-sticky Clear-sticky\n";
+}
+
+CvsSession *CvsSession::Acquire( const string& sRoot )
+{
+    CSGuard _(PoolCs);
+
+    map<string, CvsSession*>::iterator p = Pool.find( sRoot );
+
+    if ( p != Pool.end() )
+    {
+        if ( !p->second->m_bBroken )
+            return p->second;
+
+        delete p->second;
+        Pool.erase( p );
+    }
+
+    CvsRoot root;
+
+    if ( !CvsRoot::Parse( sRoot, root ) )
+        return 0;
+
+    CvsSession *pSession = new CvsSession( root );
+
+    if ( pSession->m_bBroken )
+    {
+        delete pSession;
+        return 0;
+    }
+
+    Pool[sRoot] = pSession;
+    return pSession;
+}
+
+void CvsSession::CloseAll()
+{
+    CSGuard _(PoolCs);
+
+    for ( map<string, CvsSession*>::iterator p = Pool.begin(); p != Pool.end(); ++p )
+        delete p->second;
+
+    Pool.clear();
+}
+
+//==========================================================================>>
+// Session proper
+//==========================================================================>>
+
+CvsSession::CvsSession( const CvsRoot& root ) :
+#ifdef _WIN32
+    m_HProcess( INVALID_HANDLE_VALUE ),
+    m_HToServer( INVALID_HANDLE_VALUE ),
+    m_HFromServer( INVALID_HANDLE_VALUE ),
+#else
+    m_nPid( -1 ),
+    m_fdToServer( -1 ),
+    m_fdFromServer( -1 ),
+#endif
+    m_bBroken( true )
+{
+    if ( !Start( root ) )
+        return;
+
+    m_bBroken = false;
+
+    // Handshake
+
+    if ( !Send( "Root " + root.sPath + '\n' + cszValidResponses + "valid-requests\n" ) )
+        return;
+
+    ResponseSink fNoSink = []( const char *, bool ) { return false; };
+
+    for ( string sLine; ; )
+    {
+        if ( !ReadLine( sLine, fNoSink ) )
+            return;
+
+        if ( sLine == "ok" )
+            break;
+
+        if ( sLine.compare( 0, 15, "Valid-requests " ) == 0 )
+        {
+            vector<string> v = SplitString( sLine.substr( 15 ), ' ' );
+            m_ValidRequests.insert( v.begin(), v.end() );
+        }
+        else if ( sLine.compare( 0, 5, "error" ) == 0 )
+        {
+            m_bBroken = true;
+            return;
+        }
+    }
+
+    // We only need a handful of requests, but all of them
+
+    static const char *cszRequired[] = { "Root", "Directory", "Entry", "Unchanged", "Argument", "UseUnchanged", "update", "status", "annotate" };
+
+    for ( size_t i = 0; i < _countof(cszRequired); ++i )
+        if ( !IsRequestValid( cszRequired[i] ) )
+        {
+            m_bBroken = true;
+            return;
+        }
+
+    Send( "UseUnchanged\n" ); // No response expected
+}
+
+CvsSession::~CvsSession()
+{
+#ifdef _WIN32
+    m_HToServer.Close(); // The server exits on EOF
+
+    if ( m_HProcess.IsValid() && ::WaitForSingleObject( m_HProcess, 1000 ) != WAIT_OBJECT_0 )
+        ::TerminateProcess( m_HProcess, (UINT)-1 );
+#else
+    if ( m_fdToServer >= 0 )
+        ::close( m_fdToServer ); // The server exits on EOF
+
+    if ( m_fdFromServer >= 0 )
+        ::close( m_fdFromServer );
+
+    if ( m_nPid <= 0 )
+        return;
+
+    // A second to exit, as on Windows
+
+    pid_t nExited = 0;
+    int nStatus;
+
+    for ( int i = 0; i < 50 && (nExited = ::waitpid( m_nPid, &nStatus, WNOHANG )) == 0; ++i )
+        ::usleep( 20000 );
+
+    if ( nExited == 0 )
+    {
+        ::kill( m_nPid, SIGKILL );
+        ::waitpid( m_nPid, &nStatus, 0 );
+    }
+#endif
+}
+
+//==========================================================================>>
+// Starts the server process. ':fork:' and ':local:' run 'cvs server'
+// locally, ':ext:' runs it through CVS_RSH. Other methods need
+// authentication we don't implement, so the caller spawns cvs as before.
+//==========================================================================>>
+
+bool CvsSession::Start( const CvsRoot& root )
+{
+    string sServer = GetEnv( "CVS_SERVER", "cvs" );
+    string sCmdLine;
+
+    if ( root.sMethod == "fork" || root.sMethod == "local" )
+        sCmdLine = sServer + " server";
+    else if ( root.sMethod == "ext" )
+        sCmdLine = GetEnv( "CVS_RSH", "ssh" ) + (root.sUser.empty() ? "" : " -l " + root.sUser) + ' ' + root.sHost + ' ' + sServer + " server";
+    else
+        return false;
+
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES sa = { sizeof sa, 0, TRUE };
+    const unsigned long cdwPipeBufferSize = 65536;
+
+    HANDLE hChildStdinRd, hChildStdinWr, hChildStdoutRd, hChildStdoutWr;
+
+    if ( !::CreatePipe( &hChildStdinRd, &hChildStdinWr, &sa, cdwPipeBufferSize ) )
+        return false;
+
+    W32Handle HChildStdinRd( hChildStdinRd );
+    m_HToServer = W32Handle( hChildStdinWr );
+
+    if ( !::CreatePipe( &hChildStdoutRd, &hChildStdoutWr, &sa, cdwPipeBufferSize ) )
+        return false;
+
+    W32Handle HChildStdoutWr( hChildStdoutWr );
+    m_HFromServer = W32Handle( hChildStdoutRd );
+
+    // Our ends must not be inherited, otherwise the server never sees EOF
+
+    ::SetHandleInformation( m_HToServer, HANDLE_FLAG_INHERIT, 0 );
+    ::SetHandleInformation( m_HFromServer, HANDLE_FLAG_INHERIT, 0 );
+
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+
+    memset( &si, 0, sizeof si );
+    si.cb = sizeof si;
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = HChildStdinRd;
+    si.hStdOutput = HChildStdoutWr;
+    si.hStdError = 0; // Anything the server prints to stderr is not a part of the protocol
+
+    char szVolatileCmdLine[2048]; // ::CreateProcess wants to modify the command line so we create a read-write copy
+    strncpy_s( szVolatileCmdLine, sCmdLine.c_str(), _TRUNCATE );
+
+    if ( !::CreateProcessA( 0, szVolatileCmdLine, 0, 0, TRUE, CREATE_NO_WINDOW, 0, 0, &si, &pi ) )
+        return false;
+
+    ::CloseHandle( pi.hThread );
+    m_HProcess = W32Handle( pi.hProcess );
+    return true;
+#else
+    int fdToServer[2], fdFromServer[2];
+
+    if ( ::pipe( fdToServer ) != 0 )
+        return false;
+
+    m_fdToServer = fdToServer[1];
+
+    if ( ::pipe( fdFromServer ) != 0 )
+    {
+        ::close( fdToServer[0] );
+        return false;
+    }
+
+    m_fdFromServer = fdFromServer[0];
+
+    // None of the ends are inherited as they are: ours must not be, otherwise
+    // the server never sees EOF, and the server's are duplicated onto its
+    // standard handles
+
+    for ( int fd : { fdToServer[0], fdToServer[1], fdFromServer[0], fdFromServer[1] } )
+        ::fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    m_nPid = ::fork();
+
+    if ( m_nPid == 0 )
+    {
+        ::dup2( fdToServer[0], 0 );
+        ::dup2( fdFromServer[1], 1 );
+
+        // Anything the server prints to stderr is not a part of the protocol
+
+        int fdNull = ::open( "/dev/null", O_WRONLY );
+        if ( fdNull >= 0 )
+            ::dup2( fdNull, 2 );
+
+        ::execl( "/bin/sh", "sh", "-c", sCmdLine.c_str(), static_cast<char*>(0) );
+        ::_exit( 127 );
+    }
+
+    ::close( fdToServer[0] );
+    ::close( fdFromServer[1] );
+
+    return m_nPid > 0;
+#endif
+}
+
+bool CvsSession::Send( const string& s )
+{
+    // The whole request is written before any response is read. The server
+    // doesn't respond until it gets the command, which comes last.
+
+    for ( size_t nSent = 0; nSent < s.size(); )
+    {
+#ifdef _WIN32
+        DWORD dwWritten = 0;
+
+        if ( !::WriteFile( m_HToServer, s.data() + nSent, static_cast<DWORD>(s.size() - nSent), &dwWritten, 0 ) )
+        {
+            m_bBroken = true;
+            return false;
+        }
+
+        nSent += dwWritten;
+#else
+        ssize_t nWritten = ::write( m_fdToServer, s.data() + nSent, s.size() - nSent );
+
+        if ( nWritten < 0 && errno == EINTR )
+            continue;
+
+        if ( nWritten < 0 )
+        {
+            m_bBroken = true;
+            return false;
+        }
+
+        nSent += nWritten;
+#endif
+    }
+
+    return true;
+}
+
+// Waits for the server output without blocking the UI: while there is nothing
+// to read, the sink is called with 0 to give the user a chance to cancel.
+
+bool CvsSession::ReadBytes( size_t n, const ResponseSink& fSink )
+{
+    while ( m_sBuf.size() < n )
+    {
+#ifdef _WIN32
+        DWORD dwAvail = 0;
+
+        if ( !::PeekNamedPipe( m_HFromServer, 0, 0, 0, &dwAvail, 0 ) )
+        {
+            m_bBroken = true; // The server has gone away
+            return false;
+        }
+
+        if ( dwAvail == 0 )
+        {
+            if ( fSink( 0, false ) )
+            {
+                m_bBroken = true; // Cancelled in the middle of a response
+                return false;
+            }
+
+            ::Sleep( 20 );
+            continue;
+        }
+
+        char buf[65536];
+        DWORD dwRead = 0;
+
+        if ( !::ReadFile( m_HFromServer, buf, min( dwAvail, (DWORD)sizeof buf ), &dwRead, 0 ) || dwRead == 0 )
+        {
+            m_bBroken = true;
+            return false;
+        }
+
+        m_sBuf.append( buf, dwRead );
+#else
+        // Waiting for the output is the pause between the calls of the sink
+
+        pollfd pfd = { m_fdFromServer, POLLIN, 0 };
+        int nReady = ::poll( &pfd, 1, 20 );
+
+        if ( nReady < 0 && errno != EINTR )
+        {
+            m_bBroken = true;
+            return false;
+        }
+
+        if ( nReady <= 0 )
+        {
+            if ( fSink( 0, false ) )
+            {
+                m_bBroken = true; // Cancelled in the middle of a response
+                return false;
+            }
+
+            continue;
+        }
+
+        char buf[65536];
+        ssize_t nRead = ::read( m_fdFromServer, buf, sizeof buf );
+
+        if ( nRead < 0 && errno == EINTR )
+            continue;
+
+        if ( nRead <= 0 )
+        {
+            m_bBroken = true; // The server has gone away
+            return false;
+        }
+
+        m_sBuf.append( buf, nRead );
+#endif
+    }
+
+    return true;
+}
+
+bool CvsSession::ReadLine( string& sLine, const ResponseSink& fSink )
+{
+    for ( size_t nScanned = 0; ; )
+    {
+        size_t iEol = m_sBuf.find( '\n', nScanned );
+
+        if ( iEol != string::npos )
+        {
+            sLine.assign( m_sBuf, 0, iEol );
+            m_sBuf.erase( 0, iEol+1 );
+            return true;
+        }
+
+        nScanned = m_sBuf.size();
+
+        if ( !ReadBytes( m_sBuf.size()+1, fSink ) )
+            return false;
+    }
+}
+
+//==========================================================================>>
+// Skips the body of a response we don't act upon. Only the read-only
+// commands are run through the session, so these are not expected, but
+// the stream must stay in sync if the server sends one anyway.
+//==========================================================================>>
+
+bool CvsSession::SkipResponse( const string& sName, const ResponseSink& fSink )
+{
+    static const char *cszArgOnly[]     = { "Checksum", "Mode", "Mod-time", "Module-expansion" };
+    static const char *cszPathOnly[]    = { "Removed", "Remove-entry", "Set-static-directory", "Clear-static-directory", "Clear-sticky", "Clear-template", "Notified" };
+    static const char *cszPathAndLine[] = { "Checked-in", "New-entry", "Set-sticky", "Copy-file" };
+    static const char *cszWithFile[]    = { "Updated", "Created", "Update-existing", "Merged", "Patched", "Rcs-diff" };
+
+    struct { const char **pNames; size_t nNames; int nExtraLines; bool bFile; } kinds[] =
+    {
+        { cszArgOnly,     _countof(cszArgOnly),     0, false },
+        { cszPathOnly,    _countof(cszPathOnly),    1, false },
+        { cszPathAndLine, _countof(cszPathAndLine), 2, false },
+        { cszWithFile,    _countof(cszWithFile),    3, true  }  // Repository, entry, mode; then size and contents
+    };
+
+    for ( size_t k = 0; k < _countof(kinds); ++k )
+        for ( size_t i = 0; i < kinds[k].nNames; ++i )
+        {
+            if ( sName != kinds[k].pNames[i] )
+                continue;
+
+            string sLine;
+
+            for ( int j = 0; j < kinds[k].nExtraLines; ++j )
+                if ( !ReadLine( sLine, fSink ) )
+                    return false;
+
+            if ( !kinds[k].bFile )
+                return true;
+
+            if ( !ReadLine( sLine, fSink ) )
+                return false;
+
+            // The size line is prefixed with 'z' if the contents is gzipped
+
+            size_t nSize = strtoul( sLine.c_str() + (sLine[0] == 'z' ? 1 : 0), 0, 10 );
+
+            if ( !ReadBytes( nSize, fSink ) )
+                return false;
+
+            m_sBuf.erase( 0, nSize );
+            return true;
+        }
+
+    m_bBroken = true; // Unknown response, can't tell how long it is
+    return false;
+}
+
+CvsSession::EResult CvsSession::Run( const CvsRequest& request, const ResponseSink& fSink )
+{
+    if ( m_bBroken || !Send( request.str() ) )
+        return rsUnavailable;
+
+    bool bAnythingReported = false;
+    string sLine;
+    string sTagged; // 'MT' responses are collected into a single line
+
+    for ( ; ; )
+    {
+        if ( !ReadLine( sLine, fSink ) )
+            return bAnythingReported ? rsError : rsUnavailable;
+
+        size_t iSpace = sLine.find( ' ' );
+        string sName = sLine.substr( 0, iSpace );
+        const char *szArg = iSpace == string::npos ? "" : sLine.c_str() + iSpace + 1;
+
+        if ( sName == "ok" )
+            return rsOk;
+
+        if ( sName == "error" )
+        {
+            // "error errno text"; the text, if any, is worth showing
+
+            const char *szText = strchr( szArg, ' ' );
+            if ( szText && szText[1] )
+                fSink( szText+1, true );
+
+            return rsError;
+        }
+
+        bool bCancel = false;
+
+        if ( sName == "M" || sName == "E" )
+        {
+            bCancel = fSink( szArg, sName == "E" );
+            bAnythingReported = true;
+        }
+        else if ( sName == "MT" )
+        {
+            // "MT +tag", "MT -tag", "MT newline", "MT text ...", "MT fname ..." etc.
+
+            if ( strcmp( szArg, "newline" ) == 0 )
+            {
+                bCancel = fSink( sTagged.c_str(), false );
+                sTagged.clear();
+                bAnythingReported = true;
+            }
+            else if ( *szArg != '+' && *szArg != '-' )
+            {
+                const char *szText = strchr( szArg, ' ' );
+                if ( szText )
+                    sTagged += szText+1;
+            }
+        }
+        else if ( sName == "F" || sName == "Valid-requests" )
+            ;
+        else if ( !SkipResponse( sName, fSink ) )
+            return bAnythingReported ? rsError : rsUnavailable;
+
+        if ( bCancel )
+        {
+            m_bBroken = true; // The rest of the response would confuse the next command
+            return rsError;
+        }
+    }
+}
+
+//==========================================================================>>
+// Working copy description
+//==========================================================================>>
+
+namespace
+{
+    void DescribeDirectory( CvsRequest& request, const CvsSession& session, const string& sDir, const VcsEntries& entries,
+                            const string& sRootPath, const string& sLocalDir, const VcsDataLoader& fLoadSubDir )
+    {
+        string sRepository = ReadCvsAdminLine( sDir, "Repository" );
+
+        if ( sRepository.empty() || sRepository[0] != '/' )
+            sRepository = sRootPath + '/' + sRepository;
+
+        request.Directory( sLocalDir, sRepository );
+
+        char cTagType;
+        string sTag;
+
+        if ( ReadCvsTagFile( sDir, cTagType, sTag ) )
+            request.Sticky( cTagType + sTag );
+
+        for ( VcsEntries::const_iterator p = entries.begin(); p != entries.end(); ++p )
+        {
+            const VcsEntry& entry = p->second;
+
+            if ( entry.bDir || !IsVcsFile( entry.status ) || entry.status == fsAddedRepo )
+                continue;
+
+            // The server only looks at the timestamp to detect unresolved conflicts
+
+            request.Entry( '/' + p->first + '/' + entry.sRevision + '/' + (entry.status == fsConflict ? "+=" : "") + '/' + entry.sOptions + '/' + entry.sTagdate );
+
+            if ( entry.status == fsGhost || entry.status == fsRemoved )
+                continue; // Lost files are reported by not mentioning them
+
+            if ( entry.status == fsModified || entry.status == fsConflict || entry.status == fsAdded )
+            {
+                if ( session.IsRequestValid( "Is-modified" ) )
+                    request.IsModified( p->first );
+                else
+                    request.Modified( p->first, CatPath( sDir.c_str(), p->first.c_str() ) );
+            }
+            else
+                request.Unchanged( p->first );
+        }
+
+        // The subdirectories once all the files are sent: each starts with
+        // its own Directory
+
+        if ( !fLoadSubDir )
+            return;
+
+        PathBuilder path( sDir );
+
+        for ( VcsEntries::const_iterator p = entries.begin(); p != entries.end(); ++p )
+        {
+            const VcsEntry& entry = p->second;
+
+            if ( !entry.bDir || !IsVcsFile( entry.status ) || entry.status == fsAddedRepo || p->first == "CVS" )
+                continue;
+
+            size_t nMark = path.Push( p->first );
+
+            boost::intrusive_ptr<IVcsData> pSubDirData = IsCvsDir( path.str() ) ? fLoadSubDir( path.str() ) : 0;
+
+            path.Pop( nMark );
+
+            if ( pSubDirData && pSubDirData->IsValid() )
+                DescribeDirectory( request, session, pSubDirData->getDir(), pSubDirData->entries(), sRootPath, sLocalDir + '/' + p->first, fLoadSubDir );
+        }
+    }
+}
+
+void DescribeCvsWorkingCopy( CvsRequest& request, const CvsSession& session, const string& sDir, const VcsEntries& entries, const VcsDataLoader& fLoadSubDir )
+{
+    CvsRoot root;
+    CvsRoot::Parse( ReadCvsAdminLine( sDir, "Root" ), root );
+
+    DescribeDirectory( request, session, sDir, entries, root.sPath, ".", fLoadSubDir );
+
+    // The command runs in the last directory mentioned
+
+    if ( fLoadSubDir )
+    {
+        string sRepository = ReadCvsAdminLine( sDir, "Repository" );
+        request.Directory( ".", sRepository.empty() || sRepository[0] != '/' ? root.sPath + '/' + sRepository : sRepository );
+    }
+}
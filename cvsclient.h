@@ -0,0 +1,132 @@
+/*****************************************************************************
+ File name:  cvsclient.h
+ Project:    FarVCS plugin
+ Purpose:    In-process client for the CVS client/server protocol
+ Compiler:   MS Visual C++ 8.0
+ Authors:    Michael Steinhaus
+ Dependencies: STL, Win32 or POSIX
+*****************************************************************************/
+
+#ifndef __CVSCLIENT_H
+#define __CVSCLIENT_H
+
+#include <string>
+#include <set>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+#include "vcs.h"
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+//==========================================================================>>
+// Parsed contents of CVS/Root, e.g. ":ext:user@host:/cvsroot"
+//==========================================================================>>
+
+struct CvsRoot
+{
+    std::string sMethod; // "fork", "local", "ext", "pserver", ...
+    std::string sUser;
+    std::string sHost;
+    std::string sPath;
+
+    static bool Parse( const std::string& sRoot, CvsRoot& root );
+};
+
+//==========================================================================>>
+// Accumulates the requests of a single command. The whole text is sent
+// to the server at once, so that the requests are pipelined rather than
+// exchanged one by one.
+//==========================================================================>>
+
+class CvsRequest
+{
+public:
+    void GlobalOption( const std::string& sOption )                       { m_s += "Global_option " + sOption + '\n'; }
+    void Argument( const std::string& sArgument )                         { m_s += "Argument " + sArgument + '\n'; }
+    void Directory( const std::string& sLocalDir, const std::string& sRepository ) { m_s += "Directory " + sLocalDir + '\n' + sRepository + '\n'; }
+    void Sticky( const std::string& sTag )                                { m_s += "Sticky " + sTag + '\n'; }
+    void Entry( const std::string& sEntryLine )                           { m_s += "Entry " + sEntryLine + '\n'; }
+    void Unchanged( const std::string& sName )                            { m_s += "Unchanged " + sName + '\n'; }
+    void IsModified( const std::string& sName )                           { m_s += "Is-modified " + sName + '\n'; }
+    bool Modified( const std::string& sName, const std::string& sFullPathName );
+    void Command( const std::string& sCommand )                           { m_s += sCommand + '\n'; }
+
+    const std::string& str() const { return m_s; }
+
+private:
+    std::string m_s;
+};
+
+//==========================================================================>>
+// A connection to a 'cvs server' process kept open between the commands.
+// One session per CVSROOT is kept in a pool.
+//
+// On POSIX, a write to a server that has gone away raises SIGPIPE; the
+// process using the sessions is expected to ignore it.
+//==========================================================================>>
+
+class CvsSession : private boost::noncopyable
+{
+public:
+    enum EResult
+    {
+        rsOk,          // The server responded "ok"
+        rsError,       // The server responded "error" or the user cancelled
+        rsUnavailable  // Nothing has been processed; the caller may retry the command otherwise
+    };
+
+    // Called for every line of the command output (bStdErr tells the 'E' responses from
+    // the 'M' ones) and with 0 while waiting for the server. Returns true to cancel.
+
+    typedef boost::function<bool( const char *szLine, bool bStdErr )> ResponseSink;
+
+    // Returns the pooled session for the root, starting it if necessary.
+    // Returns 0 if the access method is not supported or the server cannot be started.
+
+    static CvsSession *Acquire( const std::string& sRoot );
+    static void CloseAll();
+
+    EResult Run( const CvsRequest& request, const ResponseSink& fSink );
+
+    bool IsRequestValid( const char *szRequest ) const { return m_ValidRequests.find( szRequest ) != m_ValidRequests.end(); }
+
+private:
+    explicit CvsSession( const CvsRoot& root );
+    ~CvsSession();
+
+    bool Start( const CvsRoot& root );
+    bool Send( const std::string& s );
+    bool ReadLine( std::string& sLine, const ResponseSink& fSink );
+    bool ReadBytes( size_t n, const ResponseSink& fSink );
+    bool SkipResponse( const std::string& sName, const ResponseSink& fSink );
+
+#ifdef _WIN32
+    W32Handle m_HProcess;
+    W32Handle m_HToServer;
+    W32Handle m_HFromServer;
+#else
+    pid_t m_nPid;
+    int m_fdToServer;
+    int m_fdFromServer;
+#endif
+
+    std::string m_sBuf;                      // Read but not yet consumed server output
+    std::set<std::string> m_ValidRequests;
+    bool m_bBroken;                          // The conversation is out of sync; the session must be discarded
+};
+
+//==========================================================================>>
+// Describes the working copy in sDir, whose entries are given, as the
+// arguments of a command: the Directory request, the sticky tag and the
+// entries of the files, and, if fLoadSubDir is given, the same for every
+// VCS subdirectory, loaded with it, down the tree. All the files of a
+// directory are sent before any of its subdirectories: an entry belongs to
+// the last Directory sent.
+//==========================================================================>>
+
+typedef boost::function<boost::intrusive_ptr<IVcsData>( const std::string& sDir )> VcsDataLoader;
+
+void DescribeCvsWorkingCopy( CvsRequest& request, const CvsSession& session, const std::string& sDir, const VcsEntries& entries, const VcsDataLoader& fLoadSubDir );
+
+#endif // __CVSCLIENT_H
@@ -0,0 +1,218 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Reading of the CVS administrative files of a working directory:
+             CVS/Entries, CVS/Entries.Log and CVS/Tag
+*****************************************************************************/
+
+#include <fstream>
+#include <string.h>
+#include <time.h>
+#include "cvsentries.h"
+
+using namespace std;
+
+namespace
+{
+    tstring GetAdminFileName(const tstring& sDir, const TCHAR *szName)
+    {
+        return CatPath(CatPath(sDir.c_str(), _T("CVS")).c_str(), szName);
+    }
+}
+
+// Not asctime itself: it is locale and runtime dependent and not thread-safe.
+// Nor sformat: this is done twice per file checked, so the fixed-width
+// fields are written by hand.
+
+bool FormatCvsTime(time_t t, TCHAR (&szTime)[cnCvsTimeSize])
+{
+    static const TCHAR cszDays[]   = _T("SunMonTueWedThuFriSat");
+    static const TCHAR cszMonths[] = _T("JanFebMarAprMayJunJulAugSepOctNovDec");
+    struct tm tm;
+
+    szTime[0] = 0;
+
+#ifdef _WIN32
+    if (gmtime_s(&tm, &t) != 0)
+        return false;
+#else
+    if (gmtime_r(&t, &tm) == 0)
+        return false;
+#endif
+
+    int nYear = tm.tm_year + 1900;
+
+    if (nYear < 1000 || nYear > 9999)
+        return false;
+
+    TCHAR *p = szTime;
+
+    auto Put = [&p](const TCHAR *sz, size_t n) { for (size_t i = 0; i < n; ++i) *p++ = sz[i]; };
+    auto Put2 = [&p](int n) { *p++ = static_cast<TCHAR>(_T('0') + n / 10); *p++ = static_cast<TCHAR>(_T('0') + n % 10); };
+
+    Put(cszDays + 3 * tm.tm_wday, 3);
+    *p++ = _T(' ');
+    Put(cszMonths + 3 * tm.tm_mon, 3);
+    *p++ = _T(' ');
+    Put2(tm.tm_mday);
+    *p++ = _T(' ');
+    Put2(tm.tm_hour);
+    *p++ = _T(':');
+    Put2(tm.tm_min);
+    *p++ = _T(':');
+    Put2(tm.tm_sec);
+    *p++ = _T(' ');
+    Put2(nYear / 100);
+    Put2(nYear % 100);
+    *p = 0;
+
+    return true;
+}
+
+tstring FormatCvsTime(time_t t)
+{
+    TCHAR szTime[cnCvsTimeSize];
+    FormatCvsTime(t, szTime);
+    return szTime;
+}
+
+bool IsCvsDir(const tstring& sDir)
+{
+    // Asked for every subdirectory met by a traversal: the path is built in
+    // a buffer of the thread, which soon stops growing
+
+    static thread_local PathBuilder path;
+
+    path.Reset(sDir);
+    path.Push(_T("CVS"));
+    path.Push(_T("Entries"));
+
+    return ::GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+bool ReadCvsEntriesFile(const tstring& sDir, bool bEntriesLog, VcsEntries& entries)
+{
+    ifstream fEntries(GetAdminFileName(sDir, bEntriesLog ? _T("Entries.Log") : _T("Entries")).c_str());
+
+    if (!fEntries)
+        return false;
+
+    char buf[4096];
+
+    while (fEntries.getline(buf, sizeof buf))
+    {
+        Statistics().nAdminBytesParsed.Add(fEntries.gcount());
+
+        const char *pStartPos = buf;
+
+        bool bRemoveEntry = false;
+        bool bDir = false;
+
+        if (bEntriesLog)
+        {
+            if (buf[0] == 'R' && buf[1] == ' ')
+                bRemoveEntry = true;
+            else if (buf[0] == 'A' && buf[1] == ' ')
+                bRemoveEntry = false;
+            else
+                continue; // Unrecognized format
+            pStartPos += 2;
+        }
+
+        if (pStartPos[0] == 'D')
+        {
+            bDir = true;
+            ++pStartPos;
+        }
+
+        if (pStartPos[0] != '/') // Unrecognized format, or "D" alone
+            continue;
+
+        vector<tstring> vFields = SplitString(pStartPos + 1, '/');
+        if (vFields.empty()) // Unrecognized format
+            continue;
+
+        if (!bRemoveEntry)
+            entries.insert(make_pair(vFields[0], VcsEntry(bDir, vFields, vFields.size() > 1 && vFields[1][0] == '-' ? fsRemoved : fsGhost)));
+        else
+            entries.erase(vFields[0]);
+    }
+
+    return true;
+}
+
+bool ReadCvsTagFile(const tstring& sDir, TCHAR& cTagType, tstring& sTag)
+{
+    cTagType = 0;
+    sTag.clear();
+
+    ifstream fTag(GetAdminFileName(sDir, _T("Tag")).c_str());
+
+    if (!fTag)
+        return false;
+
+    // Read the first line of the file and ignore the rest
+
+    char buf[4096];
+
+    if (!fTag.getline(buf, sizeof buf))
+        return false;
+
+    Statistics().nAdminBytesParsed.Add(fTag.gcount());
+
+    cTagType = *buf;
+    sTag = buf + 1;
+    return true;
+}
+
+tstring ReadCvsAdminLine(const tstring& sDir, const TCHAR *szName)
+{
+    ifstream f(GetAdminFileName(sDir, szName).c_str());
+
+    char buf[4096] = "";
+    f.getline(buf, sizeof buf);
+    buf[sizeof buf - 1] = 0;
+
+    return buf;
+}
+
+bool IsCvsFileModified(const FILETIME& ftLastWriteTime, const tstring& sCvsTimestamp)
+{
+    if (sCvsTimestamp.empty())
+        return false;
+
+    Statistics().nModifiedChecks.Add();
+
+    const unsigned long long cnUnixEpoch = 116444736000000000ULL; // 1970-01-01 in FILETIME units
+
+    unsigned long long nFileTime = (static_cast<unsigned long long>(ftLastWriteTime.dwHighDateTime) << 32) + ftLastWriteTime.dwLowDateTime;
+    time_t itime = static_cast<time_t>((nFileTime - cnUnixEpoch) / 10000000);
+
+    // CVS pads a single-digit day with a space. Anything longer than a time
+    // cannot match.
+
+    TCHAR szTimestamp[cnCvsTimeSize];
+
+    if (sCvsTimestamp.size() >= cnCvsTimeSize)
+        return true;
+
+    memcpy(szTimestamp, sCvsTimestamp.c_str(), (sCvsTimestamp.size() + 1) * sizeof(TCHAR));
+
+    if (TCHAR *pPadding = _tcsstr(szTimestamp, _T("  ")))
+        pPadding[1] = _T('0');
+
+    // An hour off is tolerated: the last write times on FAT shift with the DST
+
+    TCHAR szTime[cnCvsTimeSize];
+
+    return !(FormatCvsTime(itime, szTime) && _tcscmp(szTimestamp, szTime) == 0) &&
+           !(FormatCvsTime(itime + 3600, szTime) && _tcscmp(szTimestamp, szTime) == 0);
+}
+
+EVcsStatus GetCvsLocalStatus(const VcsEntry& entry, const WIN32_FIND_DATA& findData)
+{
+    return entry.sRevision == _T("0")                                    ? fsAdded    :
+           entry.sRevision.c_str()[0] == _T('-')                         ? fsRemoved  :
+           entry.sTimestamp.find_first_of(_T("+")) != tstring::npos      ? fsConflict :
+           IsCvsFileModified(findData.ftLastWriteTime, entry.sTimestamp) ? fsModified :
+                                                                           fsNormal;
+}
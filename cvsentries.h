@@ -0,0 +1,64 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Reading of the CVS administrative files of a working directory:
+             CVS/Entries, CVS/Entries.Log and CVS/Tag
+*****************************************************************************/
+
+#include <time.h>
+#include "vcs.h"
+
+/// <summary>
+/// Checks if the directory is checked out from CVS.
+/// </summary>
+bool IsCvsDir(const tstring& sDir);
+
+/// <summary>
+/// Adds the entries listed in <c>CVS/Entries</c>, or applies the additions
+/// and removals listed in <c>CVS/Entries.Log</c>, which must be read after
+/// <c>CVS/Entries</c>. The entries get <c>fsRemoved</c> or <c>fsGhost</c>,
+/// to be adjusted once the file is found on disk.
+/// </summary>
+/// <returns><c>false</c> if there is no such file.</returns>
+bool ReadCvsEntriesFile(const tstring& sDir, bool bEntriesLog, VcsEntries& entries);
+
+/// <summary>
+/// Reads the sticky tag or date of the directory from <c>CVS/Tag</c>.
+/// </summary>
+bool ReadCvsTagFile(const tstring& sDir, TCHAR& cTagType, tstring& sTag);
+
+/// <summary>
+/// Reads the first line of a one-line administrative file of the directory,
+/// e.g. <c>CVS/Root</c> or <c>CVS/Repository</c>.
+/// </summary>
+/// <returns>An empty string if there is no such file.</returns>
+tstring ReadCvsAdminLine(const tstring& sDir, const TCHAR *szName);
+
+/// <summary>
+/// Formats the time in the asctime format CVS uses in <c>CVS/Entries</c>,
+/// with the day always of two digits.
+/// </summary>
+tstring FormatCvsTime(time_t t);
+
+const size_t cnCvsTimeSize = 25; // "Sun Jan 05 00:00:00 2000" and the terminator
+
+/// <summary>
+/// Formats the time as above into the buffer, without allocating.
+/// </summary>
+/// <returns><c>false</c>, with the buffer empty, for the times out of the
+/// range of four-digit years.</returns>
+bool FormatCvsTime(time_t t, TCHAR (&szTime)[cnCvsTimeSize]);
+
+/// <summary>
+/// Compares the last write time of a file with its timestamp recorded in
+/// <c>CVS/Entries</c>.
+/// </summary>
+bool IsCvsFileModified(const FILETIME& ftLastWriteTime, const tstring& sCvsTimestamp);
+
+/// <summary>
+/// Tells the local status of a file listed in <c>CVS/Entries</c> and found
+/// on disk. The files looking unchanged are <c>fsNormal</c>; whether they
+/// are outdated is up to the caller.
+/// </summary>
+EVcsStatus GetCvsLocalStatus(const VcsEntry& entry, const WIN32_FIND_DATA& findData);
@@ -0,0 +1,117 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    SHA-1 digests through the CryptoAPI
+*****************************************************************************/
+
+#include <wincrypt.h>
+#include "winhelpers.h"
+
+/// <summary>
+/// Incrementally computed SHA-1 digest.
+/// </summary>
+/// <remarks>
+/// If the CryptoAPI is not available, <c>HexDigest</c> returns an empty
+/// string, and the callers are expected to do without the digest.
+/// </remarks>
+class Sha1 final
+{
+public:
+    Sha1() : m_hProv(0), m_hHash(0)
+    {
+        if (::CryptAcquireContext(&m_hProv, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT) &&
+            !::CryptCreateHash(m_hProv, CALG_SHA1, 0, 0, &m_hHash))
+            m_hHash = 0;
+    }
+
+    ~Sha1()
+    {
+        if (m_hHash)
+            ::CryptDestroyHash(m_hHash);
+        if (m_hProv)
+            ::CryptReleaseContext(m_hProv, 0);
+    }
+
+    Sha1(const Sha1&) = delete;
+    Sha1& operator=(const Sha1&) = delete;
+
+    bool IsValid() const { return m_hHash != 0; }
+
+    void Update(const void *pData, size_t cb)
+    {
+        if (m_hHash && !::CryptHashData(m_hHash, static_cast<const BYTE*>(pData), static_cast<DWORD>(cb), 0))
+            Invalidate();
+    }
+
+    void Update(const tstring& s) { Update(s.data(), s.size() * sizeof(TCHAR)); }
+
+    /// <summary>
+    /// Returns the digest as 40 lowercase hexadecimal digits. No more data
+    /// can be added afterwards.
+    /// </summary>
+    tstring HexDigest()
+    {
+        BYTE digest[20];
+        DWORD cb = sizeof digest;
+
+        if (!m_hHash || !::CryptGetHashParam(m_hHash, HP_HASHVAL, digest, &cb, 0))
+            return tstring();
+
+        Invalidate();
+
+        TCHAR szHex[2 * sizeof digest + 1];
+
+        for (DWORD i = 0; i < cb; ++i)
+            _stprintf_s(szHex + 2 * i, 3, _T("%02x"), digest[i]);
+
+        return tstring(szHex, 2 * cb);
+    }
+
+private:
+    void Invalidate()
+    {
+        ::CryptDestroyHash(m_hHash);
+        m_hHash = 0;
+    }
+
+    HCRYPTPROV m_hProv;
+    HCRYPTHASH m_hHash;
+};
+
+/// <summary>
+/// SHA-1 digest of a string.
+/// </summary>
+inline tstring Sha1Hex(const tstring& s)
+{
+    Sha1 sha1;
+    sha1.Update(s);
+    return sha1.HexDigest();
+}
+
+/// <summary>
+/// SHA-1 digest of the contents of a file, or an empty string if the file
+/// cannot be read.
+/// </summary>
+inline tstring Sha1File(const tstring& sFileName)
+{
+    W32Handle HFile = ::CreateFile(sFileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+    if (!HFile)
+        return tstring();
+
+    Sha1 sha1;
+    BYTE buf[65536];
+    DWORD dwRead;
+
+    for ( ; ; )
+    {
+        if (!::ReadFile(HFile, buf, sizeof buf, &dwRead, 0))
+            return tstring();
+
+        if (dwRead == 0)
+            return sha1.HexDigest();
+
+        sha1.Update(buf, dwRead);
+    }
+}
@@ -0,0 +1,56 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    The directories most costly to load, as measured by the
+             traversals and kept in the cache file
+*****************************************************************************/
+
+#include <algorithm>
+#include "dircosts.h"
+
+using namespace std;
+
+DirCostTable SlowDirs;
+
+void DirCostTable::Record(const tstring& sDir, chrono::steady_clock::duration d, size_t nEntries)
+{
+    DirCost cost;
+    cost.nMicroseconds = chrono::duration_cast<chrono::microseconds>(d).count();
+    cost.nEntries = static_cast<unsigned long>(nEntries);
+
+    CSGuard _(cs);
+
+    cont[sDir] = cost;
+
+    if (cont.size() <= m_nMaxSize)
+        return;
+
+    // The table is small: a linear search for the cheapest is fine
+
+    cont.erase(min_element(cont.begin(), cont.end(), [](const UnderlyingMapType::value_type& a, const UnderlyingMapType::value_type& b)
+    {
+        return a.second.nMicroseconds < b.second.nMicroseconds;
+    }));
+}
+
+void DirCostTable::Clear()
+{
+    CSGuard _(cs);
+    cont.clear();
+}
+
+vector<pair<tstring, DirCost>> DirCostTable::Sorted() const
+{
+    vector<pair<tstring, DirCost>> v;
+
+    {
+        CSGuard _(cs);
+        v.assign(cont.begin(), cont.end());
+    }
+
+    sort(v.begin(), v.end(), [](const pair<tstring, DirCost>& a, const pair<tstring, DirCost>& b)
+    {
+        return a.second.nMicroseconds > b.second.nMicroseconds;
+    });
+
+    return v;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    The directories most costly to load, as measured by the
+             traversals and kept in the cache file
+*****************************************************************************/
+
+#include <chrono>
+#include <map>
+#include <vector>
+#include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+#include "platform.h"
+
+/// <summary>
+/// The last measured load of a directory: reading the VCS entries and the
+/// directory, and computing the statuses.
+/// </summary>
+struct DirCost
+{
+    DirCost() : nMicroseconds(0), nEntries(0) {}
+
+    unsigned long long nMicroseconds;
+    unsigned long nEntries;
+
+    template <class Archive> void serialize(Archive& ar, const unsigned int) { ar & nMicroseconds & nEntries; }
+};
+
+/// <summary>
+/// Thread-safe table of the N costliest directories. A directory measured
+/// again gets the new cost, so the ones fixed or excluded drop out.
+/// </summary>
+class DirCostTable
+{
+public:
+    typedef std::map<tstring, DirCost, LessNoCase> UnderlyingMapType;
+
+    static const size_t cnDefaultSize = 50;
+
+    explicit DirCostTable(size_t nMaxSize = cnDefaultSize) : m_nMaxSize(nMaxSize) {}
+
+    void Record(const tstring& sDir, std::chrono::steady_clock::duration d, size_t nEntries);
+    void Clear();
+
+    /// <summary>
+    /// The directories, the costliest first.
+    /// </summary>
+    std::vector<std::pair<tstring, DirCost>> Sorted() const;
+
+private:
+    UnderlyingMapType cont;
+    size_t m_nMaxSize;
+    mutable CriticalSection cs;
+
+private:
+    friend class boost::serialization::access;
+    template <class Archive> void serialize(Archive& ar, const unsigned int) { CSGuard _(cs); ar & cont; }
+};
+
+/// <summary>
+/// The costs recorded by <c>TraverseDirtyDirs</c> and farvcs-scan.
+/// </summary>
+extern DirCostTable SlowDirs;
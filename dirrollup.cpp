@@ -0,0 +1,101 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Counts of the dirty files and the conflicts below every
+             directory, for decorating the directory rows of the panel
+*****************************************************************************/
+
+#include <vector>
+#include "dirrollup.h"
+
+using namespace std;
+
+namespace
+{
+    // The key of a directory: without the trailing separator, as its
+    // parents are given by ForEachParentDir
+
+    tstring DirKey(const tstring& sDir)
+    {
+        size_t nLength = sDir.find_last_not_of(_T("\\/"));
+        return nLength == tstring::npos ? tstring() : sDir.substr(0, nLength + 1);
+    }
+}
+
+void DirRollup::SetDirCounts(const TCHAR *szDir, unsigned nDirty, unsigned nConflicts)
+{
+    tstring sDir = DirKey(szDir);
+
+    CSGuard _(m_cs);
+    SetOwn(sDir, nDirty, nConflicts);
+}
+
+DirCounts DirRollup::Down(const tstring& sDir) const
+{
+    CSGuard _(m_cs);
+
+    NodeMap::const_iterator p = m_nodes.find(DirKey(sDir));
+    return p != m_nodes.end() ? p->second.down : DirCounts();
+}
+
+void DirRollup::ClearBelow(const tstring& sRoot)
+{
+    tstring sKey = DirKey(sRoot);
+
+    CSGuard _(m_cs);
+
+    // The keys starting with the root are a range, the directories below it
+    // are among them. Zeroing their own counts erases them all.
+
+    vector<tstring> vDirs;
+
+    for (NodeMap::const_iterator p = m_nodes.lower_bound(sKey); p != m_nodes.end() && ComparePaths(p->first.c_str(), sKey.c_str(), sKey.length()) == 0; ++p)
+    {
+        if ((p->second.own.nDirty != 0 || p->second.own.nConflicts != 0) && StartsWithDir()(p->first, sKey))
+            vDirs.push_back(p->first);
+    }
+
+    for (const auto& sDir : vDirs)
+        SetOwn(sDir, 0, 0);
+}
+
+void DirRollup::SetOwn(const tstring& sDir, unsigned nDirty, unsigned nConflicts)
+{
+    NodeMap::iterator p = m_nodes.find(sDir);
+
+    int nDirtyDelta = static_cast<int>(nDirty) - static_cast<int>(p != m_nodes.end() ? p->second.own.nDirty : 0);
+    int nConflictsDelta = static_cast<int>(nConflicts) - static_cast<int>(p != m_nodes.end() ? p->second.own.nConflicts : 0);
+
+    if (nDirtyDelta == 0 && nConflictsDelta == 0)
+        return;
+
+    // The node itself first, so that it is still there when its totals drop
+    // to zero and it is erased
+
+    if (p == m_nodes.end())
+        p = m_nodes.insert(make_pair(sDir, Node())).first;
+
+    p->second.own.nDirty = nDirty;
+    p->second.own.nConflicts = nConflicts;
+
+    AddDown(sDir, nDirtyDelta, nConflictsDelta);
+    ForEachParentDir(sDir, [&](const tstring& sParent) { AddDown(sParent, nDirtyDelta, nConflictsDelta); });
+}
+
+// Nodes are kept only while something below them counts
+
+void DirRollup::AddDown(const tstring& sDir, int nDirty, int nConflicts)
+{
+    NodeMap::iterator p = m_nodes.insert(make_pair(sDir, Node())).first;
+
+    p->second.down.nDirty += nDirty;
+    p->second.down.nConflicts += nConflicts;
+
+    if (p->second.down.nDirty == 0 && p->second.down.nConflicts == 0)
+        m_nodes.erase(p);
+}
+
+DirRollup& GetDirRollup()
+{
+    static DirRollup rollup;
+    return rollup;
+}
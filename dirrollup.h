@@ -0,0 +1,103 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Counts of the dirty files and the conflicts below every
+             directory, for decorating the directory rows of the panel
+*****************************************************************************/
+
+#include <map>
+#include "platform.h"
+
+/// <summary>
+/// Receiver of the counts of the loaded directories. The host owns the only
+/// implementation and passes it to the second level plugins through their
+/// <c>AttachDirCounts</c> export; being an interface, it can be called from
+/// a module with another runtime.
+/// </summary>
+struct IDirCountsSink
+{
+    /// <summary>
+    /// Replaces the counts of the files directly in the directory.
+    /// </summary>
+    virtual void SetDirCounts(const TCHAR *szDir, unsigned nDirty, unsigned nConflicts) = 0;
+};
+
+/// <summary>
+/// The sink the current module reports to, null until attached.
+/// </summary>
+/// <remarks>
+/// Defined in a header file because it is used in both projects with static
+/// and dynamic runtimes; each module gets its own pointer.
+/// </remarks>
+inline IDirCountsSink*& DirCountsSinkPtr()
+{
+    static IDirCountsSink *p = 0;
+    return p;
+}
+
+inline void AttachDirCountsTo(IDirCountsSink *pSink)
+{
+    DirCountsSinkPtr() = pSink;
+}
+
+struct DirCounts
+{
+    DirCounts() : nDirty(0), nConflicts(0) {}
+
+    unsigned nDirty;
+    unsigned nConflicts;
+};
+
+/// <summary>
+/// The counts of every loaded directory, aggregated up the tree: a change
+/// of a directory is added to each of its parents, so the totals below any
+/// directory are a single lookup.
+/// </summary>
+/// <remarks>
+/// Thread-safe. A directory is known from its last load only, so the totals
+/// do not include the subdirectories that have not been loaded yet.
+/// </remarks>
+class DirRollup : public IDirCountsSink
+{
+public:
+    DirRollup() {}
+
+    DirRollup(const DirRollup&) = delete;
+    DirRollup& operator=(const DirRollup&) = delete;
+
+    void SetDirCounts(const TCHAR *szDir, unsigned nDirty, unsigned nConflicts) override;
+
+    /// <summary>
+    /// The totals of the directory and all the directories below it.
+    /// </summary>
+    DirCounts Down(const tstring& sDir) const;
+
+    /// <summary>
+    /// Forgets the directory and the directories below it, taking their
+    /// counts off the totals of its parents. For when they are about to be
+    /// reloaded, some of them possibly gone.
+    /// </summary>
+    void ClearBelow(const tstring& sRoot);
+
+private:
+    struct Node
+    {
+        DirCounts own;
+        DirCounts down; // Including own
+    };
+
+    typedef std::map<tstring, Node, LessNoCase> NodeMap;
+
+    void SetOwn(const tstring& sDir, unsigned nDirty, unsigned nConflicts);
+    void AddDown(const tstring& sDir, int nDirty, int nConflicts);
+
+    mutable CriticalSection m_cs;
+    NodeMap m_nodes;
+};
+
+/// <summary>
+/// The rollup of the process, filled by the loads of the directories once
+/// attached.
+/// </summary>
+DirRollup& GetDirRollup();
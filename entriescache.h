@@ -0,0 +1,340 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Retention of the loaded VcsEntries across GetVcsData calls,
+             under a memory budget, with LRU eviction
+*****************************************************************************/
+
+#include <atomic>
+#include <list>
+#include <map>
+#include "vcs.h"
+#include "dirlist.h"
+
+/// <summary>
+/// The budget of the entries caches and their total usage. The host owns the
+/// instance and passes it to the second level plugins through their
+/// <c>AttachEntriesCache</c> export, so the caches of all the modules share
+/// one budget.
+/// </summary>
+struct EntriesCacheBudget
+{
+    static const size_t cnDefaultBytes = 64 << 20;
+
+    EntriesCacheBudget() : nStructSize(sizeof(EntriesCacheBudget)), nBudgetBytes(cnDefaultBytes), nUsedBytes(0), nDirs(0) {}
+
+    EntriesCacheBudget(const EntriesCacheBudget&) = delete;
+    EntriesCacheBudget& operator=(const EntriesCacheBudget&) = delete;
+
+    size_t nStructSize; // Checked when attaching a module built with another layout
+
+    std::atomic<size_t> nBudgetBytes; // Zero disables the caches
+    std::atomic<size_t> nUsedBytes;
+    std::atomic<size_t> nDirs;
+
+    /// <summary>
+    /// Protects the directory shown in the panel from eviction, in place of
+    /// the one the panel has pinned before; the directory of the other panel
+    /// stays pinned. Called by the host only, so the map is never
+    /// reallocated by a module with another runtime.
+    /// </summary>
+    void Pin(const void *pOwner, const tstring& sDir)
+    {
+        CSGuard _(m_cs);
+        m_PinnedDirs[pOwner] = sDir;
+    }
+
+    /// <summary>
+    /// Drops the pin of the panel, e.g. when it is closed. Host only.
+    /// </summary>
+    void Unpin(const void *pOwner)
+    {
+        CSGuard _(m_cs);
+        m_PinnedDirs.erase(pOwner);
+    }
+
+    bool IsPinned(const tstring& sDir) const
+    {
+        CSGuard _(m_cs);
+
+        for (const auto& pinned : m_PinnedDirs)
+            if (EqualNoCase()(sDir, pinned.second))
+                return true;
+
+        return false;
+    }
+
+private:
+    mutable CriticalSection m_cs;
+    std::map<const void*, tstring> m_PinnedDirs; // By the panel
+};
+
+/// <summary>
+/// The budget the current module's cache obeys: its own until attached to
+/// the one of the host.
+/// </summary>
+/// <remarks>
+/// Defined in a header file because it is used in both projects with static
+/// and dynamic runtimes; each module gets its own pair of statics.
+/// </remarks>
+inline EntriesCacheBudget& LocalEntriesCacheBudget()
+{
+    static EntriesCacheBudget local;
+    return local;
+}
+
+inline EntriesCacheBudget*& EntriesCacheBudgetPtr()
+{
+    static EntriesCacheBudget *p = &LocalEntriesCacheBudget();
+    return p;
+}
+
+inline EntriesCacheBudget& GetEntriesCacheBudget()
+{
+    return *EntriesCacheBudgetPtr();
+}
+
+/// <summary>
+/// Makes the module obey the given budget, or its own one if null or of
+/// another layout.
+/// </summary>
+inline void AttachEntriesCacheBudgetTo(EntriesCacheBudget *pBudget)
+{
+    EntriesCacheBudgetPtr() = pBudget && pBudget->nStructSize == sizeof(EntriesCacheBudget) ? pBudget : &LocalEntriesCacheBudget();
+}
+
+/// <summary>
+/// The entries of the recently loaded directories, each with the signature
+/// of what they have been computed from: the listings of the directory and
+/// of its administrative subdirectory, and the version of its part of
+/// OutdatedFiles.
+/// An entry whose signature no longer matches is reloaded.
+/// </summary>
+/// <remarks>
+/// One per module, since the entries are allocated by its runtime.
+/// Thread-safe. The least recently used directories are evicted when the
+/// total usage of all the modules exceeds the budget, except the pinned ones.
+/// </remarks>
+class EntriesCache
+{
+public:
+    EntriesCache() {}
+    ~EntriesCache() { Clear(); }
+
+    EntriesCache(const EntriesCache&) = delete;
+    EntriesCache& operator=(const EntriesCache&) = delete;
+
+    static bool IsEnabled() { return GetEntriesCacheBudget().nBudgetBytes != 0; }
+
+    /// <summary>
+    /// The signature of the entries loaded from the given listing of the
+    /// directory. Reads the administrative subdirectory.
+    /// </summary>
+    static unsigned long long Signature(const tstring& sDir, const FileInfos& files, const TCHAR *szAdminDirName, const TSFileSet& outdatedFiles)
+    {
+        FileInfos adminFiles;
+        ListDirectory(CatPath(sDir.c_str(), szAdminDirName), adminFiles);
+
+        unsigned long long nHash = cnFnvOffsetBasis;
+
+        HashListing(nHash, files);
+        HashListing(nHash, adminFiles);
+        HashBytes(nHash, outdatedFiles.DirVersion(sDir));
+
+        return nHash;
+    }
+
+    /// <summary>
+    /// Copies the retained entries of the directory, if there are any with
+    /// the same signature.
+    /// </summary>
+    bool Get(const tstring& sDir, unsigned long long nSignature, VcsEntries& entries)
+    {
+        CSGuard _(m_cs);
+
+        auto p = m_index.find(sDir);
+
+        if (p == m_index.end() || p->second->nSignature != nSignature)
+        {
+            Statistics().nEntriesCacheMisses.Add();
+            return false;
+        }
+
+        m_lru.splice(m_lru.begin(), m_lru, p->second);
+        entries = p->second->entries;
+
+        Statistics().nEntriesCacheHits.Add();
+        return true;
+    }
+
+    /// <summary>
+    /// Retains a copy of the entries, evicting the least recently used
+    /// directories as the budget requires.
+    /// </summary>
+    void Put(const tstring& sDir, unsigned long long nSignature, const VcsEntries& entries)
+    {
+        EntriesCacheBudget& budget = GetEntriesCacheBudget();
+
+        size_t nBytes = Footprint(sDir, entries);
+
+        CSGuard _(m_cs);
+
+        auto p = m_index.find(sDir);
+
+        if (p != m_index.end())
+            Erase(p);
+
+        if (nBytes > budget.nBudgetBytes)
+        {
+            Trim(m_lru.end()); // The budget may have been lowered
+            return;
+        }
+
+        m_lru.push_front(Item());
+
+        Item& item = m_lru.front();
+        item.sDir = sDir;
+        item.nSignature = nSignature;
+        item.entries = entries;
+        item.nBytes = nBytes;
+
+        m_index[sDir] = m_lru.begin();
+
+        budget.nUsedBytes += nBytes;
+        ++budget.nDirs;
+
+        // The newest one is never evicted; if the other modules hold the
+        // budget, it goes over until they load something
+
+        Trim(m_lru.begin());
+    }
+
+    void Clear()
+    {
+        CSGuard _(m_cs);
+
+        while (!m_lru.empty())
+            Erase(m_index.find(m_lru.back().sDir));
+    }
+
+private:
+    struct Item
+    {
+        tstring sDir;
+        unsigned long long nSignature;
+        VcsEntries entries;
+        size_t nBytes;
+    };
+
+    typedef std::list<Item> ItemList;
+    typedef std::map<tstring, ItemList::iterator, LessNoCase> ItemIndex;
+
+    // Evicts the least recently used directories, except the pinned ones,
+    // until the usage is within the budget or only pKeep and the newer ones
+    // are left
+
+    void Trim(ItemList::iterator pKeep)
+    {
+        EntriesCacheBudget& budget = GetEntriesCacheBudget();
+
+        for (auto pVictim = m_lru.end(); budget.nUsedBytes > budget.nBudgetBytes && pVictim != m_lru.begin() && std::prev(pVictim) != pKeep; )
+        {
+            --pVictim;
+
+            if (!budget.IsPinned(pVictim->sDir))
+                Erase(m_index.find((pVictim++)->sDir));
+        }
+    }
+
+    void Erase(ItemIndex::iterator p)
+    {
+        EntriesCacheBudget& budget = GetEntriesCacheBudget();
+
+        budget.nUsedBytes -= p->second->nBytes;
+        --budget.nDirs;
+
+        m_lru.erase(p->second);
+        m_index.erase(p);
+    }
+
+    //==========================================================================>>
+    // Size accounting: the nodes of the containers and the heap blocks of the
+    // strings longer than the small string buffer, each with the bookkeeping
+    // of the allocator
+    //==========================================================================>>
+
+    static const size_t cnHeapBlockOverhead = 2 * sizeof(void*);
+    static const size_t cnTreeNodeOverhead  = 4 * sizeof(void*) + cnHeapBlockOverhead; // Colour, parent, children
+    static const size_t cnListNodeOverhead  = 2 * sizeof(void*) + cnHeapBlockOverhead;
+
+    static size_t HeapSize(const tstring& s)
+    {
+        static const size_t cnInPlaceCapacity = tstring().capacity();
+        return s.capacity() > cnInPlaceCapacity ? (s.capacity() + 1) * sizeof(TCHAR) + cnHeapBlockOverhead : 0;
+    }
+
+    static size_t Footprint(const tstring& sDir, const VcsEntries& entries)
+    {
+        size_t nBytes = cnListNodeOverhead + sizeof(Item) + HeapSize(sDir)                         // The item
+                      + cnTreeNodeOverhead + sizeof(ItemIndex::value_type) + HeapSize(sDir);       // Its index
+
+        for (const auto& entry : entries)
+        {
+            const VcsEntry& e = entry.second;
+
+            nBytes += cnTreeNodeOverhead + sizeof(VcsEntries::value_type)
+                    + HeapSize(entry.first)
+                    + HeapSize(e.sName) + HeapSize(e.sRevision) + HeapSize(e.sTimestamp) + HeapSize(e.sOptions) + HeapSize(e.sTagdate);
+        }
+
+        return nBytes;
+    }
+
+    //==========================================================================>>
+    // Signatures: FNV-1a over what the status depends on. The access times
+    // are left out, and so is the parent directory.
+    //==========================================================================>>
+
+    static const unsigned long long cnFnvOffsetBasis = 14695981039346656037ULL;
+    static const unsigned long long cnFnvPrime = 1099511628211ULL;
+
+    static void HashBytes(unsigned long long& nHash, const void *p, size_t n)
+    {
+        for (const unsigned char *pb = static_cast<const unsigned char*>(p); n-- > 0; ++pb)
+            nHash = (nHash ^ *pb) * cnFnvPrime;
+    }
+
+    template <typename T> static void HashBytes(unsigned long long& nHash, const T& t)
+    {
+        HashBytes(nHash, &t, sizeof t);
+    }
+
+    static void HashListing(unsigned long long& nHash, const FileInfos& files)
+    {
+        for (const auto& file : files)
+        {
+            if (file.sName == _T(".."))
+                continue;
+
+            HashBytes(nHash, file.sName.c_str(), (file.sName.size() + 1) * sizeof(TCHAR));
+            HashBytes(nHash, file.dwFileAttributes);
+            HashBytes(nHash, file.ftCreationTime);
+            HashBytes(nHash, file.ftLastWriteTime);
+            HashBytes(nHash, file.nFileSize);
+        }
+    }
+
+    CriticalSection m_cs;
+    ItemList m_lru;   // Most recently used first
+    ItemIndex m_index;
+};
+
+/// <summary>
+/// The cache of the current module.
+/// </summary>
+inline EntriesCache& ModuleEntriesCache()
+{
+    static EntriesCache cache;
+    return cache;
+}
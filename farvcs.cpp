@@ -14,9 +14,14 @@
 #include "winhelpers.h"
 #include "plugutil.h"
 #include "vcs.h"
+#include "cachefile.h"
+#include "tracefile.h"
+#include "entriescache.h"
+#include "dirrollup.h"
 #include "regwrap.h"
 #include "enforce.h"
 #include "traverse.h"
+#include "prefetch.h"
 #include "lang.h"
 
 using namespace std;
@@ -34,9 +39,14 @@ HINSTANCE hResInst;            // Where to load the resources from
 const TCHAR *cszPluginName = _T("VCS Assistant");
 // {8107EF4F-78C3-4ED5-8A3A-6BE16CC5EB1E}
 const GUID PluginGuid = { 0x8107ef4f, 0x78c3, 0x4ed5, { 0x8a, 0x3a, 0x6b, 0xe1, 0x6c, 0xc5, 0xeb, 0x1e } };
+// {5C1F6A2E-3B7D-4E91-9F0A-8D2C4B6E7A13}
+const GUID StatisticsMenuGuid = { 0x5c1f6a2e, 0x3b7d, 0x4e91, { 0x9f, 0x0a, 0x8d, 0x2c, 0x4b, 0x6e, 0x7a, 0x13 } };
+// {A4E2B7C9-61D3-4F58-B0E6-2C9D7F1A3E54}
+const GUID SlowDirsMenuGuid = { 0xa4e2b7c9, 0x61d3, 0x4f58, { 0xb0, 0xe6, 0x2c, 0x9d, 0x7f, 0x1a, 0x3e, 0x54 } };
+// {3F9D2C71-8E4A-4B06-A5D3-7C1E9B2F6A48}
+const GUID AllChangesMenuGuid = { 0x3f9d2c71, 0x8e4a, 0x4b06, { 0xa5, 0xd3, 0x7c, 0x1e, 0x9b, 0x2f, 0x6a, 0x48 } };
 
 TCHAR cszDllName[]   = _T("farvcs.dll");
-TCHAR cszCacheFile[] = _T("farvcs.csh");
 
 const TCHAR *PluginMenuStrings[] = { cszPluginName };
 
@@ -61,6 +71,13 @@ TCHAR *Stati[] = { _T(""),  _T(""),   _T(""),   _T(""),  _T(""),  _T(""),  _T(""
 TSFileSet DirtyDirs;
 TSFileSet OutdatedFiles;
 
+//==========================================================================>>
+// The repository markers seen by the last recursive status refresh of each
+// directory. The refresh then only asks for the changes committed since.
+//==========================================================================>>
+
+RemoteMarkerMap RemoteMarkers;
+
 //==========================================================================>>
 // DllMain is necessary to get and store the module handle to access the
 // resources later
@@ -90,6 +107,14 @@ public:
 
         unsigned int nCompressionLevel; // Compression level (-z option). Ranges 0-9;
 
+        // Memory
+
+        unsigned int nEntriesCacheMB; // Budget of the entries retained across panel updates; 0 disables
+
+        // Diagnostics
+
+        tstring sTraceFile; // Trace-event file written while FAR runs; set in the registry only
+
         void Load();
         void Save() const;
 
@@ -99,51 +124,21 @@ public:
 
     struct Cache
     {
-        Cache(const tstring& sCacheFile = CatPath(GetLocalAppDataFolder().c_str(), cszCacheFile)) : sCacheFile_(sCacheFile) {}
+        Cache(const tstring& sCacheFile = GetDefaultCacheFile()) : sCacheFile_(sCacheFile) {}
 
-        void Load()
-        {
-            ifstream is( sCacheFile_.c_str(), ios::binary );
-            
-            if ( !is )
-                return;
-
-            try
-            {
-                boost::archive::text_iarchive ia( is );
-
-                ia >> DirtyDirs;
-                ia >> OutdatedFiles;
-            }
-            catch(...)
-            {
-                DirtyDirs.Clear();
-                OutdatedFiles.Clear();
-            }
-        }
-
-        void Save() const
-        {
-            ofstream os( sCacheFile_.c_str(), ios::binary );
-            
-            if ( !os )
-                return;
-
-            boost::archive::text_oarchive oa( os );
-
-            oa << const_cast<const TSFileSet&>( DirtyDirs );
-            oa << const_cast<const TSFileSet&>( OutdatedFiles );
-        }
+        void Load()       { LoadCacheFile(sCacheFile_, DirtyDirs, OutdatedFiles, RemoteMarkers, SlowDirs); }
+        void Save() const { SaveCacheFile(sCacheFile_, DirtyDirs, OutdatedFiles, RemoteMarkers, SlowDirs); }
 
     private:
         tstring sCacheFile_;
     };
 
 public:
-    explicit VcsPlugin(tstring currentDirectory, tstring currentItem)
+    explicit VcsPlugin(tstring currentDirectory, tstring currentItem, bool allChanges = false)
     {
         curDir = currentDirectory;
         itemToStart = currentItem;
+        bAllChanges = allChanges;
 
         ColumnTitles1[0] = GetMsg(M_ColumnName);
         ColumnTitles1[1] = GetMsg(M_ColumnS);
@@ -205,7 +200,7 @@ public:
     intptr_t SetDirectory(const SetDirectoryInfo *pinfo);
     intptr_t GetFindData(GetFindDataInfo *pinfo);
     void FreeFindData(const FreeFindDataInfo *pinfo);
-    intptr_t ProcessPanelInput(ProcessPanelInputInfo *pinfo);
+    intptr_t ProcessPanelInput(const ProcessPanelInputInfo *pinfo);
     intptr_t ProcessPanelEvent(const ProcessPanelEventInfo *pinfo);
 
     virtual ~VcsPlugin() {}
@@ -216,6 +211,7 @@ public:
 private:
     tstring curDir;
     tstring itemToStart; // Where to position the cursor when starting
+    bool bAllChanges;    // Flat list of the changes below curDir rather than its files
 
     // Members to be used in GetOpenPanelInfo
 
@@ -235,7 +231,9 @@ private:
 
     enum { nOptColumnWidth = 5, nRevColumnWidth = 11 }; // Revision column width
 
-    void DecoratePanelItem(PluginPanelItem& pi, const VcsEntry& entry, const tstring& sTag);
+    void DecoratePanelItem(PluginPanelItem& pi, const VcsEntry& entry, EVcsStatus fs, const tstring& sTag);
+    static EVcsStatus DirRowStatus(const tstring& sDir, EVcsStatus fs);
+    void GetAllChangesFindData(vector<PluginPanelItem>& v);
 
     // Threading for automatic mode
 
@@ -265,6 +263,14 @@ void VcsPlugin::PluginSettings::Load()
     // CVS
 
     nCompressionLevel = rkey.ReadDword(_T("nCompressionLevel"));
+
+    // Memory
+
+    nEntriesCacheMB = rkey.ReadDword(_T("nEntriesCacheMB"), EntriesCacheBudget::cnDefaultBytes >> 20);
+
+    // Diagnostics
+
+    sTraceFile = rkey.ReadString(_T("sTraceFile"));
 }
 
 void VcsPlugin::PluginSettings::Save() const
@@ -276,6 +282,10 @@ void VcsPlugin::PluginSettings::Save() const
     // CVS
 
     rkey.WriteDword(_T("nCompressionLevel"), nCompressionLevel);
+
+    // Memory
+
+    rkey.WriteDword(_T("nEntriesCacheMB"), nEntriesCacheMB);
 }
 
 //==========================================================================>>
@@ -309,6 +319,15 @@ void WINAPI SetStartupInfoW(const PluginStartupInfo *pinfo)
     StartupInfo.FSF = &FSF;
 
     Settings.Load();
+
+    GetEntriesCacheBudget().nBudgetBytes = static_cast<size_t>(Settings.nEntriesCacheMB) << 20;
+
+    AttachTraceTo(&GetTraceFile());
+    AttachDirCountsTo(&GetDirRollup());
+
+    if (!Settings.sTraceFile.empty())
+        GetTraceFile().Open(Settings.sTraceFile, "farvcs");
+
     ::Cache.Load();
     ApplyAutomaticModeFromSettings();
 }
@@ -318,9 +337,19 @@ void WINAPI GetPluginInfoW(PluginInfo *pinfo)
     pinfo->StructSize = sizeof PluginInfo;
     pinfo->Flags = PF_PRELOAD;
 
-    pinfo->PluginMenu.Guids = &PluginGuid; // !!!
-    pinfo->PluginMenu.Strings = PluginMenuStrings;
-    pinfo->PluginMenu.Count = _countof(PluginMenuStrings);
+    // The panel and the diagnostic reports
+
+    static const GUID MenuGuids[] = { PluginGuid, AllChangesMenuGuid, StatisticsMenuGuid, SlowDirsMenuGuid };
+    static const TCHAR *MenuStrings[_countof(MenuGuids)];
+
+    MenuStrings[0] = cszPluginName;
+    MenuStrings[1] = GetMsg(M_AllChangesMenu);
+    MenuStrings[2] = GetMsg(M_StatisticsMenu);
+    MenuStrings[3] = GetMsg(M_SlowDirsMenu);
+
+    pinfo->PluginMenu.Guids = MenuGuids;
+    pinfo->PluginMenu.Strings = MenuStrings;
+    pinfo->PluginMenu.Count = _countof(MenuGuids);
 
     pinfo->PluginConfig.Guids = &PluginGuid; // !!!
     pinfo->PluginConfig.Strings = PluginMenuStrings;
@@ -360,11 +389,122 @@ tstring GetCurrentItem(HANDLE hPanel = PANEL_ACTIVE)
     return gpi.Item->FileName;
 }
 
+tstring GetSelectedItem(HANDLE hPanel, size_t nIndex)
+{
+    intptr_t requiredSize = StartupInfo.PanelControl(hPanel, FCTL_GETSELECTEDPANELITEM, nIndex, nullptr);
+
+    if (requiredSize <= 0)
+        return _T("");
+
+    unique_ptr<char[]> pbuf{ new char[requiredSize] }; // Replace with make_unique as soon as compiler supports it.
+
+    FarGetPluginPanelItem gpi
+    {
+        sizeof(FarGetPluginPanelItem),
+        requiredSize,
+        reinterpret_cast<PluginPanelItem*>(pbuf.get())
+    };
+
+    StartupInfo.PanelControl(hPanel, FCTL_GETSELECTEDPANELITEM, nIndex, &gpi);
+    return gpi.Item->FileName;
+}
+
+/// <summary>
+/// Shows the counters of the hot paths until closed, resetting them on request.
+/// </summary>
+void ShowStatisticsDialog()
+{
+    for ( ; ; )
+    {
+        vector<tstring> vLines = Statistics().Format();
+
+        const EntriesCacheBudget& budget = GetEntriesCacheBudget();
+
+        vLines.push_back(sformat(_T("%-24s %12llu %7.1f of %.0f MB"),
+                                 _T("Entries retained (dirs)"),
+                                 static_cast<unsigned long long>(budget.nDirs),
+                                 budget.nUsedBytes / 1048576.0,
+                                 budget.nBudgetBytes / 1048576.0));
+
+        vector<const TCHAR*> items;
+        items.push_back(GetMsg(M_StatisticsTitle));
+
+        for (const auto& sLine : vLines)
+            items.push_back(sLine.c_str());
+
+        items.push_back(GetMsg(M_Ok));
+        items.push_back(GetMsg(M_Reset));
+
+        intptr_t nButton = StartupInfo.Message(&PluginGuid,
+                                               &StatisticsMenuGuid,
+                                               FMSG_LEFTALIGN,
+                                               0,               // Help topic - a dummy value
+                                               &items[0],
+                                               items.size(),
+                                               2);              // Ok, Reset
+
+        if (nButton != 1)
+            return;
+
+        Statistics().Reset();
+    }
+}
+
+/// <summary>
+/// Lists the directories slowest to load, as measured by the traversals,
+/// the costliest first. The chosen one is opened in the active panel.
+/// </summary>
+void ShowSlowDirsMenu()
+{
+    vector<pair<tstring, DirCost>> vSlowDirs = SlowDirs.Sorted();
+
+    vector<tstring> vLines;
+    vector<FarMenuItem> items(vSlowDirs.size());
+
+    for (const auto& slowDir : vSlowDirs)
+        vLines.push_back(sformat(_T("%9.1f ms %7lu  %s"), slowDir.second.nMicroseconds / 1000.0, slowDir.second.nEntries, slowDir.first.c_str()));
+
+    for (size_t i = 0; i < items.size(); ++i)
+        items[i].Text = vLines[i].c_str();
+
+    intptr_t iItem = StartupInfo.Menu(&PluginGuid,
+                                      &SlowDirsMenuGuid,
+                                      -1, -1, 0,       // Centered, as high as needed
+                                      FMENU_WRAPMODE,
+                                      GetMsg(M_SlowDirsTitle),
+                                      0,
+                                      0,               // Help topic - a dummy value
+                                      0,
+                                      0,
+                                      items.empty() ? nullptr : &items[0],
+                                      items.size());
+
+    if (iItem < 0 || static_cast<size_t>(iItem) >= vSlowDirs.size())
+        return;
+
+    FarPanelDirectory fpd{ sizeof FarPanelDirectory };
+    fpd.Name = vSlowDirs[iItem].first.c_str();
+
+    StartupInfo.PanelControl(PANEL_ACTIVE, FCTL_SETPANELDIRECTORY, 0, &fpd);
+}
+
 HANDLE WINAPI OpenW(const struct OpenInfo *pinfo)
 {
     if (pinfo->StructSize < sizeof(OpenInfo))
         return nullptr;
 
+    if (pinfo->OpenFrom == OPEN_PLUGINSMENU && pinfo->Guid && *pinfo->Guid == StatisticsMenuGuid)
+    {
+        ShowStatisticsDialog();
+        return nullptr;
+    }
+
+    if (pinfo->OpenFrom == OPEN_PLUGINSMENU && pinfo->Guid && *pinfo->Guid == SlowDirsMenuGuid)
+    {
+        ShowSlowDirsMenu();
+        return nullptr;
+    }
+
     if (pinfo->OpenFrom != OPEN_FILEPANEL &&
         pinfo->OpenFrom != OPEN_PLUGINSMENU &&
         pinfo->OpenFrom != OPEN_SHORTCUT)
@@ -372,11 +512,15 @@ HANDLE WINAPI OpenW(const struct OpenInfo *pinfo)
 
     FarPanelDirectory fpd{ sizeof FarPanelDirectory };
 
-    return new VcsPlugin(GetPanelDir(), GetCurrentItem()); // Deleted in ClosePlugin
+    bool bAllChanges = pinfo->OpenFrom == OPEN_PLUGINSMENU && pinfo->Guid && *pinfo->Guid == AllChangesMenuGuid;
+
+    return new VcsPlugin(GetPanelDir(), GetCurrentItem(), bAllChanges); // Deleted in ClosePlugin
 }
 
 void WINAPI ClosePanelW(const ClosePanelInfo *pinfo)
 {
+    Prefetch.Cancel(pinfo->hPanel); // Only if started by this panel
+    GetEntriesCacheBudget().Unpin(pinfo->hPanel);
     delete reinterpret_cast<VcsPlugin*>(pinfo->hPanel);
 }
 
@@ -384,7 +528,7 @@ intptr_t WINAPI SetDirectoryW     (const SetDirectoryInfo *pinfo)      { return
 void     WINAPI GetOpenPanelInfoW (OpenPanelInfo *pinfo)               {        reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->GetOpenPanelInfo(pinfo);  }
 intptr_t WINAPI GetFindDataW      (GetFindDataInfo *pinfo)             { return reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->GetFindData(pinfo);       }
 void     WINAPI FreeFindDataW     (const FreeFindDataInfo *pinfo)      {        reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->FreeFindData(pinfo);      }
-intptr_t WINAPI ProcessPanelInputW(ProcessPanelInputInfo *pinfo)       { return reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->ProcessPanelInput(pinfo); }
+intptr_t WINAPI ProcessPanelInputW(const ProcessPanelInputInfo *pinfo) { return reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->ProcessPanelInput(pinfo); }
 intptr_t WINAPI ProcessPanelEventW(const ProcessPanelEventInfo *pinfo) { return reinterpret_cast<VcsPlugin*>(pinfo->hPanel)->ProcessPanelEvent(pinfo); }
 
 //!!! Revise and uncomment
@@ -428,8 +572,12 @@ intptr_t WINAPI ProcessPanelEventW(const ProcessPanelEventInfo *pinfo) { return
 
 void WINAPI ExitFARW(const ExitInfo *)
 {
+    Prefetch.Shutdown();
+
     if (Settings.bAutomaticMode)
         VcsPlugin::StopMonitoringThread();
+
+    GetTraceFile().Close();
 }
 
 /// <summary>
@@ -437,6 +585,17 @@ void WINAPI ExitFARW(const ExitInfo *)
 /// </summary>
 intptr_t VcsPlugin::SetDirectory(const SetDirectoryInfo *pinfo)
 {
+    // Leaving the list of the changes: ".." goes back to the files of its
+    // root, a directory listed as changed is entered as usual
+
+    if (bAllChanges)
+    {
+        bAllChanges = false;
+
+        if (_tcscmp(pinfo->Dir, _T("..")) == 0)
+            return 1;
+    }
+
     tstring newDir = CatPath(curDir.c_str(), pinfo->Dir);
 
     // Check if the directory acutally exists
@@ -448,6 +607,12 @@ intptr_t VcsPlugin::SetDirectory(const SetDirectoryInfo *pinfo)
     curDir = newDir;
     ::SetCurrentDirectory(curDir.c_str());
 
+    // The neighbours of the previous directory are no longer interesting,
+    // except the one we have just entered
+
+    Prefetch.Cancel(this, curDir);
+    Prefetch.NoteVisited(curDir);
+
     if (::Settings.bAutomaticMode && !IsVcsDir(newDir))
         StartupInfo.PanelControl(PANEL_ACTIVE, FCTL_CLOSEPANEL, 0, reinterpret_cast<void*>(const_cast<TCHAR*>(curDir.c_str())));
 
@@ -468,7 +633,10 @@ void VcsPlugin::GetOpenPanelInfo(OpenPanelInfo *pinfo)
     if (sLabel.empty())
         sLabel = _T("TRUNK");
     
-    _sntprintf_s(szPanelTitle, _TRUNCATE, _T(" [%s] %s "), sLabel.c_str(), curDir.c_str());
+    if (bAllChanges)
+        _sntprintf_s(szPanelTitle, _TRUNCATE, _T(" [%s] %s: %s "), sLabel.c_str(), GetMsg(M_AllChangesTitle), curDir.c_str());
+    else
+        _sntprintf_s(szPanelTitle, _TRUNCATE, _T(" [%s] %s "), sLabel.c_str(), curDir.c_str());
     pinfo->PanelTitle = szPanelTitle;
 
     pinfo->PanelModesArray = PanelModesArray;
@@ -483,7 +651,29 @@ void VcsPlugin::GetOpenPanelInfo(OpenPanelInfo *pinfo)
 // Decorate the panel item with the VCS-related data
 //==========================================================================>>
 
-void VcsPlugin::DecoratePanelItem(PluginPanelItem& pi, const VcsEntry& entry, const tstring& sTag)
+// An unchanged directory shows the most important of the changes below it.
+// Each is a lookup in the totals kept along the parents of every change.
+
+EVcsStatus VcsPlugin::DirRowStatus(const tstring& sDir, EVcsStatus fs)
+{
+    if (fs != fsNormal)
+        return fs;
+
+    DirCounts counts = GetDirRollup().Down(sDir);
+
+    if (counts.nConflicts != 0)
+        return fsConflict;
+
+    if (counts.nDirty != 0 || DirtyDirs.ContainsDown(sDir))
+        return fsModified;
+
+    if (OutdatedFiles.ContainsDown(sDir))
+        return fsOutdated;
+
+    return fs;
+}
+
+void VcsPlugin::DecoratePanelItem(PluginPanelItem& pi, const VcsEntry& entry, EVcsStatus fs, const tstring& sTag)
 {
     if (_tcscmp(pi.FileName, _T("..")) == 0)
         return;
@@ -497,18 +687,7 @@ void VcsPlugin::DecoratePanelItem(PluginPanelItem& pi, const VcsEntry& entry, co
     for (int i = 0; i < nCustomColumns; ++i)
         pCols[i] = cszEmptyLine;
 
-    EVcsStatus fs = entry.status;
-
-    char cStatus = fs == fsAdded     ? 'A' :
-                   fs == fsRemoved   ? 'R' :
-                   fs == fsConflict  ? 'C' :
-                   fs == fsModified  ? 'M' :
-                   fs == fsOutdated  ? '*' :
-                   fs == fsNonVcs    ? '?' :
-                   fs == fsIgnored   ? '|' :
-                   fs == fsAddedRepo ? 'a' :
-                   fs == fsGhost     ? '!' :
-                                       ' ';
+    char cStatus = VcsStatusChar(fs);
 
     if (cStatus != ' ')
         pCols[0] = Stati[cStatus];
@@ -595,37 +774,74 @@ intptr_t VcsPlugin::GetFindData(GetFindDataInfo *pinfo)
 {
     pinfo->StructSize = sizeof GetFindDataInfo;
 
-    // Read the VCS data (does nothing if not in a VCS-controlled directory)
+    if (bAllChanges)
+    {
+        vector<PluginPanelItem> v;
+        GetAllChangesFindData(v);
 
-    boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(curDir);
+        if (!v.empty())
+        {
+            pinfo->PanelItem = new PluginPanelItem[v.size()];
+            memcpy(pinfo->PanelItem, &v[0], v.size() * sizeof PluginPanelItem);
+            pinfo->ItemsNumber = v.size();
+        }
+
+        return 1;
+    }
+
+    // The directory shown stays retained whatever else is loaded
+
+    GetEntriesCacheBudget().Pin(this, curDir);
+
+    // Read the VCS data (does nothing if not in a VCS-controlled directory).
+    // Chances are it has already been loaded in the background.
+
+    boost::intrusive_ptr<IVcsData> pVcsData = Prefetch.Take(curDir);
+
+    if (pVcsData)
+        Statistics().nPrefetchHits.Add();
+    else
+    {
+        pVcsData = GetVcsData(curDir);
+
+        if (pVcsData)
+            Statistics().nPrefetchMisses.Add();
+    }
 
     // Enumerate all the file entries in the current directory
 
     vector<PluginPanelItem> v;
     v.reserve(1000); // Just a guess
 
+    vector<tstring> vSubDirs; // Candidates for prefetching
+
     if (pVcsData && pVcsData->IsValid())
     {
         for (const auto& entry : pVcsData->entries())
         {
             PluginPanelItem pi = W32FindDataToPluginPanelItem(entry.second.fileFindData);
+            EVcsStatus fs = entry.second.status;
 
             if (entry.second.bDir)
             {
                 pi.FileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
                 tstring sFullPathName = CatPath(curDir.c_str(), entry.first.c_str());
 
-                // !!! What is going on here?
-                // if (DirtyDirs.ContainsDown(sFullPathName))
-                //     entry.second.status = fsModified;
-                // else if (OutdatedFiles.ContainsDown(sFullPathName))
-                //     entry.second.status = fsOutdated;
+                if (entry.first != _T(".."))
+                    vSubDirs.push_back(sFullPathName);
+
+                fs = DirRowStatus(sFullPathName, fs);
             }
 
             //array_strcpy( pi.FindData.cFileName, strcmp(p->first.c_str(),"..") == 0 ? ".." : CatPath(szCurDir,p->first.c_str()).c_str() );
-            DecoratePanelItem(pi, entry.second, pVcsData->getTag());
+            DecoratePanelItem(pi, entry.second, fs, pVcsData->getTag());
             v.push_back( pi );
         }
+
+        // Far calls us on every panel update, so restart only if the directory has changed
+
+        if (!EqualNoCase()(Prefetch.GetRoot(this), curDir))
+            Prefetch.Start(this, curDir, vSubDirs);
     }
     else
     {
@@ -683,6 +899,38 @@ intptr_t VcsPlugin::GetFindData(GetFindDataInfo *pinfo)
     return 1;
 }
 
+/// <summary>
+/// The items of the flat list of the changes: every dirty and outdated file
+/// below curDir, named by its path relative to curDir, and ".." to go back.
+/// Only the directories known to hold changes are loaded.
+/// </summary>
+void VcsPlugin::GetAllChangesFindData(vector<PluginPanelItem>& v)
+{
+    WIN32_FIND_DATA findData;
+    memset(&findData, 0, sizeof findData);
+    findData.dwFileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+    _tcscpy_s(findData.cFileName, _T(".."));
+
+    v.push_back(W32FindDataToPluginPanelItem(findData));
+
+    VcsChanges changes = CollectChanges(curDir);
+    v.reserve(changes.size() + 1);
+
+    for (const auto& change : changes)
+    {
+        PluginPanelItem pi = W32FindDataToPluginPanelItem(change.entry.fileFindData);
+
+        free(reinterpret_cast<void*>(const_cast<TCHAR*>(pi.FileName)));
+        pi.FileName = _tcsdup(change.sRelativePathName.c_str());
+
+        if (change.entry.bDir)
+            pi.FileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
+
+        DecoratePanelItem(pi, change.entry, change.entry.status, change.sTag);
+        v.push_back(pi);
+    }
+}
+
 void VcsPlugin::FreeFindData(const FreeFindDataInfo *pinfo)
 {
     for (int i = 0; i < pinfo->ItemsNumber; ++i)
@@ -741,6 +989,132 @@ intptr_t VcsPlugin::ProcessPanelEvent(const ProcessPanelEventInfo *pinfo)
     return FALSE;
 }
 
+//==========================================================================>>
+// Status and update of the panel directory:
+//   Ctrl+Shift+F5  remote status of the tree, or of the selected files only
+//   Ctrl+Alt+F5    local status of the directory
+//   Ctrl+Shift+F6  update of the tree
+//   Ctrl+Alt+F6    update of the directory
+// The other keys of the Far 2 handler below are yet to be ported.
+//==========================================================================>>
+
+intptr_t VcsPlugin::ProcessPanelInput(const ProcessPanelInputInfo *pinfo)
+{
+    if (pinfo->Rec.EventType != KEY_EVENT || !pinfo->Rec.Event.KeyEvent.bKeyDown)
+        return FALSE;
+
+    WORD wKey = pinfo->Rec.Event.KeyEvent.wVirtualKeyCode;
+    DWORD dwState = pinfo->Rec.Event.KeyEvent.dwControlKeyState;
+
+    bool bCtrl  = (dwState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) != 0;
+    bool bAlt   = (dwState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) != 0;
+    bool bShift = (dwState & SHIFT_PRESSED) != 0;
+
+    bool bCtrlAlt   = bCtrl &&  bAlt && !bShift;
+    bool bCtrlShift = bCtrl && !bAlt &&  bShift;
+
+    if (!(bCtrlAlt || bCtrlShift) || (wKey != VK_F5 && wKey != VK_F6))
+        return FALSE;
+
+    PanelInfo pi = { sizeof(PanelInfo) };
+    StartupInfo.PanelControl(this, FCTL_GETPANELINFO, 0, &pi);
+
+    if (pi.PanelType != PTYPE_FILEPANEL || pi.ItemsNumber == 0)
+        return FALSE;
+
+    boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(curDir);
+
+    if (!pVcsData || !pVcsData->IsValid())
+        return FALSE;
+
+    if (bCtrlShift && wKey == VK_F5 && pi.SelectedItemsNumber > 1)
+    {
+        // The remote status of the selected files only, queried in one
+        // invocation per directory rather than one per file
+
+        vector<tstring> vFileNames;
+
+        for (size_t i = 0; i < pi.SelectedItemsNumber; ++i)
+        {
+            tstring sName = GetSelectedItem(this, i); // Relative in the list of all the changes
+
+            if (!sName.empty() && sName != _T(".."))
+                vFileNames.push_back(sName);
+        }
+
+        VcsFileStatuses statuses;
+
+        if (vFileNames.empty() || !pVcsData->Status(vFileNames, statuses))
+            return FALSE;
+
+        ::Cache.Save();
+
+        StartupInfo.PanelControl(this, FCTL_UPDATEPANEL, 0, nullptr);
+        StartupInfo.PanelControl(this, FCTL_REDRAWPANEL, 0, nullptr);
+
+        return TRUE;
+    }
+
+    bool bLocal = bCtrlAlt;
+    bool bWholeTree = true; // Whether the dirty state may have changed anywhere below
+
+    if (wKey == VK_F5 && !bLocal)
+    {
+        RemoteMarkerMap::iterator pMarker = RemoteMarkers.find(curDir);
+        tstring sMarker = pMarker != RemoteMarkers.end() ? pMarker->second : tstring();
+        tstring sLastMarker = sMarker;
+
+        // Without a marker, the whole subtree is queried anew
+
+        if (sMarker.empty())
+            OutdatedFiles.RemoveFilesOfDir(curDir, true);
+
+        bool bFull = true;
+        bool bResult = pVcsData->UpdateStatusSince(sMarker, bFull);
+
+        if (bResult && !sMarker.empty())
+            RemoteMarkers[curDir] = sMarker;
+        else
+            RemoteMarkers.erase(curDir);
+
+        // Nothing committed since the last time
+
+        if (bResult && !bFull && !sLastMarker.empty() && sMarker == sLastMarker)
+            return TRUE;
+
+        // Otherwise an incremental status has refreshed the directories it has queried
+
+        bWholeTree = !bResult || bFull;
+    }
+    else if (wKey == VK_F5)
+    {
+        OutdatedFiles.RemoveFilesOfDir(curDir, false);
+        pVcsData->UpdateStatus(true);
+    }
+    else
+    {
+        if (pVcsData->Update(bLocal))
+            OutdatedFiles.RemoveFilesOfDir(curDir, !bLocal);
+    }
+
+    // CVS derives the dirty directories from the update output, and so
+    // does an incremental status for the directories it has queried.
+    // Otherwise the tree is traversed. Either way the counts on the
+    // directory rows are rebuilt from them.
+
+    if (!bLocal && !pVcsData->ReportsDirtyDirs() && bWholeTree)
+        Traversal(cszPluginName, curDir.c_str()).Execute();
+    else
+        RebuildDirCounts(curDir);
+
+    ::Cache.Save();
+
+    StartupInfo.PanelControl(this, FCTL_UPDATEPANEL, 0, nullptr);
+    StartupInfo.PanelControl(this, FCTL_REDRAWPANEL, 0, nullptr);
+
+    return TRUE;
+}
+
 /* !!! Review and uncomment
 //==========================================================================>>
 // We have to override the processing of Ctrl+Enter and Ctrl+Insert keys
@@ -844,7 +1218,7 @@ intptr_t VcsPlugin::ProcessPanelInput(ProcessPanelInputInfo *pinfo)
     {
         boost::intrusive_ptr<IVcsData> apVcsData = GetVcsData( szCurDir );
 
-        if ( !apVcsData || !apVcsData->IsValid() || !IsVcsFile(pi.PanelItems[pi.CurrentItem].FindData,*apVcsData) && !OutdatedFiles.ContainsEntry(szCurFile) )
+        if ( !apVcsData || !apVcsData->IsValid() || !IsVcsFile(pi.PanelItems[pi.CurrentItem].FindData,*apVcsData) && !OutdatedFiles.Contains(szCurFile) )
             return FALSE;
 
         TempFile tempFile;
@@ -867,33 +1241,6 @@ intptr_t VcsPlugin::ProcessPanelInput(ProcessPanelInputInfo *pinfo)
                                 1, 1 );
         return TRUE;
     }
-    else if ( (bCtrlAlt || bCtrlShift) && (Key == VK_F5 || Key == VK_F6) ) // Alt/Ctrl + Shift + F5/F6
-    {
-        boost::intrusive_ptr<IVcsData> apVcsData = GetVcsData( szCurDir );
-
-        bool bLocal = bCtrlAlt;
-
-        if ( Key == VK_F5 )
-        {
-            OutdatedFiles.RemoveFilesOfDir( szCurDir, !bLocal );
-            apVcsData->UpdateStatus( bLocal );
-        }
-        else
-        {
-            if ( apVcsData->Update( bLocal ) )
-                OutdatedFiles.RemoveFilesOfDir( szCurDir, !bLocal );
-        }
-
-        if ( !bLocal )
-            Traversal( cszPluginName, szCurDir ).Execute();
-
-        ::Cache.Save();
-
-        StartupInfo.Control( this, FCTL_UPDATEPANEL, 0 );
-        StartupInfo.Control( this, FCTL_REDRAWPANEL, 0 );
-
-        return TRUE;
-    }
     else if ( bCtrl && Key == VK_OEM_PLUS ) // Ctrl+=
     {
         boost::intrusive_ptr<IVcsData> apVcsData = GetVcsData( szCurDir );
@@ -9,11 +9,20 @@
 
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <set>
 #include <time.h>
 #include <boost/utility.hpp>
 #include <boost/function.hpp>
+#include <boost/ref.hpp>
 #include "longop.h"
 #include "vcsdata.h"
+#include "cvsentries.h"
+#include "regwrap.h"
+#include "cvsclient.h"
+#include "filecache.h"
+#include "pristine.h"
+#include "verify.h"
 
 using namespace std;
 using namespace boost;
@@ -24,33 +33,14 @@ HINSTANCE hResInst;
 
 string sPluginName;
 
-//==========================================================================>>
-// Detects whether a file is locally modified
-//==========================================================================>>
-
-bool IsFileModified( const FILETIME &ftLastWriteTime, string sCvsTimestamp )
-{
-    if ( sCvsTimestamp.empty() )
-        return false;
-
-    SYSTEMTIME base_st = { 1970, 1, 0, 1, 0, 0, 0, 0 };
-    FILETIME base_ft;
+const char cszSettingsKey[] = "HKEY_CURRENT_USER\\Software\\FAR\\Plugins\\FarVCS";
 
-    ::SystemTimeToFileTime( &base_st, &base_ft );
-    time_t itime = (*(unsigned _int64*)&ftLastWriteTime - *(unsigned _int64*)&base_ft)/10000000L;
-    time_t itime_tz = itime + 3600;
+// The base revisions of modified files are fetched into the pristine store in the background
 
-    string sModifTime( ::asctime( ::gmtime( &itime ) ) );
-    string sModifTimeTz( ::asctime( ::gmtime( &itime_tz ) ) );
-
-    sModifTime.erase( remove( sModifTime.begin(), sModifTime.end(), '\n' ) );
-    sModifTimeTz.erase( remove( sModifTimeTz.begin(), sModifTimeTz.end(), '\n' ) );
-
-    size_t i = sCvsTimestamp.find( "  " );
-    if ( i != string::npos )
-        sCvsTimestamp[i+1] = '0';
-
-    return sCvsTimestamp != sModifTime && sCvsTimestamp != sModifTimeTz;
+bool IsPristineFetchEnabled()
+{
+    static bool bEnabled = RegWrap( cszSettingsKey ).ReadDword( "bCvsPristineFetch", 1 ) != 0;
+    return bEnabled;
 }
 
 //==========================================================================>>
@@ -70,175 +60,293 @@ public:
         char cTagType;
         string sTag;
 
-        if ( ReadTagFile( sDir, cTagType, sTag ) )
+        if ( ReadCvsTagFile( sDir, cTagType, sTag ) )
             setTag( sTag.c_str() );
     }
 
     static const char *GetAdminDirName() { return "CVS"; }
-    static const bool IsVcsDir( const string& sDir ) { return ::GetFileAttributes( CatPath( sDir.c_str(), "CVS\\Entries" ).c_str() ) != (DWORD)-1; }
+    static const bool IsVcsDir( const string& sDir ) { return IsCvsDir( sDir ); }
     
     void self_destroy() { delete this; }
 
     bool UpdateStatus( bool bLocal );
+    bool UpdateStatusSince( string& sMarker, bool& bFull );
     bool Update( bool bLocal );
     bool Annotate( const string& sFileName, const string& sTempFile );
     bool Status( const string& sFileName, string& sWorkingRevision );
+    bool Status( const vector<string>& vFileNames, VcsFileStatuses& statuses );
     bool GetRevisionTemp( const string& sFileName, const string& sRevision, const string& sTempFile );
+    bool ReportsDirtyDirs() const { return true; }
+
+    typedef function<void( CvsRequest&, const CvsSession& )> RequestBuilder;
+
+    CvsSession::EResult RunOverSession( const RequestBuilder& fBuild, const string& sPrompt, const function<void(char*)>& fLine, const char *szOutFile = 0 );
+    void DescribeWorkingCopy( CvsRequest& request, const CvsSession& session, bool bRecursive ) const;
 
 protected:
     void GetVcsEntriesOnly() const
     {
         m_Entries.clear();
-        ReadEntriesFile( false );
-        ReadEntriesFile( true );
+        ReadCvsEntriesFile( getDir(), false, m_Entries );
+        ReadCvsEntriesFile( getDir(), true, m_Entries );
     }
 
     void AdjustVcsEntry( VcsEntry& entry, const WIN32_FIND_DATA& findData ) const
     {
-        string sFullPathName = CatPath( getDir(), findData.cFileName );
-
-        entry.status = strcmp( entry.sRevision.c_str(), "0" ) == 0                  ? fsAdded    :
-                       entry.sRevision.c_str()[0] == '-'                            ? fsRemoved  :
-                       entry.sTimestamp.find_first_of( "+" ) != string::npos        ? fsConflict :
-                       IsFileModified( findData.ftLastWriteTime, entry.sTimestamp ) ? fsModified :
-                       m_OutdatedFiles.ContainsEntry( sFullPathName )               ? fsOutdated :
-                                                                                      fsNormal;
+        entry.status = GetCvsLocalStatus( entry, findData );
+
+        if ( entry.status == fsNormal && IsOutdatedEntry( findData.cFileName ) )
+            entry.status = fsOutdated;
+
+        // Have the base revision at hand by the time the user wants to compare
+
+        if ( entry.status == fsModified && IsCommittedRevision( entry.sRevision ) && IsPristineFetchEnabled() )
+            Pristine.FetchInBackground( getDir(), findData.cFileName, entry.sRevision, GetCacheKey( findData.cFileName, entry.sRevision ) );
     }
 
+    bool AdjustVcsEntries() const;
+
 private:
-    bool ReadEntriesFile( bool bEntriesLog ) const;
-    bool ReadTagFile( const string& sDir, char& cTagType, string& sTag );
+    static bool IsCommittedRevision( const string& sRevision ) { return !sRevision.empty() && sRevision != "0" && sRevision[0] != '-'; }
+
+    string GetCacheKey( const string& sName, const string& sRevision ) const;
+    bool FetchRevision( const string& sName, const string& sRevision, const string& sTmpFile );
+
+    vector<string> GetSubtrees() const;
+    bool UpdateSubtrees( const vector<string>& vSubDirs, const string& sGlobalFlags, bool bReal );
+
+    mutable string m_sCacheKeyRoot; // CVS/Root and CVS/Repository, read once
 };
 
+std::string GetGlobalFlags()
+{
+    return sformat( " -z%d", 9 /* !!! m_VcsPlugin.Settings.nCompressionLevel*/ );
+}
+
 //==========================================================================>>
-// Reads 'Entries' or 'Entries.Log' file
+// Reads the first line of a small administrative file, e.g. CVS/Root
 //==========================================================================>>
 
-bool CvsData::ReadEntriesFile( bool bEntriesLog ) const
+string ReadFirstLine( const string& sFileName )
 {
-    // Construct the file name
+    ifstream f( sFileName.c_str() );
 
-    const char *szEntriesFile = bEntriesLog ? "CVS\\Entries.Log" : "CVS\\Entries";
+    char buf[4096] = "";
+    f.getline( buf, sizeof buf );
+    buf[sizeof buf-1] = 0;
 
-    ifstream fEntries( CatPath(getDir(),szEntriesFile).c_str() );
+    return buf;
+}
 
-    if ( !fEntries )
-        return false;
+//==========================================================================>>
+// Persistent server session. The read-only commands are run through an
+// in-process protocol client instead of spawning cvs every time. Can be
+// turned off in the registry, in which case cvs is spawned as before.
+//==========================================================================>>
 
-    // Parse the file
+bool IsSessionEnabled()
+{
+    static bool bEnabled = RegWrap( cszSettingsKey ).ReadDword( "bCvsServerSession", 1 ) != 0;
+    return bEnabled;
+}
 
-    char buf[4096];
+void CvsData::DescribeWorkingCopy( CvsRequest& request, const CvsSession& session, bool bRecursive ) const
+{
+    VcsDataLoader fLoadSubDir;
 
-    while ( fEntries )
-    {
-        fEntries.getline( buf, sizeof buf );
+    if ( bRecursive )
+        fLoadSubDir = [this]( const string& sSubDir ) { return boost::intrusive_ptr<IVcsData>( new CvsData( sSubDir, m_DirtyDirs, m_OutdatedFiles ) ); };
 
-        if ( !fEntries )
-            break;
+    DescribeCvsWorkingCopy( request, session, getDir(), entries(), fLoadSubDir );
+}
 
-        buf[sizeof buf-1] = 0;
-        const char *pStartPos = buf;
+CvsSession::EResult CvsData::RunOverSession( const RequestBuilder& fBuild, const string& sPrompt, const function<void(char*)>& fLine, const char *szOutFile )
+{
+    if ( !IsSessionEnabled() )
+        return CvsSession::rsUnavailable;
 
-        bool bRemoveEntry = false;
-        bool bDir = false;
+    CvsSession *pSession = CvsSession::Acquire( ReadFirstLine( CatPath( getDir(), "CVS\\Root" ) ) );
 
-        if ( bEntriesLog )
-        {
-            if ( buf[0] == 'R' && buf[1] == ' ' )
-                bRemoveEntry = true;
-            else if ( buf[0] == 'A' && buf[1] == ' ' )
-                bRemoveEntry = false;
-            else
-                continue; // Unrecognized format
-            pStartPos += 2;
-        }
+    if ( !pSession )
+        return CvsSession::rsUnavailable;
 
-        if ( pStartPos[0] == 'D' )
-        {
-            bDir = true;
-            ++pStartPos;
-        }
+    CvsRequest request;
+    fBuild( request, *pSession );
 
-        if ( pStartPos[0] != '/' ) // Unrecognized format
-            continue;
+    ofstream fOut;
 
-        vector<string> vFields = SplitString( pStartPos+1, '/' );
-        if ( vFields.empty() ) // Unrecognized format
-            continue;
+    if ( szOutFile )
+    {
+        fOut.open( szOutFile, ios::binary );
 
-        if ( !bRemoveEntry )
-            m_Entries.insert( make_pair( vFields[0], VcsEntry( bDir, vFields, vFields[1][0] == '-' ? fsRemoved : fsGhost ) ) );
-        else
-            m_Entries.erase( vFields[0] );
+        if ( !fOut )
+            return CvsSession::rsUnavailable;
     }
 
-    return true;
-}
-
-//==========================================================================>>
-// Reads 'Tag' file
-//==========================================================================>>
-
-bool CvsData::ReadTagFile( const string& sDir, char& cTagType, string& sTag )
-{
-    cTagType = 0;
-    sTag.clear();
+    CvsSession::EResult result = CvsSession::rsUnavailable;
 
-    // Construct the file name
-
-    ifstream fTag( CatPath(sDir.c_str(),"CVS\\Tag").c_str() );
-
-    if ( !fTag )
-        return false;
+    InProcessOperation( sPluginName.c_str(), sPrompt, [&]( const InProcessOperation::LineSink& fSink ) -> bool
+    {
+        result = pSession->Run( request, [&]( const char *szLine, bool bStdErr ) -> bool
+        {
+            if ( szLine == 0 )
+                return fSink( 0 );
 
-    // Read the first line of the file and ignore the rest
+            // The standard output goes to the file if one is given, like Executor does
 
-    char buf[4096];
+            if ( szOutFile && !bStdErr )
+            {
+                fOut << szLine << "\r\n";
+                return fSink( 0 );
+            }
 
-    fTag.getline( buf, sizeof buf );
-    buf[sizeof buf/sizeof *buf-1] = 0;
+            if ( fLine )
+            {
+                vector<char> buf( szLine, szLine + strlen(szLine) + 1 ); // The callbacks are allowed to modify the line
+                fLine( &buf[0] );
+            }
 
-    if ( !fTag )
-        return false;
+            return fSink( szLine );
+        } );
 
-    cTagType = *buf;
-    sTag = buf+1;
-    return true;
-}
+        return result == CvsSession::rsOk;
+    } ).Execute();
 
-std::string GetGlobalFlags()
-{
-    return sformat( " -z%d", 9 /* !!! m_VcsPlugin.Settings.nCompressionLevel*/ );
+    return result;
 }
 
 //==========================================================================>>
 // Update/Update status
 //==========================================================================>>
 
+//==========================================================================>>
+// Besides the outdated files, notes every directory cvs reports on and the
+// ones having locally changed files, so that DirtyDirs can be brought up to
+// date from the output instead of traversing the tree once again.
+//==========================================================================>>
+
 struct CvsUpProcessor
 {
     CvsUpProcessor( CvsData& cvsData, bool bReal ) :
         m_pCvsData( &cvsData ),
-        m_bReal( bReal )
-    {}
+        m_bReal( bReal ),
+        m_sDirPrefix( cvsData.getDir() ),
+        m_OutdatedFiles( cvsData.m_OutdatedFiles ),
+        m_DirtyDirs( cvsData.m_DirtyDirs )
+    {
+        if ( !m_sDirPrefix.empty() && !strchr( "\\/:", *m_sDirPrefix.rbegin() ) )
+            m_sDirPrefix += '\\';
+
+        m_VisitedDirs.insert( cvsData.getDir() );
+    }
 
     void operator()( char *sz )
     {
-        if ( ::strlen(sz) > 1 && (sz[0] == 'U' || sz[0] == 'P') && sz[1] == ' ' )
+        size_t nLen = ::strlen( sz );
+        std::replace( sz, sz + nLen, '/', '\\' );
+
+        // "cvs update: Updating <dir>" precedes the output for each directory
+
+        if ( const char *szDir = ::strstr( sz, ": Updating " ) )
         {
-            for ( char *p = sz+2; *p; ++p )
-                if ( *p == '/' )
-                    *p = '\\';
+            szDir += ::strlen( ": Updating " );
+            m_VisitedDirs.insert( strcmp( szDir, "." ) == 0 ? string( m_pCvsData->getDir() ) : m_sDirPrefix + szDir );
+            return;
+        }
 
+        if ( nLen < 3 || sz[1] != ' ' )
+            return;
+
+        string sFullPathName = m_sDirPrefix + (sz+2);
+
+        switch ( sz[0] )
+        {
+        case 'U':
+        case 'P':
             if ( m_bReal )
-                m_pCvsData->m_OutdatedFiles.Remove( CatPath( m_pCvsData->getDir(), sz+2 ) );
+            {
+                m_OutdatedFiles.Remove( sFullPathName );
+                m_UpdatedFiles[ExtractPath( sFullPathName )].push_back( ExtractFileName( sFullPathName ) );
+            }
             else
-                m_pCvsData->m_OutdatedFiles.Add( CatPath( m_pCvsData->getDir(), sz+2 ) );
+                m_OutdatedFiles.Add( sFullPathName );
+            break;
+
+        case 'C':
+            if ( m_bReal )
+                m_OutdatedFiles.Remove( sFullPathName );
+            else
+                m_OutdatedFiles.Add( sFullPathName ); // Would conflict, so is outdated as well
+            // Fall through
+
+        case 'M':
+        case 'A':
+        case 'R':
+            m_ChangedDirs.insert( ExtractPath( sFullPathName ) );
+            break;
+
+        default: // '?' - unknown files do not make the directory dirty
+            break;
         }
     }
 
+    // Publishes the collected changes. DirtyDirs are only updated if the command
+    // has completed, since the output of an interrupted one does not cover all
+    // the directories.
+
+    void Commit( bool bCompleted )
+    {
+        m_OutdatedFiles.Commit();
+
+        if ( !bCompleted )
+            return;
+
+        for ( set<string, LessNoCase>::const_iterator p = m_VisitedDirs.begin(); p != m_VisitedDirs.end(); ++p )
+        {
+            bool bDirty = m_ChangedDirs.find( *p ) != m_ChangedDirs.end();
+
+            // cvs compares the contents while we look at the timestamps, which
+            // are rewritten by the update. Look at the directory ourselves then.
+            // The updated files are exactly their committed revisions now, so
+            // they go to the pristine store as well.
+
+            map<string, vector<string>, LessNoCase>::const_iterator pUpdated = m_UpdatedFiles.find( *p );
+
+            if ( pUpdated != m_UpdatedFiles.end() && CvsData::IsVcsDir( *p ) )
+            {
+                CvsData dirData( *p, m_pCvsData->m_DirtyDirs, m_pCvsData->m_OutdatedFiles );
+
+                for ( VcsEntries::const_iterator pEntry = dirData.entries().begin(); pEntry != dirData.entries().end() && !bDirty; ++pEntry )
+                    bDirty = IsFileDirty( pEntry->second.status );
+
+                for ( vector<string>::const_iterator pName = pUpdated->second.begin(); pName != pUpdated->second.end(); ++pName )
+                {
+                    VcsEntries::const_iterator pEntry = dirData.entries().find( *pName );
+
+                    if ( pEntry != dirData.entries().end() && pEntry->second.status == fsNormal && CvsData::IsCommittedRevision( pEntry->second.sRevision ) )
+                        Pristine.Put( dirData.GetCacheKey( *pName, pEntry->second.sRevision ), CatPath( p->c_str(), pName->c_str() ) );
+                }
+            }
+
+            if ( bDirty )
+                m_DirtyDirs.Add( *p );
+            else
+                m_DirtyDirs.Remove( *p );
+        }
+
+        m_DirtyDirs.Commit();
+    }
+
     CvsData *m_pCvsData;
     bool m_bReal;
+    string m_sDirPrefix;              // The directory the command runs in, with the trailing backslash
+
+    TSFileSetBatch m_OutdatedFiles;
+    TSFileSetBatch m_DirtyDirs;
+
+    set<string, LessNoCase> m_VisitedDirs;  // Directories cvs has reported on
+    set<string, LessNoCase> m_ChangedDirs;  // ... of them having modified, added, removed or conflicting files
+    map<string, vector<string>, LessNoCase> m_UpdatedFiles; // ... of them having files updated by cvs, with the names of the files
 };
 
 bool CvsData::UpdateStatus( bool bLocal )
@@ -248,7 +356,32 @@ bool CvsData::UpdateStatus( bool bLocal )
 
     string sCmdLine = sformat( "cvs%s up%s", sGlobalFlags.c_str(), sCommandFlags.c_str() );
 
-    return Executor( sPluginName.c_str(), getDir(), sCmdLine, &function<void(char*)>(CvsUpProcessor(*this,false)) ).Execute();
+    CvsUpProcessor processor( *this, false );
+
+    CvsSession::EResult result = RunOverSession( [&]( CvsRequest& request, const CvsSession& session )
+    {
+        request.GlobalOption( "-n" );
+
+        if ( bLocal )
+            request.Argument( "-l" );
+
+        DescribeWorkingCopy( request, session, !bLocal );
+        request.Command( "update" );
+    }, sCmdLine, boost::ref(processor) );
+
+    if ( result == CvsSession::rsUnavailable && !bLocal )
+    {
+        vector<string> vSubDirs = GetSubtrees();
+
+        if ( vSubDirs.size() > 1 && GetMaxParallelJobs() > 1 )
+            return UpdateSubtrees( vSubDirs, sGlobalFlags, false );
+    }
+
+    bool bResult = result != CvsSession::rsUnavailable ? result == CvsSession::rsOk
+                                                       : Executor( sPluginName.c_str(), getDir(), sCmdLine, boost::ref(processor) ).Execute();
+    processor.Commit( bResult );
+
+    return bResult;
 }
 
 bool CvsData::Update( bool bLocal )
@@ -258,64 +391,518 @@ bool CvsData::Update( bool bLocal )
 
     string sCmdLine = sformat( "cvs%s up%s", sGlobalFlags.c_str(), sCommandFlags.c_str() );
 
-    return Executor( sPluginName.c_str(), getDir(), sCmdLine, &function<void(char*)>(CvsUpProcessor(*this,true)) ).Execute();
+    if ( !bLocal )
+    {
+        vector<string> vSubDirs = GetSubtrees();
+
+        if ( vSubDirs.size() > 1 && GetMaxParallelJobs() > 1 )
+            return UpdateSubtrees( vSubDirs, sGlobalFlags, true );
+    }
+
+    CvsUpProcessor processor( *this, true );
+
+    bool bResult = Executor( sPluginName.c_str(), getDir(), sCmdLine, boost::ref(processor) ).Execute();
+
+    processor.Commit( bResult );
+
+    return bResult;
+}
+
+//==========================================================================>>
+// A recursive update of a directory with several CVS-controlled subdirectories
+// (typically, a tree of modules) is split into a local update of the directory
+// itself and a recursive update of each subdirectory. These are independent,
+// so several cvs processes run them at once, each waiting for its own server
+// round-trips.
+//==========================================================================>>
+
+unsigned int GetMaxParallelJobs()
+{
+    static unsigned int nMaxParallelJobs = RegWrap( cszSettingsKey ).ReadDword( "nMaxParallelJobs", 4 );
+    return nMaxParallelJobs;
+}
+
+vector<string> CvsData::GetSubtrees() const
+{
+    vector<string> vSubDirs;
+    PathBuilder path( getDir() );
+
+    for ( VcsEntries::const_iterator p = entries().begin(); p != entries().end(); ++p )
+    {
+        if ( !p->second.bDir || p->first == ".." || p->first == GetAdminDirName() || !IsVcsFile( p->second.status ) )
+            continue;
+
+        size_t nMark = path.Push( p->first );
+
+        if ( IsVcsDir( path.str() ) )
+            vSubDirs.push_back( p->first );
+
+        path.Pop( nMark );
+    }
+
+    return vSubDirs;
+}
+
+bool CvsData::UpdateSubtrees( const vector<string>& vSubDirs, const string& sGlobalFlags, bool bReal )
+{
+    vector<unique_ptr<CvsData>> vSubDirData;
+    vector<unique_ptr<CvsUpProcessor>> vProcessors;
+    vector<ParallelExecutor::Job> jobs;
+
+    vProcessors.emplace_back( new CvsUpProcessor( *this, bReal ) );
+
+    ParallelExecutor::Job topJob = { getDir(), sformat( "cvs%s up -l", sGlobalFlags.c_str() ), "", boost::ref( *vProcessors.back() ) };
+    jobs.push_back( topJob );
+
+    for ( vector<string>::const_iterator p = vSubDirs.begin(); p != vSubDirs.end(); ++p )
+    {
+        vSubDirData.emplace_back( new CvsData( CatPath( getDir(), p->c_str() ), m_DirtyDirs, m_OutdatedFiles ) );
+        vProcessors.emplace_back( new CvsUpProcessor( *vSubDirData.back(), bReal ) );
+
+        ParallelExecutor::Job subJob = { vSubDirData.back()->getDir(), sformat( "cvs%s up", sGlobalFlags.c_str() ), *p + ": ", boost::ref( *vProcessors.back() ) };
+        jobs.push_back( subJob );
+    }
+
+    ParallelExecutor executor( sPluginName.c_str(),
+                               sformat( "cvs%s up (%u subtrees, %u at a time)", sGlobalFlags.c_str(), static_cast<unsigned int>( jobs.size() ), GetMaxParallelJobs() ),
+                               jobs,
+                               GetMaxParallelJobs() );
+
+    bool bResult = executor.Execute() != 0;
+
+    for ( size_t i = 0; i < vProcessors.size(); ++i )
+        vProcessors[i]->Commit( executor.Succeeded( i ) );
+
+    return bResult;
 }
 
 //==========================================================================>>
-// Annotate
+// Incremental remote status. The marker is the time of the previous refresh.
+// 'cvs rlog' lists the files committed since, and only their directories are
+// queried again. The server clock may differ from ours, so the commits are
+// looked for a few minutes before the marker.
 //==========================================================================>>
 
+struct CvsRlogProcessor
+{
+    CvsRlogProcessor( const string& sRepositoryPath, const string& sLocalDir, set<string, LessNoCase>& changedDirs ) :
+        m_sRepositoryPath( sRepositoryPath ),
+        m_sLocalDir( sLocalDir ),
+        m_pChangedDirs( &changedDirs )
+    {}
+
+    // The lines are the names of the RCS files, e.g. "/cvsroot/module/dir/Attic/foo.c,v"
+
+    void operator()( char *sz )
+    {
+        size_t nLen = m_sRepositoryPath.length();
+
+        if ( strncmp( sz, m_sRepositoryPath.c_str(), nLen ) != 0 || sz[nLen] != '/' )
+            return;
+
+        string sRelative( sz + nLen + 1 );
+
+        if ( sRelative.length() < 3 || sRelative.compare( sRelative.length()-2, 2, ",v" ) != 0 )
+            return;
+
+        sRelative.erase( sRelative.length()-2 );
+        std::replace( sRelative.begin(), sRelative.end(), '/', '\\' );
+
+        // Only the directory matters, so a file removed to the Attic counts in its original one
+
+        string sDir = ExtractPath( CatPath( m_sLocalDir.c_str(), sRelative.c_str() ) );
+
+        if ( ExtractFileName( sDir ) == "Attic" )
+            sDir = ExtractPath( sDir );
+
+        // A directory added in the repository is not checked out yet, so its
+        // nearest checked out ancestor is queried instead
+
+        while ( sDir.length() > m_sLocalDir.length() && !CvsData::IsVcsDir( sDir ) )
+            sDir = ExtractPath( sDir );
+
+        m_pChangedDirs->insert( sDir );
+    }
+
+    string m_sRepositoryPath;
+    string m_sLocalDir;
+    set<string, LessNoCase> *m_pChangedDirs;
+};
+
+bool CvsData::UpdateStatusSince( string& sMarker, bool& bFull )
+{
+    const time_t cnClockSkew = 5*60;
+
+    time_t nNow = ::time( 0 );
+    time_t nLast = sMarker.empty() ? 0 : _atoi64( sMarker.c_str() );
+
+    string sGlobalFlags = GetGlobalFlags();
+
+    CvsRoot root;
+    string sRepository = ReadFirstLine( CatPath( getDir(), "CVS\\Repository" ) );
+
+    bFull = nLast <= 0 || nLast > nNow || sRepository.empty() || !CvsRoot::Parse( ReadFirstLine( CatPath( getDir(), "CVS\\Root" ) ), root );
+
+    if ( bFull )
+    {
+        if ( !UpdateStatus( false ) )
+            return false;
+
+        sMarker = sformat( "%I64d", static_cast<__int64>( nNow ) );
+        return true;
+    }
+
+    // rlog takes the module path relative to the root, and reports the full paths of the RCS files
+
+    if ( sRepository.compare( 0, root.sPath.length() + 1, root.sPath + '/' ) == 0 )
+        sRepository.erase( 0, root.sPath.length() + 1 );
+
+    time_t nSince = nLast - cnClockSkew;
+    char szSince[32];
+    strftime( szSince, sizeof szSince, "%Y-%m-%d %H:%M:%S UTC", gmtime( &nSince ) );
+
+    set<string, LessNoCase> changedDirs;
+    CvsRlogProcessor rlogProcessor( root.sPath + '/' + sRepository, getDir(), changedDirs );
+
+    string sRlogCmdLine = sformat( "cvs%s -Q rlog -S -R -d \">%s\" %s", sGlobalFlags.c_str(), szSince, QuoteIfNecessary( sRepository ).c_str() );
+
+    if ( !Executor( sPluginName.c_str(), getDir(), sRlogCmdLine, boost::ref(rlogProcessor) ).Execute() )
+        return false;
+
+    // Every changed directory is queried by a local 'cvs -n up' of its own
+
+    vector<unique_ptr<CvsData>> vDirData;
+    vector<unique_ptr<CvsUpProcessor>> vProcessors;
+    vector<ParallelExecutor::Job> jobs;
+
+    for ( set<string, LessNoCase>::const_iterator p = changedDirs.begin(); p != changedDirs.end(); ++p )
+    {
+        m_OutdatedFiles.RemoveFilesOfDir( *p, false );
+
+        vDirData.emplace_back( new CvsData( *p, m_DirtyDirs, m_OutdatedFiles ) );
+        vProcessors.emplace_back( new CvsUpProcessor( *vDirData.back(), false ) );
+
+        string sLabel = p->length() > strlen( getDir() ) ? p->substr( strlen( getDir() ) + 1 ) + ": " : "";
+
+        ParallelExecutor::Job job = { *p, sformat( "cvs%s -n up -l", sGlobalFlags.c_str() ), sLabel, boost::ref( *vProcessors.back() ) };
+        jobs.push_back( job );
+    }
+
+    bool bResult = true;
+
+    if ( !jobs.empty() )
+    {
+        ParallelExecutor executor( sPluginName.c_str(),
+                                   sformat( "cvs%s -n up -l (%u directories, %u at a time)", sGlobalFlags.c_str(), static_cast<unsigned int>( jobs.size() ), GetMaxParallelJobs() ),
+                                   jobs,
+                                   GetMaxParallelJobs() );
+
+        bResult = executor.Execute() != 0;
+
+        for ( size_t i = 0; i < vProcessors.size(); ++i )
+            vProcessors[i]->Commit( executor.Succeeded( i ) );
+    }
+
+    if ( bResult )
+        sMarker = sformat( "%I64d", static_cast<__int64>( nNow ) );
+
+    return bResult;
+}
+
+//==========================================================================>>
+// Annotate. The annotations are kept in an on-disk LRU cache, so that cvs is
+// only run once for every revision.
+//==========================================================================>>
+
+FileCache& GetAnnotateCache()
+{
+    static FileCache cache( CatPath( GetLocalAppDataFolder().c_str(), "FarVCS\\annotate" ),
+                            static_cast<unsigned __int64>( RegWrap( cszSettingsKey ).ReadDword( "nAnnotateCacheMB", 64 ) ) << 20 );
+    return cache;
+}
+
+// Identifies a committed revision of a file regardless of the working copy it is in
+
+string CvsData::GetCacheKey( const string& sName, const string& sRevision ) const
+{
+    if ( m_sCacheKeyRoot.empty() )
+        m_sCacheKeyRoot = ReadFirstLine( CatPath( getDir(), "CVS\\Root" ) ) + '\n' + ReadFirstLine( CatPath( getDir(), "CVS\\Repository" ) );
+
+    return m_sCacheKeyRoot + '/' + sName + '\n' + sRevision + '\n' + getTag();
+}
+
+//==========================================================================>>
+// The files with the timestamps differing from the ones in CVS/Entries are
+// compared with their base revisions from the pristine store, so that the
+// files touched but not changed do not show as modified
+//==========================================================================>>
+
+bool IsContentVerificationEnabled()
+{
+    static bool bEnabled = RegWrap( cszSettingsKey ).ReadDword( "bCvsVerifyContents", 1 ) != 0;
+    return bEnabled;
+}
+
+// The entries whose verification was inconclusive, the base revision being
+// fetched yet, are not retained: the signature of the directory would not
+// change once it is there
+
+bool CvsData::AdjustVcsEntries() const
+{
+    if ( !IsContentVerificationEnabled() )
+        return true;
+
+    vector<ContentVerifier::Item> items;
+    vector<VcsEntries::iterator> vEntries;
+    PathBuilder path( getDir() );
+
+    for ( VcsEntries::iterator p = m_Entries.begin(); p != m_Entries.end(); ++p )
+    {
+        VcsEntry& entry = p->second;
+
+        if ( entry.status != fsModified || !IsCommittedRevision( entry.sRevision ) )
+            continue;
+
+        size_t nMark = path.Push( p->first );
+        ContentVerifier::Item item = { path.str(), GetCacheKey( p->first, entry.sRevision ), entry.fileFindData, true, false };
+        path.Pop( nMark );
+
+        items.push_back( item );
+        vEntries.push_back( p );
+    }
+
+    Verifier.Verify( items );
+
+    bool bVerified = true;
+
+    for ( size_t i = 0; i < items.size(); ++i )
+    {
+        if ( !items[i].bModified )
+            vEntries[i]->second.status = IsOutdatedEntry( vEntries[i]->first ) ? fsOutdated : fsNormal;
+
+        bVerified &= items[i].bVerified;
+    }
+
+    return bVerified;
+}
+
 bool CvsData::Annotate( const string& sFileName, const string& sTmpFile )
 {
-    string sCommandFlags = *getTag() ? sformat( " -r %s", getTag() ) : "";
+    string sName = ExtractFileName(sFileName.c_str());
 
-    return Executor( sPluginName.c_str(),
-                     getDir(),
-                     sformat( "cvs%s annotate%s %s", GetGlobalFlags().c_str(), sCommandFlags.c_str(), ExtractFileName(sFileName.c_str()).c_str() ),
-                     0,
-                     sTmpFile.c_str() ).Execute();
+    // The working revision is annotated rather than the head, so that the result
+    // never changes and can be cached. Added and removed files are not cached.
+
+    VcsEntries::const_iterator pEntry = entries().find( sName );
+    bool bCommitted = pEntry != entries().end() && IsCommittedRevision( pEntry->second.sRevision );
+
+    string sRevision = bCommitted ? pEntry->second.sRevision : getTag();
+    string sKey = bCommitted ? GetCacheKey( sName, sRevision ) : "";
+
+    if ( !sKey.empty() && GetAnnotateCache().Get( sKey, sTmpFile ) )
+        return true;
+
+    string sCommandFlags = !sRevision.empty() ? sformat( " -r %s", sRevision.c_str() ) : "";
+
+    CvsSession::EResult result = RunOverSession( [&]( CvsRequest& request, const CvsSession& session )
+    {
+        if ( !sRevision.empty() )
+            request.Argument( "-r" ), request.Argument( sRevision );
+
+        request.Argument( sName );
+        DescribeWorkingCopy( request, session, false );
+        request.Command( "annotate" );
+    }, sformat( "cvs annotate%s %s", sCommandFlags.c_str(), sName.c_str() ), 0, sTmpFile.c_str() );
+
+    bool bResult = result != CvsSession::rsUnavailable ? result == CvsSession::rsOk
+                                                       : Executor( sPluginName.c_str(),
+                                                                   getDir(),
+                                                                   sformat( "cvs%s annotate%s %s", GetGlobalFlags().c_str(), sCommandFlags.c_str(), sName.c_str() ),
+                                                                   0,
+                                                                   sTmpFile.c_str() ).Execute();
+    if ( bResult && !sKey.empty() )
+        GetAnnotateCache().Put( sKey, sTmpFile );
+
+    return bResult;
 }
 
 //==========================================================================>>
-// Status
+// Status. The output of 'cvs status' for several files is parsed line by
+// line as it comes:
+//
+// ===================================================================
+// File: foo.c             Status: Needs Patch
+//
+//    Working revision:    1.2
+//    Repository revision: 1.3     /cvsroot/module/foo.c,v
+//
+// The changes of OutdatedFiles are collected and applied at once when the
+// processor is destroyed.
 //==========================================================================>>
 
 struct CvsStatusProcessor
 {
-    CvsStatusProcessor( string& sWorkingRevision ) :
-        m_psWorkingRevision( &sWorkingRevision )
+    CvsStatusProcessor( const string& sDir, VcsFileStatuses& statuses, TSFileSet& OutdatedFiles ) :
+        m_path( sDir ),
+        m_pStatuses( &statuses ),
+        m_OutdatedFiles( OutdatedFiles ),
+        m_pCurrent( 0 )
     {}
 
     void operator()( char *sz )
     {
-        static const char cszWorkingRevision[] = "Working revision:";
+        static const char cszFile[]               = "File: ";
+        static const char cszNoFile[]             = "no file ";
+        static const char cszStatus[]             = "\tStatus: ";
+        static const char cszWorkingRevision[]    = "Working revision:";
+        static const char cszRepositoryRevision[] = "Repository revision:";
 
-        const char *p = ::strstr( sz, cszWorkingRevision );
+        if ( ::strncmp( sz, cszFile, _countof(cszFile)-1 ) == 0 )
+        {
+            const char *szName = sz + _countof(cszFile)-1;
+            const char *szStatus = ::strstr( szName, cszStatus );
 
-        if ( p == 0 )
-            return;
+            if ( szStatus == 0 )
+            {
+                m_pCurrent = 0;
+                return;
+            }
 
-        for ( p += sizeof cszWorkingRevision/sizeof *cszWorkingRevision-1; isspace(*p); ++p );
+            if ( ::strncmp( szName, cszNoFile, _countof(cszNoFile)-1 ) == 0 )
+                szName += _countof(cszNoFile)-1;
 
-        if ( *p == 0 )
-            return;
+            // The name is padded with spaces before the tab
+
+            const char *szNameEnd = szStatus;
+            while ( szNameEnd > szName && szNameEnd[-1] == ' ' )
+                --szNameEnd;
+
+            size_t nMark = m_path.Push( szName, szNameEnd-szName );
+            const string& sFullPathName = m_path.str();
+
+            m_pCurrent = &(*m_pStatuses)[sFullPathName];
+            m_pCurrent->sStatus = szStatus + _countof(cszStatus)-1;
+
+            if ( m_pCurrent->sStatus.find( "Needs" ) == 0 ) // Needs Patch, Needs Checkout, Needs Merge
+                m_OutdatedFiles.Add( sFullPathName );
+            else
+                m_OutdatedFiles.Remove( sFullPathName );
+
+            m_path.Pop( nMark );
+        }
+        else if ( m_pCurrent )
+        {
+            if ( ExtractField( sz, cszWorkingRevision, m_pCurrent->sWorkingRevision ) )
+                return;
+
+            ExtractField( sz, cszRepositoryRevision, m_pCurrent->sRepositoryRevision );
+        }
+    }
+
+    // Extracts the first word after the label, if the line contains the label
+
+    static bool ExtractField( const char *sz, const char *szLabel, string& sValue )
+    {
+        const char *p = ::strstr( sz, szLabel );
+
+        if ( p == 0 )
+            return false;
+
+        for ( p += ::strlen(szLabel); isspace((unsigned char)*p); ++p );
 
         const char *szStart = p;
 
-        for ( ; *p && !isspace(*p); ++p );
+        for ( ; *p && !isspace((unsigned char)*p); ++p );
 
-        *m_psWorkingRevision = string( szStart, p-szStart );
+        sValue.assign( szStart, p-szStart );
+        return true;
     }
 
-    string *m_psWorkingRevision;
+    PathBuilder m_path; // The directory, with the name of the current file pushed while it is recorded
+    VcsFileStatuses *m_pStatuses;
+    TSFileSetBatch m_OutdatedFiles;
+    VcsFileStatus *m_pCurrent; // The file the lines being read belong to
 };
 
 bool CvsData::Status( const string& sFileName, string& sWorkingRevision )
 {
-    return Executor( sPluginName.c_str(),
-                     getDir(),
-                     sformat( "cvs%s status %s", GetGlobalFlags().c_str(), ExtractFileName(sFileName.c_str()).c_str() ),
-                     &function<void(char*)>(CvsStatusProcessor(sWorkingRevision)) ).Execute();
+    string sFullPathName = CatPath( getDir(), ExtractFileName(sFileName.c_str()).c_str() );
+
+    VcsFileStatuses statuses;
+
+    if ( !Status( vector<string>( 1, sFullPathName ), statuses ) )
+        return false;
+
+    VcsFileStatuses::const_iterator p = statuses.find( sFullPathName );
+
+    if ( p == statuses.end() )
+        return false;
+
+    sWorkingRevision = p->second.sWorkingRevision;
+    return true;
+}
+
+//==========================================================================>>
+// Batch status: one 'cvs status' per directory for all the files in it.
+// Running it per directory keeps the "File:" lines (which carry the base
+// name only) unambiguous.
+//==========================================================================>>
+
+bool CvsData::Status( const vector<string>& vFileNames, VcsFileStatuses& statuses )
+{
+    // ExecuteConsoleNoWait has a fixed-size command line buffer
+
+    const size_t cnMaxCmdLine = 1900;
+
+    map<string, vector<string>, LessNoCase> filesByDir;
+
+    for ( vector<string>::const_iterator p = vFileNames.begin(); p != vFileNames.end(); ++p )
+    {
+        string sFullPathName = CatPath( getDir(), p->c_str() );
+        filesByDir[ExtractPath(sFullPathName)].push_back( ExtractFileName(sFullPathName) );
+    }
+
+    bool bResult = true;
+
+    for ( map<string, vector<string>, LessNoCase>::const_iterator pDir = filesByDir.begin(); pDir != filesByDir.end(); ++pDir )
+    {
+        string sBaseCmdLine = sformat( "cvs%s status", GetGlobalFlags().c_str() );
+
+        // The session has no command line length limit, so one command does for the whole directory
+
+        CvsData dirData( pDir->first, m_DirtyDirs, m_OutdatedFiles );
+        CvsStatusProcessor sessionProcessor( pDir->first, statuses, m_OutdatedFiles );
+
+        CvsSession::EResult result = dirData.RunOverSession( [&]( CvsRequest& request, const CvsSession& session )
+        {
+            for ( vector<string>::const_iterator pFile = pDir->second.begin(); pFile != pDir->second.end(); ++pFile )
+                request.Argument( *pFile );
+
+            dirData.DescribeWorkingCopy( request, session, false );
+            request.Command( "status" );
+        }, sBaseCmdLine, boost::ref(sessionProcessor) );
+
+        if ( result != CvsSession::rsUnavailable )
+        {
+            bResult &= result == CvsSession::rsOk;
+            continue;
+        }
+
+        for ( vector<string>::const_iterator pFile = pDir->second.begin(); pFile != pDir->second.end(); )
+        {
+            string sCmdLine = sBaseCmdLine;
+
+            do
+                sCmdLine += ' ' + QuoteIfNecessary( *pFile++ );
+            while ( pFile != pDir->second.end() && sCmdLine.length() + pFile->length() + 3 < cnMaxCmdLine );
+
+            CvsStatusProcessor processor( pDir->first, statuses, m_OutdatedFiles );
+
+            bResult &= Executor( sPluginName.c_str(), pDir->first.c_str(), sCmdLine, boost::ref(processor) ).Execute() != 0;
+        }
+    }
+
+    return bResult;
 }
 
 //==========================================================================>>
@@ -324,9 +911,45 @@ bool CvsData::Status( const string& sFileName, string& sWorkingRevision )
 
 bool CvsData::GetRevisionTemp( const string& sFileName, const string& sRevision, const string& sTmpFile )
 {
+    string sName = ExtractFileName(sFileName.c_str());
+    string sKey = IsCommittedRevision( sRevision ) ? GetCacheKey( sName, sRevision ) : "";
+
+    if ( !sKey.empty() && Pristine.Get( sKey, sTmpFile ) )
+        return true;
+
+    bool bResult = FetchRevision( sName, sRevision, sTmpFile );
+
+    if ( bResult && !sKey.empty() )
+        Pristine.Put( sKey, sTmpFile );
+
+    return bResult;
+}
+
+bool CvsData::FetchRevision( const string& sName, const string& sRevision, const string& sTmpFile )
+{
+    // The session delivers the contents line by line, which would mangle binary files
+
+    VcsEntries::const_iterator pEntry = entries().find( sName );
+
+    if ( pEntry == entries().end() || pEntry->second.sOptions.find( "b" ) == string::npos )
+    {
+        CvsSession::EResult result = RunOverSession( [&]( CvsRequest& request, const CvsSession& session )
+        {
+            request.Argument( "-r" );
+            request.Argument( sRevision );
+            request.Argument( "-p" );
+            request.Argument( sName );
+            DescribeWorkingCopy( request, session, false );
+            request.Command( "update" );
+        }, sformat( "cvs up -r %s -p %s", sRevision.c_str(), sName.c_str() ), 0, sTmpFile.c_str() );
+
+        if ( result != CvsSession::rsUnavailable )
+            return result == CvsSession::rsOk;
+    }
+
     return Executor( sPluginName.c_str(),
                      getDir(),
-                     sformat( "cvs%s up -r %s -p %s", GetGlobalFlags().c_str(), sRevision.c_str(), ExtractFileName(sFileName.c_str()).c_str() ),
+                     sformat( "cvs%s up -r %s -p %s", GetGlobalFlags().c_str(), sRevision.c_str(), sName.c_str() ),
                      0,
                      sTmpFile.c_str() ).Execute();
 }
@@ -343,6 +966,36 @@ extern "C" __declspec(dllexport) void Initialize( PluginStartupInfo& startupInfo
     hResInst = hHostInst;
 
     sPluginName = string(szPluginName) + "/CVS";
+
+    Pristine.Init( CatPath( GetLocalAppDataFolder().c_str(), "FarVCS\\pristine" ),
+                   static_cast<unsigned __int64>( RegWrap( cszSettingsKey ).ReadDword( "nPristineStoreMB", 256 ) ) << 20 );
+}
+
+extern "C" __declspec(dllexport) void Uninitialize()
+{
+    Pristine.Shutdown();
+    CvsSession::CloseAll();
+    ModuleEntriesCache().Clear(); // While the budget of the host is still there
+}
+
+extern "C" __declspec(dllexport) void AttachStatistics( VcsStatistics *pStatistics )
+{
+    AttachStatisticsTo( pStatistics );
+}
+
+extern "C" __declspec(dllexport) void AttachTrace( ITraceSink *pSink )
+{
+    AttachTraceTo( pSink );
+}
+
+extern "C" __declspec(dllexport) void AttachEntriesCache( EntriesCacheBudget *pBudget )
+{
+    AttachEntriesCacheBudgetTo( pBudget );
+}
+
+extern "C" __declspec(dllexport) void AttachDirCounts( IDirCountsSink *pSink )
+{
+    AttachDirCountsTo( pSink );
 }
 
 extern "C" __declspec(dllexport) bool IsPluginDir( const string& sDir )
@@ -7,17 +7,23 @@
  Dependencies: STL
 *****************************************************************************/
 
+#include <set>
+#include <boost/function.hpp>
 #include <boost/utility.hpp>
 #include "vcsdata.h"
 #include "plugutil.h"
+#include "longop.h"
 
 #undef _CRT_SECURE_NO_DEPRECATE
 
 #include "svn_client.h"
 #include "svn_cmdline.h"
 #include "svn_pools.h"
+#include "svn_path.h"
+#include "svn_ra.h"
 #include "svn_config.h"
 #include "svn_fs.h"
+#include "svn_error_codes.h"
 
 using namespace std;
 using namespace boost;
@@ -41,10 +47,13 @@ public:
     void self_destroy() { delete this; }
 
     bool UpdateStatus( bool bLocal );
-    bool Update( bool ) { return false; }
-    bool Annotate( const string& /*sFileName*/, const string& /*sTempFile*/ ) { return false; }
-    bool GetRevisionTemp( const string& /*sFileName*/, const string& /*sRevision*/, const string& /*sTempFile*/ ) { return false; }
-    bool Status( const std::string& /*sFileName*/, std::string& /*sWorkingRevision*/ ) { return false; }
+    bool UpdateStatusSince( string& sMarker, bool& bFull );
+    bool Update( bool bLocal );
+    bool Annotate( const string& sFileName, const string& sTempFile );
+    bool GetRevisionTemp( const string& sFileName, const string& sRevision, const string& sTempFile );
+    bool Status( const std::string& sFileName, std::string& sWorkingRevision );
+    bool Status( const vector<string>& vFileNames, VcsFileStatuses& statuses );
+    bool ReportsDirtyDirs() const { return false; }
 
     // Public Morozov pattern below :)
 
@@ -55,45 +64,91 @@ protected:
     void GetVcsEntriesOnly() const;
 };
 
-#define ENF( f ) { if ( f != 0 ) { printf( "ERROR in " #f ); return; } }
+#define ENF_INIT( f ) { if ( f != 0 ) { printf( "ERROR in " #f ); return; } }
+
+//==========================================================================>>
+// The client context is created once, when the plugin is loaded: reading
+// the configuration and setting up the RA layer for every operation costs
+// more than many of the operations themselves.
+//==========================================================================>>
 
 class SvnClient : private noncopyable
 {
 public:
     SvnClient() : m_pool(0), m_ctx(0)
     {
-        ENF( svn_cmdline_init( "farvcs", stderr ) );
+        ENF_INIT( svn_cmdline_init( "farvcs", stderr ) );
 
         m_pool = svn_pool_create(0);
 
-        ENF( svn_fs_initialize( m_pool ) );
-        ENF( svn_config_ensure( 0, m_pool ) );
-        ENF( svn_client_create_context( &m_ctx, m_pool ) );
-        ENF( svn_config_get_config( &m_ctx->config, 0, m_pool ) );
+        ENF_INIT( svn_fs_initialize( m_pool ) );
+        ENF_INIT( svn_config_ensure( 0, m_pool ) );
+        ENF_INIT( svn_client_create_context( &m_ctx, m_pool ) );
+        ENF_INIT( svn_config_get_config( &m_ctx->config, 0, m_pool ) );
 
         if ( getenv( "SVN_ASP_DOT_NET_HACK" ) )
-            ENF( svn_wc_set_adm_dir( "_svn", m_pool ) );
+            ENF_INIT( svn_wc_set_adm_dir( "_svn", m_pool ) );
     }
 
     virtual ~SvnClient()
     {
-        apr_pool_destroy( pool() );
+        apr_pool_destroy( m_pool );
         apr_terminate();
     }
 
-    apr_pool_t       *pool() { return m_pool; }
-    svn_client_ctx_t *ctx() { return m_ctx; }
+    //======================================================================>>
+    // Exclusive use of the shared context by a single operation, with a
+    // scratch pool of its own. The directory entries may be read on a
+    // background thread, so the operations are serialized.
+    //======================================================================>>
+
+    class Session : private noncopyable
+    {
+    public:
+        explicit Session( SvnClient& client ) : m_guard( client.m_cs ), m_ctx( client.m_ctx ), m_pool( client.m_pool ? svn_pool_create( client.m_pool ) : 0 )
+        {
+            if ( m_ctx )
+            {
+                m_ctx->notify_func2 = 0;
+                m_ctx->cancel_func = 0;
+            }
+        }
+
+        ~Session()
+        {
+            if ( m_ctx )
+            {
+                m_ctx->notify_func2 = 0;
+                m_ctx->cancel_func = 0;
+            }
+
+            if ( m_pool )
+                svn_pool_destroy( m_pool );
+        }
+
+        apr_pool_t       *pool() { return m_pool; }
+        svn_client_ctx_t *ctx()  { return m_ctx; }
+
+        bool IsValid() const { return m_ctx != 0 && m_pool != 0; }
+
+    private:
+        CSGuard m_guard;
+        svn_client_ctx_t *m_ctx;
+        apr_pool_t *m_pool;
+    };
 
 private:
+    CriticalSection m_cs;
     apr_pool_t *m_pool;
     svn_client_ctx_t *m_ctx;
 };
 
+SvnClient *pSvnClient; // Created in Initialize, destroyed in Uninitialize
+
 struct StatusCbData
 {
     const char *szDir;
     const SvnData *pSvnData;
-    bool bUpdateStatus;
 };
 
 void svn_wc_status_callback( void *status_baton, const char *path, svn_wc_status2_t *status )
@@ -124,18 +179,14 @@ void svn_wc_status_callback( void *status_baton, const char *path, svn_wc_status
                     status->text_status == svn_wc_status_external     ? fsExternal   :
                     status->text_status == svn_wc_status_incomplete   ? fsIncomplete :
                                                                         fsBogus;
-    if ( !pcb->bUpdateStatus )
-        pcb->pSvnData->m_Entries.insert( make_pair( szFileName,
-                                                    VcsEntry( status->entry && status->entry->kind == svn_node_dir, 
-                                                              szFileName,
-                                                              status->entry ? l2s(status->entry->revision) : "",
-                                                              "",
-                                                              "",
-                                                              "",
-                                                              fs ) ) );
-    else
-        if ( fs == fsOutdated )
-            pcb->pSvnData->m_OutdatedFiles.Add( path );
+    pcb->pSvnData->m_Entries.insert( make_pair( szFileName,
+                                                VcsEntry( status->entry && status->entry->kind == svn_node_dir, 
+                                                          szFileName,
+                                                          status->entry ? l2s(status->entry->revision) : "",
+                                                          "",
+                                                          "",
+                                                          "",
+                                                          fs ) ) );
 }
 
 bool CheckSuccess( svn_error_t *perr, const char *szUserFriendlyMessage )
@@ -144,24 +195,34 @@ bool CheckSuccess( svn_error_t *perr, const char *szUserFriendlyMessage )
         return true;
 
     string sError( szUserFriendlyMessage );
+    bool bCancelled = perr->apr_err == SVN_ERR_CANCELLED;
     
-    for ( ; perr; perr = perr->child )
-        sError += sformat( "\n\x01\n[Error %d] %s", perr->apr_err, perr->message );
+    for ( svn_error_t *p = perr; p; p = p->child )
+        sError += sformat( "\n\x01\n[Error %d] %s", p->apr_err, p->message );
+
+    svn_error_clear( perr );
+
+    if ( !bCancelled ) // The user knows
+        MsgBoxWarning( sPluginName.c_str(), sError.c_str() );
 
-    MsgBoxWarning( sPluginName.c_str(), sError.c_str() );
     return false;
 }
 
 void SvnData::GetVcsEntriesOnly() const
 {
-    SvnClient svn;
+    SvnClient::Session svn( *pSvnClient );
+
+    if ( !svn.IsValid() )
+        return;
 
     svn_revnum_t result_rev;
     svn_opt_revision_t requested_rev = { svn_opt_revision_base };
 
     m_Entries.clear();
 
-    StatusCbData cbdata = { getDir(), this, false };
+    StatusCbData cbdata = { getDir(), this };
+
+    ScopedStatTimer _( Statistics().tSvnLibrary );
 
     svn_error_t *perr = svn_client_status2
     (
@@ -182,32 +243,593 @@ void SvnData::GetVcsEntriesOnly() const
     CheckSuccess( perr, "Getting directory entries failed" );
 }
 
-bool SvnData::UpdateStatus( bool bLocal )
+//==========================================================================>>
+// Operations shown in the FAR dialog. libsvn reports the items processed to
+// the notification callback, which scrolls them in the dialog, and polls the
+// cancellation callback, which keeps the dialog responsive in between.
+//==========================================================================>>
+
+class SvnProgress : private noncopyable
 {
-    SvnClient svn;
+public:
+    SvnProgress( const InProcessOperation::LineSink& fSink, const char *szBaseDir ) :
+        m_fSink( fSink ),
+        m_sBaseDir( szBaseDir ),
+        m_bCancelled( false )
+    {}
 
-    svn_revnum_t result_rev;
-    svn_opt_revision_t requested_rev = { svn_opt_revision_base };
+    void Attach( svn_client_ctx_t *ctx )
+    {
+        ctx->notify_func2  = Notify;
+        ctx->notify_baton2 = this;
+        ctx->cancel_func   = Cancel;
+        ctx->cancel_baton  = this;
+    }
 
-    StatusCbData cbdata = { getDir(), this, true };
+private:
+    static void Notify( void *baton, const svn_wc_notify_t *notify, apr_pool_t *pool )
+    {
+        SvnProgress *pThis = reinterpret_cast<SvnProgress *>( baton );
+
+        char cAction = notify->action == svn_wc_notify_update_add    ? 'A' :
+                       notify->action == svn_wc_notify_update_delete ? 'D' :
+                       notify->action == svn_wc_notify_exists        ? 'E' :
+                       notify->action == svn_wc_notify_update_update ? ( notify->content_state == svn_wc_notify_state_conflicted ? 'C' :
+                                                                         notify->content_state == svn_wc_notify_state_merged     ? 'G' :
+                                                                                                                                   'U' ) :
+                                                                       0;
+        string sLine;
+
+        if ( cAction )
+            sLine = sformat( "%c %s", cAction, pThis->RelativePath( notify->path, pool ) );
+        else if ( notify->action == svn_wc_notify_update_completed && SVN_IS_VALID_REVNUM( notify->revision ) )
+            sLine = sformat( "At revision %ld.", notify->revision );
+        else if ( notify->action == svn_wc_notify_status_completed && SVN_IS_VALID_REVNUM( notify->revision ) )
+            sLine = sformat( "Status against revision %ld.", notify->revision );
+        else if ( notify->action == svn_wc_notify_blame_revision )
+            sLine = sformat( "Revision %ld", notify->revision );
+        else
+            return;
+
+        if ( pThis->m_fSink( sLine.c_str() ) )
+            pThis->m_bCancelled = true;
+    }
 
-    svn_error_t *perr = svn_client_status2
+    static svn_error_t *Cancel( void *baton )
+    {
+        SvnProgress *pThis = reinterpret_cast<SvnProgress *>( baton );
+
+        if ( !pThis->m_bCancelled && pThis->m_fSink( 0 ) )
+            pThis->m_bCancelled = true;
+
+        return pThis->m_bCancelled ? svn_error_create( SVN_ERR_CANCELLED, 0, "Cancelled by the user" ) : SVN_NO_ERROR;
+    }
+
+    // The paths are reported in the internal style, relative to the working copy if possible
+
+    const char *RelativePath( const char *szPath, apr_pool_t *pool ) const
+    {
+        size_t nLen = m_sBaseDir.length();
+
+        if ( _strnicmp( szPath, m_sBaseDir.c_str(), nLen ) == 0 && szPath[nLen] == '/' )
+            szPath += nLen + 1;
+
+        return svn_path_local_style( szPath, pool );
+    }
+
+    const InProcessOperation::LineSink& m_fSink;
+    string m_sBaseDir;
+    bool m_bCancelled;
+};
+
+typedef boost::function<svn_error_t *( SvnClient::Session&, const char *szDir )> SvnOperation;
+
+// Runs the operation in the progress dialog. The operation gets the directory in the internal style.
+
+bool RunSvnOperation( const char *szDir, const string& sPrompt, const char *szUserFriendlyMessage, const SvnOperation& fOperation )
+{
+    bool bResult = false;
+
+    InProcessOperation( sPluginName.c_str(), sPrompt, [&]( const InProcessOperation::LineSink& fSink ) -> bool
+    {
+        SvnClient::Session svn( *pSvnClient );
+
+        if ( !svn.IsValid() )
+            return false;
+
+        const char *szInternalDir = svn_path_internal_style( szDir, svn.pool() );
+
+        SvnProgress progress( fSink, szInternalDir );
+        progress.Attach( svn.ctx() );
+
+        svn_error_t *perr;
+
+        {
+            ScopedStatTimer _( Statistics().tSvnLibrary );
+            TraceSpan span( "RunSvnOperation", "backend", szDir );
+            perr = fOperation( svn, szInternalDir );
+        }
+
+        bResult = CheckSuccess( perr, szUserFriendlyMessage );
+        return bResult;
+    } ).Execute();
+
+    return bResult;
+}
+
+//==========================================================================>>
+// Remote status: a single recursive status against the repository, which
+// libsvn runs over one RA session. The items changed in the repository
+// since the working revision are outdated, whatever their local status.
+//==========================================================================>>
+
+void svn_wc_remote_status_callback( void *status_baton, const char *path, svn_wc_status2_t *status )
+{
+    TSFileSetBatch *pOutdatedFiles = reinterpret_cast<TSFileSetBatch *>( status_baton );
+
+    bool bOutdated = status->repos_text_status != svn_wc_status_none && status->repos_text_status != svn_wc_status_normal ||
+                     status->repos_prop_status != svn_wc_status_none && status->repos_prop_status != svn_wc_status_normal;
+
+    if ( !bOutdated )
+        return;
+
+    string sFullPathName( path );
+    std::replace( sFullPathName.begin(), sFullPathName.end(), '/', '\\' );
+
+    pOutdatedFiles->Add( sFullPathName );
+}
+
+svn_error_t *RemoteStatus( SvnClient::Session& svn, const char *szDir, bool bRecurse, TSFileSetBatch& outdatedFiles, apr_pool_t *pool )
+{
+    svn_revnum_t result_rev;
+    svn_opt_revision_t requested_rev = { svn_opt_revision_head };
+
+    return svn_client_status2
     (
         &result_rev,
-        getDir(),
+        szDir,
         &requested_rev,
-        svn_wc_status_callback,
-        (void*)&cbdata,
-        !bLocal, // recurse
-        false,   // get_all
-        true,    // update,
-        true,    // no_ignore
+        svn_wc_remote_status_callback,
+        (void*)&outdatedFiles,
+        bRecurse,
+        false,   // get_all: only the items with local or remote changes
+        true,    // update
+        false,   // no_ignore
         true,    // ignore_externals
         svn.ctx(),
-        svn.pool()
+        pool
     );
+}
+
+bool SvnData::UpdateStatus( bool bLocal )
+{
+    // The status reports every outdated item of the range it covers, so the
+    // earlier results of that range are dropped
+
+    m_OutdatedFiles.RemoveFilesOfDir( getDir(), !bLocal );
+
+    TSFileSetBatch outdatedFiles( m_OutdatedFiles );
+
+    bool bResult = RunSvnOperation( getDir(), sformat( "svn status -u %s", getDir() ), "Status update failed", [&]( SvnClient::Session& svn, const char *szDir ) -> svn_error_t *
+    {
+        return RemoteStatus( svn, szDir, !bLocal, outdatedFiles, svn.pool() );
+    } );
+
+    // Even if interrupted, the files found so far are known to be outdated
+
+    outdatedFiles.Commit();
+
+    return bResult;
+}
+
+//==========================================================================>>
+// Incremental remote status. The marker is the UUID and the youngest
+// revision of the repository. If the revision has moved, the log since the marker tells the paths
+// committed under the directory, and only their working copy directories
+// are queried again.
+//==========================================================================>>
+
+struct ChangedPathsCbData
+{
+    string sDirPath;                    // Repository path of the directory, e.g. "/trunk/src"
+    const char *szLocalDir;
+    set<string, LessNoCase> *pChangedDirs;
+};
 
-    return CheckSuccess( perr, "Status update failed" );
+svn_error_t *svn_log_changed_paths_receiver( void *baton, svn_log_entry_t *log_entry, apr_pool_t *pool )
+{
+    ChangedPathsCbData *pcb = reinterpret_cast<ChangedPathsCbData *>( baton );
+
+    if ( !log_entry->changed_paths )
+        return SVN_NO_ERROR;
+
+    for ( apr_hash_index_t *hi = apr_hash_first( pool, log_entry->changed_paths ); hi; hi = apr_hash_next( hi ) )
+    {
+        const void *key;
+        apr_hash_this( hi, &key, 0, 0 );
+
+        const char *szPath = reinterpret_cast<const char *>( key );
+        size_t nLen = pcb->sDirPath.length();
+
+        if ( strncmp( szPath, pcb->sDirPath.c_str(), nLen ) != 0 )
+            continue;
+
+        if ( szPath[nLen] == 0 )
+        {
+            pcb->pChangedDirs->insert( pcb->szLocalDir ); // The properties of the directory itself
+            continue;
+        }
+
+        if ( szPath[nLen] != '/' )
+            continue;
+
+        string sFullPathName = CatPath( pcb->szLocalDir, szPath + nLen + 1 );
+        std::replace( sFullPathName.begin(), sFullPathName.end(), '/', '\\' );
+
+        // The item is reported by the status of its directory. A directory
+        // added in the repository is not in the working copy yet, so its
+        // nearest versioned ancestor is queried instead.
+
+        string sDir = ExtractPath( sFullPathName );
+
+        while ( sDir.length() > strlen( pcb->szLocalDir ) && !SvnData::IsVcsDir( sDir ) )
+            sDir = ExtractPath( sDir );
+
+        pcb->pChangedDirs->insert( sDir );
+    }
+
+    return SVN_NO_ERROR;
+}
+
+bool SvnData::UpdateStatusSince( string& sMarker, bool& bFull )
+{
+    size_t nAt = sMarker.rfind( '@' );
+
+    string sLastUuid = nAt != string::npos ? sMarker.substr( 0, nAt ) : "";
+    svn_revnum_t nLastRevision = nAt != string::npos ? atol( sMarker.c_str() + nAt + 1 ) : SVN_INVALID_REVNUM;
+
+    string sUuid;
+    svn_revnum_t nYoungest = SVN_INVALID_REVNUM;
+
+    TSFileSetBatch outdatedFiles( m_OutdatedFiles );
+    set<string, LessNoCase> changedDirs;
+
+    bFull = false;
+
+    bool bResult = RunSvnOperation( getDir(), sformat( "svn status -u %s", getDir() ), "Status update failed", [&]( SvnClient::Session& svn, const char *szDir ) -> svn_error_t *
+    {
+        // Taken before the status, so that a commit made meanwhile is seen next time
+
+        const char *szUrl, *szReposRoot, *szUuid;
+        svn_ra_session_t *session;
+
+        SVN_ERR( svn_client_url_from_path( &szUrl, szDir, svn.pool() ) );
+
+        if ( !szUrl )
+            return svn_error_createf( SVN_ERR_ENTRY_MISSING_URL, 0, "'%s' has no URL", svn_path_local_style( szDir, svn.pool() ) );
+
+        SVN_ERR( svn_client_open_ra_session( &session, szUrl, svn.ctx(), svn.pool() ) );
+        SVN_ERR( svn_ra_get_uuid2( session, &szUuid, svn.pool() ) );
+        SVN_ERR( svn_ra_get_latest_revnum( session, &nYoungest, svn.pool() ) );
+
+        sUuid = szUuid;
+
+        // Relocated to another repository, or the marker is missing
+
+        if ( !SVN_IS_VALID_REVNUM( nLastRevision ) || nLastRevision > nYoungest || sLastUuid != sUuid )
+        {
+            bFull = true;
+            m_OutdatedFiles.RemoveFilesOfDir( getDir(), true );
+            return RemoteStatus( svn, szDir, true, outdatedFiles, svn.pool() );
+        }
+
+        if ( nLastRevision == nYoungest )
+            return SVN_NO_ERROR; // Nothing committed since
+
+        SVN_ERR( svn_ra_get_repos_root2( session, &szReposRoot, svn.pool() ) );
+
+        ChangedPathsCbData cbdata = { svn_path_uri_decode( szUrl + strlen( szReposRoot ), svn.pool() ), getDir(), &changedDirs };
+
+        apr_array_header_t *paths = apr_array_make( svn.pool(), 1, sizeof(const char *) );
+        APR_ARRAY_PUSH( paths, const char * ) = "";
+
+        SVN_ERR( svn_ra_get_log2
+        (
+            session,
+            paths,
+            nLastRevision + 1,
+            nYoungest,
+            0,     // limit
+            true,  // discover_changed_paths
+            false, // strict_node_history
+            false, // include_merged_revisions
+            apr_array_make( svn.pool(), 0, sizeof(const char *) ), // No revprops needed
+            svn_log_changed_paths_receiver,
+            &cbdata,
+            svn.pool()
+        ) );
+
+        for ( set<string, LessNoCase>::const_iterator p = changedDirs.begin(); p != changedDirs.end(); ++p )
+        {
+            apr_pool_t *pool = svn_pool_create( svn.pool() );
+
+            m_OutdatedFiles.RemoveFilesOfDir( *p, false );
+
+            svn_error_t *perr = RemoteStatus( svn, svn_path_internal_style( p->c_str(), pool ), false, outdatedFiles, pool );
+
+            svn_pool_destroy( pool );
+
+            if ( perr )
+                return perr;
+        }
+
+        return SVN_NO_ERROR;
+    } );
+
+    outdatedFiles.Commit();
+
+    // Only the changed directories have been queried: reloading them brings
+    // their dirty state up to date and saves the caller a traversal
+
+    if ( bResult )
+    {
+        for ( set<string, LessNoCase>::const_iterator p = changedDirs.begin(); p != changedDirs.end(); ++p )
+        {
+            if ( SvnData::IsVcsDir( *p ) )
+                SvnData( *p, m_DirtyDirs, m_OutdatedFiles ).entries();
+        }
+    }
+
+    sMarker = bResult && !sUuid.empty() && SVN_IS_VALID_REVNUM( nYoungest ) ? sformat( "%s@%ld", sUuid.c_str(), nYoungest ) : "";
+
+    return bResult;
+}
+
+bool SvnData::Update( bool bLocal )
+{
+    return RunSvnOperation( getDir(), sformat( "svn update %s", getDir() ), "Update failed", [=]( SvnClient::Session& svn, const char *szDir ) -> svn_error_t *
+    {
+        apr_array_header_t *paths = apr_array_make( svn.pool(), 1, sizeof(const char *) );
+        APR_ARRAY_PUSH( paths, const char * ) = szDir;
+
+        svn_opt_revision_t revision = { svn_opt_revision_head };
+
+        return svn_client_update3
+        (
+            0,
+            paths,
+            &revision,
+            bLocal ? svn_depth_files : svn_depth_unknown, // unknown: as deep as the working copy goes
+            false, // depth_is_sticky
+            false, // ignore_externals
+            false, // allow_unver_obstructions
+            svn.ctx(),
+            svn.pool()
+        );
+    } );
+}
+
+//==========================================================================>>
+// Annotate and GetRevisionTemp write straight to the destination file
+//==========================================================================>>
+
+svn_error_t *WriteToFile( void *baton, const char *data, apr_size_t *len )
+{
+    if ( fwrite( data, 1, *len, reinterpret_cast<FILE *>( baton ) ) != *len )
+        return svn_error_create( SVN_ERR_IO_WRITE_ERROR, 0, "Cannot write the temporary file" );
+
+    return SVN_NO_ERROR;
+}
+
+svn_error_t *BlameReceiver( void *baton, apr_int64_t /*line_no*/, svn_revnum_t revision, const char *author, const char * /*date*/,
+                            svn_revnum_t /*merged_revision*/, const char * /*merged_author*/, const char * /*merged_date*/,
+                            const char * /*merged_path*/, const char *line, apr_pool_t * /*pool*/ )
+{
+    // The same layout as 'svn blame' has
+
+    string sRevision = SVN_IS_VALID_REVNUM( revision ) ? l2s( revision ) : "-";
+
+    if ( fprintf( reinterpret_cast<FILE *>( baton ), "%6s %10s %s\n", sRevision.c_str(), author ? author : "-", line ) < 0 )
+        return svn_error_create( SVN_ERR_IO_WRITE_ERROR, 0, "Cannot write the temporary file" );
+
+    return SVN_NO_ERROR;
+}
+
+bool SvnData::Annotate( const string& sFileName, const string& sTmpFile )
+{
+    string sFullPathName = CatPath( getDir(), ExtractFileName(sFileName.c_str()).c_str() );
+
+    FILE *pFile = fopen( sTmpFile.c_str(), "wt" );
+
+    if ( !pFile )
+        return false;
+
+    bool bResult = RunSvnOperation( getDir(), sformat( "svn blame %s", sFullPathName.c_str() ), "Annotate failed", [&]( SvnClient::Session& svn, const char * ) -> svn_error_t *
+    {
+        svn_opt_revision_t start = { svn_opt_revision_number }, base = { svn_opt_revision_base };
+        start.value.number = 0;
+
+        return svn_client_blame4
+        (
+            svn_path_internal_style( sFullPathName.c_str(), svn.pool() ),
+            &base,  // peg_revision
+            &start,
+            &base,  // end
+            svn_diff_file_options_create( svn.pool() ),
+            false,  // ignore_mime_type
+            false,  // include_merged_revisions
+            BlameReceiver,
+            pFile,
+            svn.ctx(),
+            svn.pool()
+        );
+    } );
+
+    return fclose( pFile ) == 0 && bResult;
+}
+
+bool SvnData::GetRevisionTemp( const string& sFileName, const string& sRevision, const string& sTmpFile )
+{
+    string sName = ExtractFileName(sFileName.c_str());
+    string sFullPathName = CatPath( getDir(), sName.c_str() );
+
+    // The working revision comes from the text base in the working copy, without contacting the repository
+
+    VcsEntries::const_iterator pEntry = entries().find( sName );
+
+    svn_opt_revision_t revision = { svn_opt_revision_base };
+
+    if ( pEntry == entries().end() || pEntry->second.sRevision != sRevision )
+    {
+        revision.kind = svn_opt_revision_number;
+        revision.value.number = atol( sRevision.c_str() );
+    }
+
+    FILE *pFile = fopen( sTmpFile.c_str(), "wb" );
+
+    if ( !pFile )
+        return false;
+
+    bool bResult = RunSvnOperation( getDir(), sformat( "svn cat -r %s %s", sRevision.c_str(), sFullPathName.c_str() ), "Getting revision failed", [&]( SvnClient::Session& svn, const char * ) -> svn_error_t *
+    {
+        svn_stream_t *out = svn_stream_create( pFile, svn.pool() );
+        svn_stream_set_write( out, WriteToFile );
+
+        return svn_client_cat2
+        (
+            out,
+            svn_path_internal_style( sFullPathName.c_str(), svn.pool() ),
+            &revision, // peg_revision
+            &revision,
+            svn.ctx(),
+            svn.pool()
+        );
+    } );
+
+    return fclose( pFile ) == 0 && bResult;
+}
+
+//==========================================================================>>
+// Status: one query per directory, asking the repository for the revisions
+// of all the files requested in it at once.
+//==========================================================================>>
+
+struct FileStatusCbData
+{
+    const set<string, LessNoCase> *pNames;
+    const char *szLocalDir;
+    VcsFileStatuses *pStatuses;
+    TSFileSetBatch *pOutdatedFiles;
+};
+
+void svn_wc_file_status_callback( void *status_baton, const char *path, svn_wc_status2_t *status )
+{
+    FileStatusCbData *pcb = reinterpret_cast<FileStatusCbData *>( status_baton );
+
+    const char *szName = strrchr( path, '/' );
+    szName = szName ? szName + 1 : path;
+
+    if ( pcb->pNames->find( szName ) == pcb->pNames->end() )
+        return;
+
+    bool bLocalChanges  = status->text_status != svn_wc_status_normal && status->text_status != svn_wc_status_none;
+    bool bRemoteChanges = status->repos_text_status != svn_wc_status_none && status->repos_text_status != svn_wc_status_normal;
+
+    // Named the way 'cvs status' does, as the panel shows them for both
+
+    const char *szStatus = status->text_status == svn_wc_status_unversioned ? "Unknown"             :
+                           status->text_status == svn_wc_status_added       ? "Locally Added"       :
+                           status->text_status == svn_wc_status_deleted     ? "Locally Removed"     :
+                           status->text_status == svn_wc_status_conflicted  ? "Unresolved Conflict" :
+                           status->text_status == svn_wc_status_missing     ? "Needs Checkout"      :
+                           bLocalChanges && bRemoteChanges                  ? "Needs Merge"         :
+                           bRemoteChanges                                   ? "Needs Patch"         :
+                           bLocalChanges                                    ? "Locally Modified"    :
+                                                                              "Up-to-date";
+
+    string sFullPathName = CatPath( pcb->szLocalDir, szName );
+
+    VcsFileStatus& fileStatus = (*pcb->pStatuses)[sFullPathName];
+    fileStatus.sStatus = szStatus;
+    fileStatus.sWorkingRevision = status->entry && SVN_IS_VALID_REVNUM( status->entry->revision ) ? l2s( status->entry->revision ) : "";
+    fileStatus.sRepositoryRevision = SVN_IS_VALID_REVNUM( status->ood_last_cmt_rev ) ? l2s( status->ood_last_cmt_rev ) :
+                                     status->entry && SVN_IS_VALID_REVNUM( status->entry->cmt_rev ) ? l2s( status->entry->cmt_rev ) : "";
+
+    if ( strncmp( szStatus, "Needs", 5 ) == 0 )
+        pcb->pOutdatedFiles->Add( sFullPathName );
+    else
+        pcb->pOutdatedFiles->Remove( sFullPathName );
+}
+
+bool SvnData::Status( const string& sFileName, string& sWorkingRevision )
+{
+    string sFullPathName = CatPath( getDir(), ExtractFileName(sFileName.c_str()).c_str() );
+
+    VcsFileStatuses statuses;
+
+    if ( !Status( vector<string>( 1, sFullPathName ), statuses ) )
+        return false;
+
+    VcsFileStatuses::const_iterator p = statuses.find( sFullPathName );
+
+    if ( p == statuses.end() )
+        return false;
+
+    sWorkingRevision = p->second.sWorkingRevision;
+    return true;
+}
+
+bool SvnData::Status( const vector<string>& vFileNames, VcsFileStatuses& statuses )
+{
+    map<string, set<string, LessNoCase>, LessNoCase> filesByDir;
+
+    for ( vector<string>::const_iterator p = vFileNames.begin(); p != vFileNames.end(); ++p )
+    {
+        string sFullPathName = CatPath( getDir(), p->c_str() );
+        filesByDir[ExtractPath(sFullPathName)].insert( ExtractFileName(sFullPathName) );
+    }
+
+    TSFileSetBatch outdatedFiles( m_OutdatedFiles );
+
+    bool bResult = RunSvnOperation( getDir(), sformat( "svn status -u %s", getDir() ), "Status failed", [&]( SvnClient::Session& svn, const char * ) -> svn_error_t *
+    {
+        for ( map<string, set<string, LessNoCase>, LessNoCase>::const_iterator pDir = filesByDir.begin(); pDir != filesByDir.end(); ++pDir )
+        {
+            apr_pool_t *pool = svn_pool_create( svn.pool() );
+
+            FileStatusCbData cbdata = { &pDir->second, pDir->first.c_str(), &statuses, &outdatedFiles };
+
+            svn_revnum_t result_rev;
+            svn_opt_revision_t requested_rev = { svn_opt_revision_head };
+
+            svn_error_t *perr = svn_client_status2
+            (
+                &result_rev,
+                svn_path_internal_style( pDir->first.c_str(), pool ),
+                &requested_rev,
+                svn_wc_file_status_callback,
+                (void*)&cbdata,
+                false, // recurse
+                true,  // get_all
+                true,  // update
+                true,  // no_ignore
+                true,  // ignore_externals
+                svn.ctx(),
+                pool
+            );
+
+            svn_pool_destroy( pool );
+
+            if ( perr )
+                return perr;
+        }
+
+        return SVN_NO_ERROR;
+    } );
+
+    outdatedFiles.Commit();
+
+    return bResult;
 }
 
 extern "C" __declspec(dllexport) void Initialize( PluginStartupInfo& startupInfo, const char *szPluginName, HINSTANCE hHostInst )
@@ -218,6 +840,35 @@ extern "C" __declspec(dllexport) void Initialize( PluginStartupInfo& startupInfo
     hResInst = hHostInst;
 
     sPluginName = string(szPluginName) + "/Subversion";
+
+    pSvnClient = new SvnClient;
+}
+
+extern "C" __declspec(dllexport) void Uninitialize()
+{
+    delete pSvnClient;
+    pSvnClient = 0;
+    ModuleEntriesCache().Clear(); // While the budget of the host is still there
+}
+
+extern "C" __declspec(dllexport) void AttachStatistics( VcsStatistics *pStatistics )
+{
+    AttachStatisticsTo( pStatistics );
+}
+
+extern "C" __declspec(dllexport) void AttachTrace( ITraceSink *pSink )
+{
+    AttachTraceTo( pSink );
+}
+
+extern "C" __declspec(dllexport) void AttachEntriesCache( EntriesCacheBudget *pBudget )
+{
+    AttachEntriesCacheBudgetTo( pBudget );
+}
+
+extern "C" __declspec(dllexport) void AttachDirCounts( IDirCountsSink *pSink )
+{
+    AttachDirCountsTo( pSink );
 }
 
 extern "C" __declspec(dllexport) bool IsPluginDir( const string& sDir )
@@ -0,0 +1,187 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Size-bounded on-disk cache of files produced by slow VCS
+             commands (annotations, old revisions)
+*****************************************************************************/
+
+#include <algorithm>
+#include <vector>
+#include "digest.h"
+
+/// <summary>
+/// A directory of files named by the SHA-1 digest of their keys. The least
+/// recently used files are evicted once the total size exceeds the limit.
+/// </summary>
+/// <remarks>
+/// <p>
+/// The last write time of a cached file serves as its LRU stamp and is
+/// bumped on every hit.
+/// </p>
+/// <p>
+/// The total size is only counted by enumerating the directory on the first
+/// <c>Put</c> and whenever the running estimate exceeds the limit, so that
+/// putting many files in a row stays cheap.
+/// </p>
+/// <p>
+/// Several FAR instances may share the cache: the files are put in place
+/// by renaming, so a reader never sees a partially written one.
+/// </p>
+/// </remarks>
+class FileCache final
+{
+public:
+    FileCache(const tstring& sDir, unsigned __int64 nMaxBytes) : m_sDir(sDir), m_nMaxBytes(nMaxBytes), m_nKnownBytes(-1) {}
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    bool Contains(const tstring& sKey) const
+    {
+        return !GetCachedFileName(sKey).empty();
+    }
+
+    /// <summary>
+    /// Returns the name of the file cached under the key, or an empty string
+    /// on a miss. The file is only good for reading right away, since it may
+    /// be evicted at any moment.
+    /// </summary>
+    tstring GetCachedFileName(const tstring& sKey) const
+    {
+        tstring sCachedFile = GetPathName(sKey);
+        return !sCachedFile.empty() && ::GetFileAttributes(sCachedFile.c_str()) != INVALID_FILE_ATTRIBUTES ? sCachedFile : tstring();
+    }
+
+    /// <summary>
+    /// Copies the file cached under the key to <paramref name="sDestFile"/>.
+    /// Returns false on a miss.
+    /// </summary>
+    bool Get(const tstring& sKey, const tstring& sDestFile) const
+    {
+        tstring sCachedFile = GetPathName(sKey);
+
+        if (sCachedFile.empty() || !::CopyFile(sCachedFile.c_str(), sDestFile.c_str(), FALSE))
+            return false;
+
+        Touch(sCachedFile);
+        return true;
+    }
+
+    /// <summary>
+    /// Stores a copy of <paramref name="sSrcFile"/> under the key, replacing
+    /// the previously cached one, and evicts the oldest files if necessary.
+    /// </summary>
+    void Put(const tstring& sKey, const tstring& sSrcFile)
+    {
+        tstring sCachedFile = GetPathName(sKey);
+
+        if (sCachedFile.empty())
+            return;
+
+        int nError = ::SHCreateDirectoryEx(0, m_sDir.c_str(), 0);
+
+        if (nError != ERROR_SUCCESS && nError != ERROR_ALREADY_EXISTS && nError != ERROR_FILE_EXISTS)
+            return;
+
+        tstring sNewFile = sCachedFile + sformat(_T(".%lu.tmp"), ::GetCurrentProcessId());
+
+        if (!::CopyFile(sSrcFile.c_str(), sNewFile.c_str(), FALSE))
+            return;
+
+        if (!::MoveFileEx(sNewFile.c_str(), sCachedFile.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            ::DeleteFile(sNewFile.c_str());
+            return;
+        }
+
+        Touch(sCachedFile);
+
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        __int64 nBytes = ::GetFileAttributesEx(sCachedFile.c_str(), GetFileExInfoStandard, &fad) ? (static_cast<__int64>(fad.nFileSizeHigh) << 32) + fad.nFileSizeLow : 0;
+
+        CSGuard _(m_cs);
+
+        if (m_nKnownBytes >= 0)
+            m_nKnownBytes += nBytes;
+
+        if (m_nKnownBytes < 0 || static_cast<unsigned __int64>(m_nKnownBytes) > m_nMaxBytes)
+            Trim();
+    }
+
+    /// <summary>
+    /// Drops the file cached under the key, if any.
+    /// </summary>
+    void Remove(const tstring& sKey)
+    {
+        tstring sCachedFile = GetPathName(sKey);
+
+        if (!sCachedFile.empty())
+            ::DeleteFile(sCachedFile.c_str());
+    }
+
+private:
+    tstring GetPathName(const tstring& sKey) const
+    {
+        tstring sDigest = Sha1Hex(sKey);
+        return sDigest.empty() ? sDigest : CatPath(m_sDir.c_str(), sDigest.c_str());
+    }
+
+    static void Touch(const tstring& sFileName)
+    {
+        W32Handle HFile = ::CreateFile(sFileName.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+
+        if (!HFile)
+            return;
+
+        FILETIME ftNow;
+        ::GetSystemTimeAsFileTime(&ftNow);
+        ::SetFileTime(HFile, 0, 0, &ftNow);
+    }
+
+    // Called under the lock
+
+    void Trim()
+    {
+        std::vector<WIN32_FIND_DATA> files;
+        unsigned __int64 nTotalBytes = 0;
+
+        try
+        {
+            for (dir_iterator p(m_sDir), end; p != end; ++p)
+            {
+                if (p->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || _tcsstr(p->cFileName, _T(".tmp")) != 0)
+                    continue; // Being put in place by someone
+
+                files.push_back(*p);
+                nTotalBytes += (static_cast<unsigned __int64>(p->nFileSizeHigh) << 32) + p->nFileSizeLow;
+            }
+        }
+        catch (std::runtime_error&)
+        {
+            return; // Try next time
+        }
+
+        m_nKnownBytes = nTotalBytes;
+
+        if (nTotalBytes <= m_nMaxBytes)
+            return;
+
+        std::sort(files.begin(), files.end(), [](const WIN32_FIND_DATA& left, const WIN32_FIND_DATA& right)
+        {
+            return ::CompareFileTime(&left.ftLastWriteTime, &right.ftLastWriteTime) < 0;
+        });
+
+        for (auto p = files.begin(); p != files.end() && nTotalBytes > m_nMaxBytes; ++p)
+            if (::DeleteFile(CatPath(m_sDir.c_str(), p->cFileName).c_str()))
+                nTotalBytes -= (static_cast<unsigned __int64>(p->nFileSizeHigh) << 32) + p->nFileSizeLow;
+
+        m_nKnownBytes = nTotalBytes;
+    }
+
+    const tstring m_sDir;
+    const unsigned __int64 m_nMaxBytes;
+
+    CriticalSection m_cs;   // Guards the estimate; the cache may be filled from several threads
+    __int64 m_nKnownBytes;  // Running estimate of the total size, -1 if not yet counted
+};
@@ -21,7 +21,17 @@ enum
 
     M_Traversing,
 
-    M_Starting
+    M_Starting,
+
+    M_StatisticsMenu,
+    M_StatisticsTitle,
+    M_Reset,
+
+    M_SlowDirsMenu,
+    M_SlowDirsTitle,
+
+    M_AllChangesMenu,
+    M_AllChangesTitle
 };
 
 #endif // __LANG_H
@@ -14,6 +14,8 @@
 #include "enforce.h"
 #include "miscutil.h"
 #include "plugutil.h"
+#include "stats.h"
+#include "trace.h"
 #include "lang.h"
 
 class LongOperation
@@ -298,6 +300,10 @@ protected:
             return false;
         }
 
+        Statistics().nProcessesSpawned.Add();
+        ScopedStatTimer _(Statistics().tProcesses);
+        TraceSpan span("Executor", "process", m_sCmdLine);
+
         W32Handle HTempFile = !m_sTempFileName.empty() ? ENF_H(::CreateFile(m_sTempFileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, 0, CREATE_ALWAYS, 0, 0))
                                                        : INVALID_HANDLE_VALUE;
 
@@ -398,3 +404,281 @@ protected:
     const boost::function<void(TCHAR*)>& m_fNewLineCallback;
     tstring m_sPrompt;
 };
+
+/// <summary>
+/// Runs an operation implemented in-process (i.e. without spawning an external
+/// application) in the same scrolling dialog as <c>Executor</c> uses.
+/// </summary>
+/// <remarks>
+/// The work receives a line sink. It should pass every output line to the sink,
+/// and <c>nullptr</c> while it has nothing to report but is still busy, so that
+/// the dialog stays responsive. The sink returns <c>true</c> if the user wants
+/// to cancel the operation.
+/// </remarks>
+class InProcessOperation : public ScrollLongOperation
+{
+public:
+    typedef boost::function<bool(const TCHAR*)> LineSink;
+    typedef boost::function<bool(const LineSink&)> Work;
+
+    InProcessOperation(const TCHAR *szPluginName, const tstring& sPrompt, const Work& work) :
+        ScrollLongOperation(szPluginName),
+        m_work(work),
+        m_sPrompt(ProkrustString(sPrompt, W()))
+    {}
+
+protected:
+    virtual intptr_t DoGetPrompt() override { return reinterpret_cast<intptr_t>(m_sPrompt.c_str()); }
+
+    virtual bool DoExecute() override
+    {
+        bool bResult = m_work([this](const TCHAR *szLine) -> bool
+        {
+            if (szLine != nullptr)
+                Scroll(szLine);
+
+            return UserInteraction(false);
+        });
+
+        UserInteraction(true); // So that the dialog displays the latest data before closing
+        return bResult;
+    }
+
+    Work m_work;
+    tstring m_sPrompt;
+};
+
+/// <summary>
+/// Runs several external applications, at most a given number of them at a
+/// time, merging their output in the same scrolling dialog as <c>Executor</c>
+/// uses.
+/// </summary>
+/// <remarks>
+/// Every line of a job is passed to the callback of that job and shown in the
+/// dialog prefixed with the label of the job. The callbacks are called on the
+/// thread running the operation, one at a time.
+/// </remarks>
+class ParallelExecutor : public ScrollLongOperation
+{
+public:
+    struct Job
+    {
+        tstring sDir;
+        tstring sCmdLine;
+        tstring sLabel;
+        boost::function<void(TCHAR*)> fNewLineCallback;
+    };
+
+    ParallelExecutor(const TCHAR *szPluginName, const tstring& sPrompt, const std::vector<Job>& jobs, unsigned int nMaxParallel) :
+        ScrollLongOperation(szPluginName),
+        m_jobs(jobs),
+        m_nMaxParallel(max(nMaxParallel, 1u)),
+        m_results(jobs.size(), false),
+        m_sPrompt(ProkrustString(sPrompt, W()))
+    {}
+
+    /// <summary>
+    /// Whether the job has been run to the end and exited with zero code.
+    /// </summary>
+    bool Succeeded(size_t iJob) const { return m_results[iJob]; }
+
+protected:
+    virtual intptr_t DoGetPrompt() override { return reinterpret_cast<intptr_t>(m_sPrompt.c_str()); }
+
+    virtual bool DoExecute() override
+    {
+        ScopedStatTimer _(Statistics().tProcesses);
+
+        std::vector<std::unique_ptr<Slot>> slots;
+        size_t iNextJob = 0;
+        bool bResult = true;
+
+        while (iNextJob < m_jobs.size() || !slots.empty())
+        {
+            while (slots.size() < m_nMaxParallel && iNextJob < m_jobs.size())
+            {
+                std::unique_ptr<Slot> pSlot(Start(iNextJob++));
+
+                if (pSlot)
+                    slots.push_back(std::move(pSlot));
+                else
+                    bResult = false;
+            }
+
+            if (slots.empty())
+                break;
+
+            std::vector<HANDLE> events;
+            for (const auto& pSlot : slots)
+                events.push_back(pSlot->oe);
+
+            ::WaitForMultipleObjectsEx(static_cast<DWORD>(events.size()), &events[0], FALSE, 100, TRUE);
+
+            for (auto p = slots.begin(); p != slots.end(); )
+            {
+                if (Pump(**p))
+                {
+                    ++p;
+                    continue;
+                }
+
+                bResult &= Finish(**p);
+                p = slots.erase(p);
+            }
+
+            if (UserInteraction(false))
+            {
+                for (const auto& pSlot : slots)
+                    ::TerminateProcess(pSlot->HProcess, (UINT)-1);
+
+                return false;
+            }
+        }
+
+        UserInteraction(true); // So that the dialog displays the latest data before closing
+        return bResult;
+    }
+
+private:
+    static const DWORD cdwPipeBufferSize = 1024;
+
+    struct Slot
+    {
+        Slot(size_t _iJob, HANDLE hReadPipe, HANDLE hProcess, const tstring& sCmdLine) :
+            iJob(_iJob),
+            HReadPipe(hReadPipe),
+            HProcess(hProcess),
+            bIoPending(false),
+            span("ParallelExecutor", "process", sCmdLine)
+        {
+            memset(&o, 0, sizeof o);
+            o.hEvent = oe;
+        }
+
+        size_t iJob;
+        W32Handle HReadPipe;
+        W32Handle HProcess;
+        W32Event oe;
+        OVERLAPPED o;
+        bool bIoPending;
+        TCHAR buf[cdwPipeBufferSize];
+        tstring sLine; // Incomplete line collected so far
+        TraceSpan span; // Ends with the slot, once the process has exited
+    };
+
+    Slot *Start(size_t iJob)
+    {
+        const Job& job = m_jobs[iJob];
+
+        tstring sPipeName = GetTempPipeName();
+        SECURITY_ATTRIBUTES sa = { sizeof sa, 0, TRUE };
+
+        // Named pipes, since unnamed ones do not support asynchronous operations
+
+        W32Handle HReadPipe = ENF_H(::CreateNamedPipe(sPipeName.c_str(),
+                                                      PIPE_ACCESS_INBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+                                                      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE,
+                                                      1,
+                                                      cdwPipeBufferSize,
+                                                      cdwPipeBufferSize,
+                                                      500,
+                                                      0));
+
+        W32Handle HWritePipe = ENF_H(::CreateFile(sPipeName.c_str(), GENERIC_WRITE, 0, &sa, OPEN_EXISTING, 0, 0));
+        W32Handle HProcess = ExecuteConsoleNoWait(job.sDir.c_str(), job.sCmdLine.c_str(), HWritePipe, HWritePipe);
+
+        if (!HProcess)
+        {
+            Scroll((job.sLabel + _T("Cannot execute external application: ") + LastErrorStr()).c_str());
+            return nullptr;
+        }
+
+        Statistics().nProcessesSpawned.Add();
+
+        return new Slot(iJob, HReadPipe.Detach(), HProcess.Detach(), job.sCmdLine);
+    }
+
+    // Processes whatever output is available. Returns false once the pipe is closed.
+
+    bool Pump(Slot& slot)
+    {
+        for ( ; ; )
+        {
+            DWORD dwRead = 0;
+
+            if (slot.bIoPending)
+            {
+                if (!::GetOverlappedResult(slot.HReadPipe, &slot.o, &dwRead, FALSE))
+                {
+                    if (::GetLastError() == ERROR_IO_INCOMPLETE)
+                        return true;
+
+                    ENF(::GetLastError() == ERROR_BROKEN_PIPE);
+                    return false;
+                }
+
+                slot.bIoPending = false;
+            }
+            else if (!::ReadFile(slot.HReadPipe, slot.buf, sizeof slot.buf, &dwRead, &slot.o))
+            {
+                if (::GetLastError() == ERROR_BROKEN_PIPE)
+                    return false;
+
+                ENF(::GetLastError() == ERROR_IO_PENDING);
+                slot.bIoPending = true;
+                continue;
+            }
+
+            const TCHAR *pEnd = slot.buf + dwRead / sizeof(TCHAR);
+
+            for (const TCHAR *p = slot.buf; p < pEnd; )
+            {
+                const TCHAR *pNextEOL = std::find(p, pEnd, _T('\n'));
+                slot.sLine.append(p, pNextEOL);
+
+                if (pNextEOL == pEnd)
+                    break;
+
+                if (!slot.sLine.empty() && *slot.sLine.rbegin() == _T('\r'))
+                    slot.sLine.erase(slot.sLine.size() - 1);
+
+                Deliver(slot);
+                p = pNextEOL + 1;
+            }
+        }
+    }
+
+    void Deliver(Slot& slot)
+    {
+        const Job& job = m_jobs[slot.iJob];
+
+        Scroll((job.sLabel + slot.sLine).c_str());
+
+        if (job.fNewLineCallback)
+        {
+            std::vector<TCHAR> line(slot.sLine.begin(), slot.sLine.end());
+            line.push_back(0);
+            job.fNewLineCallback(&line[0]); // The callbacks are allowed to modify the line
+        }
+
+        slot.sLine.clear();
+    }
+
+    bool Finish(Slot& slot)
+    {
+        if (!slot.sLine.empty())
+            Deliver(slot);
+
+        ENF(::WaitForSingleObjectEx(slot.HProcess, INFINITE, TRUE) == WAIT_OBJECT_0);
+
+        DWORD dwExitCode;
+        ENF(::GetExitCodeProcess(slot.HProcess, &dwExitCode));
+
+        return m_results[slot.iJob] = dwExitCode == 0;
+    }
+
+    const std::vector<Job>& m_jobs;
+    unsigned int m_nMaxParallel;
+    std::vector<bool> m_results;
+    tstring m_sPrompt;
+};
@@ -4,10 +4,13 @@
  Purpose:    General-purpose utilities
  Compiler:   MS Visual C++ 8.0
  Authors:    Michael Steinhause
- Dependencies: STL, Win32
+ Dependencies: STL, Win32 or POSIX
 *****************************************************************************/
 
-#include "miscutil.h"
+#include "platform.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -49,6 +52,8 @@ vector<string> SplitString( const string& s, char c )
     return v;
 }
 
+#ifdef _WIN32
+
 //==========================================================================>>
 // Replacement of the conventional Sleep, because the latter causes troubles
 // with message processing -- see MSDN for details
@@ -133,3 +138,33 @@ string GetTempFileName( const char *szPrefix )
 
     return szTempFileName;
 }
+
+#else // POSIX
+
+//==========================================================================>>
+// GetTempPath/GetTempFileName counterparts
+//==========================================================================>>
+
+string GetTempPath()
+{
+    const char *szTempPath = ::getenv( "TMPDIR" );
+    return szTempPath && *szTempPath ? szTempPath : "/tmp";
+}
+
+string GetTempFileName( const char *szPrefix )
+{
+    string sTemplate = CatPath( GetTempPath().c_str(), ( string( szPrefix ? szPrefix : "" ) + "XXXXXX" ).c_str() );
+
+    vector<char> buf( sTemplate.begin(), sTemplate.end() );
+    buf.push_back( 0 );
+
+    int fd = ::mkstemp( &buf[0] );
+
+    if ( fd < 0 )
+        throw std::runtime_error( "mkstemp failed" );
+
+    ::close( fd );
+    return &buf[0];
+}
+
+#endif
@@ -1,9 +1,17 @@
 #pragma once
 
 #include <stdio.h>
-#include <tchar.h>
+#include <stdarg.h>
 #include <memory>
 #include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <tchar.h>
+#else
+#include "posixcompat.h"
+#endif
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/serialization/set.hpp>
@@ -14,6 +22,12 @@ typedef std::wstring tstring;
 typedef std::string tstring;
 #endif
 
+#ifdef _WIN32
+const TCHAR cPathSeparator = _T('\\');
+#else
+const TCHAR cPathSeparator = _T('/');
+#endif
+
 /// <summary>
 /// A printf cousin returning a string.
 /// </summary>
@@ -88,11 +102,71 @@ inline tstring CatPath(const TCHAR *szDir, const TCHAR *szSubDir)
     {
         tstring sNewDir(szDir);
         if (!sNewDir.empty() && _tcschr(_T("\\/:"), *sNewDir.rbegin()) == 0)
-            sNewDir += _T("\\");
+            sNewDir += cPathSeparator;
         return sNewDir + szSubDir;
     }
 }
 
+/// <summary>
+/// Builds the paths below a directory in one growing buffer, for the loops
+/// visiting every entry: a name is pushed, the path used, and the name
+/// popped again. Unlike <c>CatPath</c>, allocates only when a path is longer
+/// than any built before.
+/// </summary>
+/// <remarks>
+/// Joins the names as <c>CatPath</c> does for a plain relative name. The
+/// string returned by <c>str()</c> is the buffer itself, so it changes with
+/// the next Push or Pop.
+/// <p>
+/// Defined in a header file because it is used in both projects
+/// with static and dynamic runtimes.
+/// </p>
+/// </remarks>
+class PathBuilder
+{
+public:
+    explicit PathBuilder(const tstring& sDir = tstring()) { Reset(sDir); }
+
+    /// <summary>
+    /// Starts over from another directory, keeping the buffer.
+    /// </summary>
+    void Reset(const tstring& sDir)
+    {
+        if (m_s.capacity() < sDir.size() + cnReserve)
+            m_s.reserve(sDir.size() + cnReserve);
+
+        m_s.assign(sDir);
+    }
+
+    /// <summary>
+    /// Appends the name, with a separator if needed.
+    /// </summary>
+    /// <returns>The length to pass to <c>Pop</c> to remove the name.</returns>
+    size_t Push(const TCHAR *szName, size_t nLength)
+    {
+        size_t nMark = m_s.size();
+
+        if (!m_s.empty() && _tcschr(_T("\\/:"), *m_s.rbegin()) == 0)
+            m_s += cPathSeparator;
+
+        m_s.append(szName, nLength);
+        return nMark;
+    }
+
+    size_t Push(const TCHAR *szName)    { return Push(szName, _tcslen(szName)); }
+    size_t Push(const tstring& sName)   { return Push(sName.c_str(), sName.size()); }
+
+    void Pop(size_t nMark)              { m_s.resize(nMark); }
+
+    const tstring& str() const          { return m_s; }
+    const TCHAR *c_str() const          { return m_s.c_str(); }
+
+private:
+    static const size_t cnReserve = 260; // MAX_PATH: room for the names below
+
+    tstring m_s;
+};
+
 /// <summary>
 /// Extracts the filename from a full pathname, absolute or relative.
 /// </summary>
@@ -119,6 +193,20 @@ inline tstring ExtractPath(const tstring& sPathName)
     return iLastSlash == tstring::npos ? _T("") : sPathName.substr(0, iLastSlash);
 }
 
+/// <summary>
+/// Calls <c>f</c> with every directory the pathname is in, the innermost
+/// first, e.g. with "C:\a\b", "C:\a" and "C:" for "C:\a\b\c".
+/// </summary>
+/// <remarks>
+/// Defined in a header file because it is used in both projects
+/// with static and dynamic runtimes.
+/// </remarks>
+template <typename F> void ForEachParentDir(const tstring& sPathName, F f)
+{
+    for (size_t i = sPathName.find_last_of(_T("\\/")); i != tstring::npos && i != 0; i = sPathName.find_last_of(_T("\\/"), i - 1))
+        f(sPathName.substr(0, i));
+}
+
 /// <summary>
 /// Encloses pathname in double quotes, if necessary.
 /// </summary>
@@ -138,14 +226,33 @@ inline tstring QuoteIfNecessary(tstring sFileName)
 }
 
 //==========================================================================>>
-// String comparison functors
+// String comparison functors. They compare file names the way the file
+// system does: the case is ignored on Windows only.
 //==========================================================================>>
 
+inline int ComparePaths(const TCHAR *szLeft, const TCHAR *szRight)
+{
+#ifdef _WIN32
+    return _tcsicmp(szLeft, szRight);
+#else
+    return _tcscmp(szLeft, szRight);
+#endif
+}
+
+inline int ComparePaths(const TCHAR *szLeft, const TCHAR *szRight, size_t nLength)
+{
+#ifdef _WIN32
+    return _tcsnicmp(szLeft, szRight, nLength);
+#else
+    return _tcsncmp(szLeft, szRight, nLength);
+#endif
+}
+
 struct EqualNoCase : public std::binary_function<tstring, tstring, bool>
 {
     result_type operator()(const first_argument_type& left, const second_argument_type& right) const
     {
-        return _tcsicmp(left.c_str(), right.c_str()) == 0;
+        return ComparePaths(left.c_str(), right.c_str()) == 0;
     }
 };
 
@@ -153,7 +260,7 @@ struct LessNoCase : public std::binary_function<tstring, tstring, bool>
 {
     result_type operator()(const first_argument_type& left, const second_argument_type& right) const
     {
-        return _tcsicmp(left.c_str(), right.c_str()) < 0;
+        return ComparePaths(left.c_str(), right.c_str()) < 0;
     }
 };
 
@@ -161,20 +268,51 @@ struct StartsWithDir : public std::binary_function<tstring, tstring, bool>
 {
     result_type operator()(const first_argument_type& str, const second_argument_type& substr) const
     {
-        return _tcsnicmp(str.c_str(), substr.c_str(), substr.length()) == 0 &&
+        return ComparePaths(str.c_str(), substr.c_str(), substr.length()) == 0 &&
             (str.length() == substr.length() || _tcschr(_T("\\/:"), str[substr.length()]) != nullptr);
     }
 };
 
 struct IsFileFromDir : public std::binary_function<tstring, tstring, bool>
 {
-    result_type operator()(const first_argument_type& dirname, const second_argument_type& pathname) const
+    result_type operator()(const first_argument_type& pathname, const second_argument_type& dirname) const
     {
-        return _tcsnicmp(dirname.c_str(), pathname.c_str(), pathname.length()) == 0 &&
+        return ComparePaths(pathname.c_str(), dirname.c_str(), dirname.length()) == 0 &&
             pathname.find_last_of(_T("\\/:")) == dirname.length();
     }
 };
 
+/// <summary>
+/// Splits a string into a list of strings (like split in perl).
+/// </summary>
+std::vector<tstring> SplitString(const tstring& s, TCHAR c);
+
+//==========================================================================>>
+// ref_countable CRTP base for the classes held by boost::intrusive_ptr
+//==========================================================================>>
+
+template <typename T> class ref_countable
+{
+private:
+    friend void intrusive_ptr_add_ref( ref_countable<T> *p )
+    {
+        ++static_cast<T*>(p)->ref_counter;
+    }
+
+    friend void intrusive_ptr_release( ref_countable<T> *p )
+    {
+        if ( --static_cast<T*>(p)->ref_counter == 0 )
+            static_cast<T*>(p)->ref_countable_self_destroy();
+    }
+
+protected:
+    ref_countable() : ref_counter(0) {}
+    void ref_countable_self_destroy() { delete static_cast<T*>(this); }
+
+private:
+    int ref_counter;
+};
+
 /// <summary>
 /// Returns a srting of exactly specified length by truncating the source string
 /// with "..." or extending it with trailing spaces.
@@ -0,0 +1,16 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Selects the platform layer of the portable core: Win32 for the
+             FAR plugin, POSIX for far2l and the command line tools
+*****************************************************************************/
+
+#ifdef _WIN32
+#include <windows.h>
+#include <tchar.h>
+#include "winhelpers.h"
+#else
+#include "posixcompat.h"
+#include "posixhelpers.h"
+#endif
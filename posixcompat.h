@@ -0,0 +1,183 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    The subset of the Win32 and MSVC runtime declarations used by
+             the portable core, implemented over POSIX
+*****************************************************************************/
+
+#ifdef _WIN32
+#error "posixcompat.h is for the POSIX builds only"
+#endif
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+
+//==========================================================================>>
+// Characters and strings. The POSIX builds are narrow: the file names are
+// passed through in the encoding of the file system, normally UTF-8.
+//==========================================================================>>
+
+typedef char TCHAR;
+
+#define _T(x) x
+
+#define _tcslen    strlen
+#define _tcschr    strchr
+#define _tcsrchr   strrchr
+#define _tcsstr    strstr
+#define _tcscmp    strcmp
+#define _tcsncmp   strncmp
+#define _tcsicmp   strcasecmp
+#define _tcsnicmp  strncasecmp
+#define _stricmp   strcasecmp
+#define _strnicmp  strncasecmp
+#define _atoi64    atoll
+
+#define _TRUNCATE (static_cast<size_t>(-1))
+
+template <typename T, size_t N> char (&_countof_helper(T (&)[N]))[N];
+#define _countof(a) (sizeof(_countof_helper(a)))
+
+/// <summary>
+/// Formats into the buffer like the MSVC function with <c>_TRUNCATE</c>:
+/// returns -1 if the result has been truncated.
+/// </summary>
+inline int _vsntprintf_s(char *szBuf, size_t nBufSize, size_t, const char *szFormat, va_list args)
+{
+    int len = vsnprintf(szBuf, nBufSize, szFormat, args);
+    return len >= 0 && static_cast<size_t>(len) < nBufSize ? len : -1;
+}
+
+template <size_t N> inline int _vsntprintf_s(char (&szBuf)[N], size_t nCount, const char *szFormat, va_list args)
+{
+    return _vsntprintf_s(szBuf, N, nCount, szFormat, args);
+}
+
+inline int _vsctprintf(const char *szFormat, va_list args)
+{
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int len = vsnprintf(0, 0, szFormat, argsCopy);
+    va_end(argsCopy);
+    return len;
+}
+
+template <size_t N> inline int _tcsncpy_s(char (&szDest)[N], const char *szSrc, size_t)
+{
+    strncpy(szDest, szSrc, N - 1);
+    szDest[N - 1] = 0;
+    return 0;
+}
+
+//==========================================================================>>
+// Types
+//==========================================================================>>
+
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef int64_t __int64;
+
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+
+#define MAX_PATH 4096
+
+//==========================================================================>>
+// File attributes and find data. The times are kept as FILETIME, i.e. in
+// 100 ns units since 1601-01-01 UTC, so that the code comparing them stays
+// the same on all the platforms.
+//==========================================================================>>
+
+struct FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+};
+
+struct WIN32_FIND_DATA
+{
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    DWORD dwReserved0;
+    DWORD dwReserved1;
+    TCHAR cFileName[256];
+    TCHAR cAlternateFileName[14];
+};
+
+#define FILE_ATTRIBUTE_READONLY  0x00000001
+#define FILE_ATTRIBUTE_HIDDEN    0x00000002
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_NORMAL    0x00000080
+
+#define INVALID_FILE_ATTRIBUTES (static_cast<DWORD>(-1))
+
+const uint64_t cnFileTimeUnixEpoch = 116444736000000000ULL; // 1970-01-01 in FILETIME units
+
+inline FILETIME TimespecToFileTime(const timespec& ts)
+{
+    uint64_t n = cnFileTimeUnixEpoch + static_cast<uint64_t>(ts.tv_sec) * 10000000 + ts.tv_nsec / 100;
+    FILETIME ft = { static_cast<DWORD>(n), static_cast<DWORD>(n >> 32) };
+    return ft;
+}
+
+inline long CompareFileTime(const FILETIME *pLeft, const FILETIME *pRight)
+{
+    uint64_t nLeft  = (static_cast<uint64_t>(pLeft->dwHighDateTime) << 32) + pLeft->dwLowDateTime;
+    uint64_t nRight = (static_cast<uint64_t>(pRight->dwHighDateTime) << 32) + pRight->dwLowDateTime;
+    return nLeft < nRight ? -1 : nLeft > nRight ? 1 : 0;
+}
+
+/// <summary>
+/// Fills the find data from the results of <c>stat</c>. The files starting
+/// with a dot are hidden, as the shells show them.
+/// </summary>
+inline void StatToFindData(const char *szName, const struct stat& st, WIN32_FIND_DATA& findData)
+{
+    memset(&findData, 0, sizeof findData);
+
+    findData.dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+
+    if (szName[0] == '.' && strcmp(szName, ".") != 0 && strcmp(szName, "..") != 0)
+        findData.dwFileAttributes |= FILE_ATTRIBUTE_HIDDEN;
+
+    if ((st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) == 0)
+        findData.dwFileAttributes |= FILE_ATTRIBUTE_READONLY;
+
+    findData.ftCreationTime   = TimespecToFileTime(st.st_ctim);
+    findData.ftLastAccessTime = TimespecToFileTime(st.st_atim);
+    findData.ftLastWriteTime  = TimespecToFileTime(st.st_mtim);
+
+    findData.nFileSizeHigh = static_cast<DWORD>(static_cast<uint64_t>(st.st_size) >> 32);
+    findData.nFileSizeLow  = static_cast<DWORD>(st.st_size);
+
+    size_t nLength = strlen(szName);
+
+    if (nLength >= sizeof findData.cFileName)
+        nLength = sizeof findData.cFileName - 1;
+
+    memcpy(findData.cFileName, szName, nLength);
+    findData.cFileName[nLength] = 0;
+}
+
+inline DWORD GetFileAttributes(const char *szFileName)
+{
+    struct stat st;
+
+    if (::stat(szFileName, &st) != 0)
+        return INVALID_FILE_ATTRIBUTES;
+
+    return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    POSIX counterparts of the helpers in winhelpers.h used by the
+             portable core: critical sections and the directory iterator
+*****************************************************************************/
+
+#include <dirent.h>
+#include <mutex>
+#include <stdexcept>
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include "miscutil.h"
+
+//==========================================================================>>
+// Critical section wrapper and guard. Recursive, like the Win32 one.
+//==========================================================================>>
+
+class CriticalSection final
+{
+public:
+    CriticalSection() {}
+
+    CriticalSection(const CriticalSection&) = delete;
+    CriticalSection& operator=(const CriticalSection&) = delete;
+
+    void Enter() { m.lock(); }
+    bool TryEnter() { return m.try_lock(); }
+    void Leave() { m.unlock(); }
+
+private:
+    std::recursive_mutex m;
+};
+
+class CSGuard final
+{
+public:
+    CSGuard(CriticalSection& _cs) : cs(_cs) { cs.Enter(); }
+    ~CSGuard() { cs.Leave(); }
+
+    CSGuard(const CSGuard&) = delete;
+    CSGuard& operator=(const CSGuard&) = delete;
+
+private:
+    CriticalSection& cs;
+};
+
+//==========================================================================>>
+// STL-compliant iterator wrapper around opendir/readdir, yielding the same
+// WIN32_FIND_DATA as the Win32 one
+//==========================================================================>>
+
+class dir_iterator : public boost::iterator_facade<dir_iterator, WIN32_FIND_DATA, boost::single_pass_traversal_tag>
+{
+public:
+    dir_iterator() {}
+    explicit dir_iterator(const tstring& sDir, bool bWithDots = false) : paccessor_(new dir_accessor(sDir, bWithDots)) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    void increment()
+    {
+        paccessor_->advance();
+    }
+
+    bool equal(const dir_iterator& rhs) const
+    {
+        return paccessor_ == rhs.paccessor_ ||
+               ((!paccessor_ || !paccessor_->is_valid()) && (!rhs.paccessor_ || !rhs.paccessor_->is_valid()));
+    }
+
+    reference dereference() const
+    {
+        return paccessor_->findData_;
+    }
+
+private:
+    struct dir_accessor : public ref_countable<dir_accessor>
+    {
+        explicit dir_accessor(const tstring& sDir, bool bWithDots) : sDir_(sDir), bWithDots_(bWithDots)
+        {
+            pDir_ = ::opendir(sDir.c_str());
+            if (pDir_ == 0)
+                throw std::runtime_error("opendir failed");
+            advance();
+        }
+
+        ~dir_accessor()
+        {
+            release_handle();
+        }
+
+        void advance()
+        {
+            if (pDir_ == 0)
+                throw std::runtime_error("Invalid attempt to advance to the next item in dir_accessor");
+
+            for (;;)
+            {
+                const dirent *pEntry = ::readdir(pDir_);
+
+                if (pEntry == 0)
+                {
+                    release_handle();
+                    return;
+                }
+
+                if (!bWithDots_ && is_dot_entry(pEntry->d_name))
+                    continue;
+
+                // A dangling symbolic link is reported as the link itself
+
+                struct stat st;
+                tstring sPathName = CatPath(sDir_.c_str(), pEntry->d_name);
+
+                if (::stat(sPathName.c_str(), &st) != 0 && ::lstat(sPathName.c_str(), &st) != 0)
+                    continue; // Removed meanwhile
+
+                StatToFindData(pEntry->d_name, st, findData_);
+                return;
+            }
+        }
+
+        bool is_valid()
+        {
+            return pDir_ != 0;
+        }
+
+        tstring sDir_;
+        DIR *pDir_;
+        WIN32_FIND_DATA findData_;
+        bool bWithDots_;
+
+    private:
+        void release_handle()
+        {
+            if (pDir_ != 0)
+                ::closedir(pDir_);
+
+            pDir_ = 0;
+        }
+
+        bool is_dot_entry(const TCHAR *szName)
+        {
+            return _tcscmp(szName, _T(".")) == 0 || _tcscmp(szName, _T("..")) == 0;
+        }
+    };
+
+    boost::intrusive_ptr<dir_accessor> paccessor_;
+};
+
+//==========================================================================>>
+// Temporary files and the per-user data folder
+//==========================================================================>>
+
+tstring GetTempPath();
+tstring GetTempFileName(const TCHAR *szPrefix = 0);
+
+/// <summary>
+/// The counterpart of the local application data folder: <c>$XDG_CACHE_HOME</c>,
+/// or <c>~/.cache</c> if not set.
+/// </summary>
+inline tstring GetLocalAppDataFolder()
+{
+    if (const char *szCacheHome = ::getenv("XDG_CACHE_HOME"))
+        if (*szCacheHome)
+            return szCacheHome;
+
+    const char *szHome = ::getenv("HOME");
+    return szHome && *szHome ? CatPath(szHome, ".cache") : tstring();
+}
@@ -0,0 +1,290 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Speculative background loading of the VCS data for the
+             directories the user is likely to enter next
+*****************************************************************************/
+
+#include <algorithm>
+#include "prefetch.h"
+
+using namespace std;
+
+Prefetcher Prefetch;
+
+namespace
+{
+    const size_t cnMaxPrefetchedDirs = 32;    // Do not try to guess too far
+    const size_t cnMaxVisitedDirs    = 64;    // Length of the most-recently-visited list
+    const DWORD  cdwMaxAge           = 30000; // Prefetched data older than that (ms) is considered stale
+}
+
+/// <summary>
+/// A single prefetch run. Shared by the prefetcher and the worker thread,
+/// deleted by whoever releases it last.
+/// </summary>
+/// <remarks>
+/// The reference counter of <c>IVcsData</c> is not thread-safe, so the
+/// loaded data is only ever swapped in and out of <c>ready</c> under the
+/// lock and never copied.
+/// </remarks>
+struct Prefetcher::Job
+{
+    Job(Prefetcher *_pPrefetcher, vector<tstring>&& _vDirs) : nRefs(2), bCancelled(0), pPrefetcher(_pPrefetcher), vDirs(std::move(_vDirs)) {}
+
+    struct Ready
+    {
+        Ready() : dwLoadedAt(0) {}
+
+        boost::intrusive_ptr<IVcsData> pVcsData;
+        DWORD dwLoadedAt;
+    };
+
+    volatile LONG nRefs;
+    volatile LONG bCancelled;
+
+    Prefetcher * const pPrefetcher; // Counts the worker until it exits
+
+    const vector<tstring> vDirs; // Read by the worker only
+
+    CriticalSection cs;
+    map<tstring, Ready, LessNoCase> ready;
+};
+
+void Prefetcher::Release(Job *pJob)
+{
+    if (pJob && ::InterlockedDecrement(&pJob->nRefs) == 0)
+        delete pJob;
+}
+
+DWORD WINAPI Prefetcher::WorkerRoutine(void *p)
+{
+    Job *pJob = static_cast<Job*>(p);
+
+    // The routine runs on a pool thread, so the priority is restored on exit
+
+    int nPriority = ::GetThreadPriority(::GetCurrentThread());
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+    for (const auto& sDir : pJob->vDirs)
+    {
+        if (pJob->bCancelled)
+            break;
+
+        try
+        {
+            if (!IsVcsDir(sDir))
+                continue;
+
+            boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(sDir);
+
+            if (!pVcsData || !pVcsData->IsValid())
+                continue;
+
+            pVcsData->entries(); // Forces the lazy load
+
+            CSGuard _(pJob->cs);
+            Job::Ready& ready = pJob->ready[sDir];
+            ready.pVcsData.swap(pVcsData);
+            ready.dwLoadedAt = ::GetTickCount();
+        }
+        catch (std::runtime_error&)
+        {
+            // A directory that cannot be read now will be reported when the user enters it
+        }
+    }
+
+    ::SetThreadPriority(::GetCurrentThread(), nPriority);
+
+    Prefetcher *pPrefetcher = pJob->pPrefetcher;
+
+    Release(pJob);
+
+    // Shutdown may return as soon as the event is set, while the code below
+    // still runs. The work item holds the module until the routine returns.
+
+    pPrefetcher->WorkerFinished();
+    return 0;
+}
+
+void Prefetcher::WorkerStarted()
+{
+    CSGuard _(m_csWorkers);
+
+    if (m_nWorkers++ == 0)
+        m_noWorkers.Reset();
+}
+
+void Prefetcher::WorkerFinished()
+{
+    CSGuard _(m_csWorkers);
+
+    if (--m_nWorkers == 0)
+        m_noWorkers.Set();
+}
+
+vector<tstring> Prefetcher::Prioritize(const tstring& sDir, const vector<tstring>& vSubDirs) const
+{
+    vector<tstring> vDirs(vSubDirs);
+
+    tstring sParentDir = CatPath(sDir.c_str(), _T(".."));
+    if (!EqualNoCase()(sParentDir, sDir))
+        vDirs.push_back(sParentDir);
+
+    // Most recently visited first, the rest in the listing order
+
+    auto rank = [this](const tstring& s) -> size_t
+    {
+        auto p = std::find_if(m_Visited.begin(), m_Visited.end(), std::bind2nd(EqualNoCase(), s));
+        return p - m_Visited.begin(); // m_Visited.size() if never visited
+    };
+
+    std::stable_sort(vDirs.begin(), vDirs.end(), [&rank](const tstring& left, const tstring& right) { return rank(left) < rank(right); });
+
+    if (vDirs.size() > cnMaxPrefetchedDirs)
+        vDirs.resize(cnMaxPrefetchedDirs);
+
+    return vDirs;
+}
+
+void Prefetcher::Start(const void *pOwner, const tstring& sDir, const vector<tstring>& vSubDirs)
+{
+    PanelJob& panelJob = m_Jobs[pOwner];
+
+    CancelJob(panelJob, tstring());
+    panelJob.sRoot = sDir;
+
+    vector<tstring> vDirs = Prioritize(sDir, vSubDirs);
+    if (vDirs.empty())
+        return;
+
+    panelJob.pJob = new Job(this, std::move(vDirs)); // One reference for us, one for the worker
+
+    WorkerStarted();
+
+    if (!ModuleWorkItem::Queue(WorkerRoutine, panelJob.pJob))
+    {
+        Release(panelJob.pJob);
+        WorkerFinished();
+    }
+}
+
+void Prefetcher::Cancel(const void *pOwner, const tstring& sKeep)
+{
+    // The job of the other panel goes on
+
+    auto p = m_Jobs.find(pOwner);
+    if (p == m_Jobs.end())
+        return;
+
+    CancelJob(p->second, sKeep);
+
+    if (!p->second.pJob)
+        m_Jobs.erase(p);
+}
+
+void Prefetcher::CancelAll()
+{
+    for (auto& job : m_Jobs)
+        CancelJob(job.second, tstring());
+
+    m_Jobs.clear();
+}
+
+tstring Prefetcher::GetRoot(const void *pOwner) const
+{
+    auto p = m_Jobs.find(pOwner);
+    return p != m_Jobs.end() ? p->second.sRoot : tstring();
+}
+
+void Prefetcher::CancelJob(PanelJob& panelJob, const tstring& sKeep)
+{
+    panelJob.sRoot.clear();
+
+    if (!panelJob.pJob)
+        return;
+
+    Job *pJob = panelJob.pJob;
+    panelJob.pJob = nullptr;
+
+    ::InterlockedExchange(&pJob->bCancelled, 1);
+
+    // Whatever has been loaded for the directory being entered is moved to
+    // a fresh job without a worker, so that Take can still find it
+
+    if (!sKeep.empty())
+    {
+        Job *pKeptJob = new Job(this, vector<tstring>());
+        pKeptJob->nRefs = 1;
+        pKeptJob->bCancelled = 1;
+
+        {
+            CSGuard _(pJob->cs);
+
+            auto p = pJob->ready.find(sKeep);
+            if (p != pJob->ready.end())
+                pKeptJob->ready[sKeep] = std::move(p->second), pJob->ready.erase(p);
+        }
+
+        if (!pKeptJob->ready.empty())
+            panelJob.pJob = pKeptJob;
+        else
+            Release(pKeptJob);
+    }
+
+    Release(pJob);
+}
+
+boost::intrusive_ptr<IVcsData> Prefetcher::Take(const tstring& sDir)
+{
+    boost::intrusive_ptr<IVcsData> pVcsData;
+    DWORD dwLoadedAt = 0;
+
+    for (auto& job : m_Jobs)
+    {
+        Job *pJob = job.second.pJob;
+
+        if (!pJob)
+            continue;
+
+        CSGuard _(pJob->cs);
+
+        auto p = pJob->ready.find(sDir);
+        if (p == pJob->ready.end())
+            continue;
+
+        pVcsData.swap(p->second.pVcsData);
+        dwLoadedAt = p->second.dwLoadedAt;
+        pJob->ready.erase(p);
+        break;
+    }
+
+    if (!pVcsData)
+        return pVcsData;
+
+    if (::GetTickCount() - dwLoadedAt > cdwMaxAge)
+        pVcsData.reset();
+
+    return pVcsData;
+}
+
+void Prefetcher::NoteVisited(const tstring& sDir)
+{
+    m_Visited.erase(std::remove_if(m_Visited.begin(), m_Visited.end(), std::bind2nd(EqualNoCase(), sDir)), m_Visited.end());
+    m_Visited.push_front(sDir);
+
+    if (m_Visited.size() > cnMaxVisitedDirs)
+        m_Visited.pop_back();
+}
+
+void Prefetcher::Shutdown(unsigned long dwMilliseconds)
+{
+    CancelAll();
+
+    // The workers run the code of the second level plugins, so they must be
+    // done with them before those are unloaded (this module stays loaded
+    // until its workers return, see ModuleWorkItem). A cancelled job is no
+    // longer referenced here, but its worker may still be loading a
+    // directory.
+
+    ::WaitForSingleObject(m_noWorkers, dwMilliseconds);
+}
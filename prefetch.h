@@ -0,0 +1,104 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Speculative background loading of the VCS data for the
+             directories the user is likely to enter next
+*****************************************************************************/
+
+#include <deque>
+#include <map>
+#include <vector>
+#include "vcs.h"
+
+/// <summary>
+/// Loads <c>VcsEntries</c> of the neighbouring directories on a low-priority
+/// background thread, so that stepping into one of them finds its entries
+/// already loaded.
+/// </summary>
+/// <remarks>
+/// Every panel has at most one prefetch job. Starting a new job cancels the
+/// current one of the panel, and so does navigating elsewhere in it; the job
+/// of the other panel goes on. A cancelled job finishes the directory it is
+/// loading and drops the results.
+/// </remarks>
+class Prefetcher final
+{
+public:
+    Prefetcher() : m_nWorkers(0), m_noWorkers(true, true) {}
+    ~Prefetcher() { CancelAll(); }
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    /// <summary>
+    /// Cancels the current job of the panel and starts prefetching the
+    /// subdirectories of <paramref name="sDir"/> and its parent.
+    /// </summary>
+    void Start(const void *pOwner, const tstring& sDir, const std::vector<tstring>& vSubDirs);
+
+    /// <summary>
+    /// Cancels the current job of the panel. The data already loaded for
+    /// <paramref name="sKeep"/>, if any, survives the cancellation.
+    /// </summary>
+    void Cancel(const void *pOwner, const tstring& sKeep = tstring());
+
+    /// <summary>
+    /// Hands over the prefetched data for the directory, whichever panel has
+    /// loaded it, or returns null if the directory has not been (or is not
+    /// yet) prefetched.
+    /// </summary>
+    boost::intrusive_ptr<IVcsData> Take(const tstring& sDir);
+
+    /// <summary>
+    /// Remembers the directory as the most recently visited one.
+    /// </summary>
+    void NoteVisited(const tstring& sDir);
+
+    /// <summary>
+    /// Cancels the jobs of all the panels and waits for all the workers to finish,
+    /// those of the jobs cancelled earlier included. Must be called before
+    /// the second level plugins are unloaded.
+    /// </summary>
+    void Shutdown(unsigned long dwMilliseconds = 5000);
+
+    /// <summary>
+    /// The directory whose neighbours are being prefetched for the panel.
+    /// </summary>
+    tstring GetRoot(const void *pOwner) const;
+
+private:
+    struct Job;
+
+    // The current job of a panel and the directory it has been started for
+
+    struct PanelJob
+    {
+        PanelJob() : pJob(nullptr) {}
+
+        Job *pJob;
+        tstring sRoot;
+    };
+
+    static DWORD WINAPI WorkerRoutine(void *pJob);
+    static void Release(Job *pJob);
+
+    void CancelJob(PanelJob& panelJob, const tstring& sKeep);
+    void CancelAll();
+    void WorkerStarted();
+    void WorkerFinished();
+
+    std::vector<tstring> Prioritize(const tstring& sDir, const std::vector<tstring>& vSubDirs) const;
+
+    std::map<const void*, PanelJob> m_Jobs; // By the panel that has started the job
+    std::deque<tstring> m_Visited; // Most recently visited first
+
+    // The workers still running, cancelled or not, and the event signalled
+    // when there are none
+
+    CriticalSection m_csWorkers;
+    unsigned m_nWorkers;
+    W32Event m_noWorkers;
+};
+
+extern Prefetcher Prefetch;
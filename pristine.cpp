@@ -0,0 +1,178 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Local store of the base revisions of CVS working files
+*****************************************************************************/
+
+#include "pristine.h"
+
+using namespace std;
+
+PristineStore Pristine;
+
+namespace
+{
+    const size_t cnMaxQueuedFetches = 256;   // Do not let a huge modified tree flood the server
+    const DWORD  cdwMaxFetchTime    = 60000; // A fetch taking longer (ms) is abandoned
+}
+
+void PristineStore::Init(const tstring& sDir, unsigned __int64 nMaxBytes)
+{
+    m_pCache.reset(new FileCache(sDir, nMaxBytes));
+}
+
+void PristineStore::FetchInBackground(const tstring& sDir, const tstring& sName, const tstring& sRevision, const tstring& sKey)
+{
+    if (!m_pCache || m_bStopping)
+        return;
+
+    CSGuard _(m_cs);
+
+    if (m_Queue.size() >= cnMaxQueuedFetches || !m_RequestedKeys.insert(sKey).second)
+        return;
+
+    Fetch fetch = { sDir, sName, sRevision, sKey };
+    m_Queue.push_back(fetch);
+
+    if (m_bWorkerRunning)
+        return;
+
+    m_idle.Reset();
+    m_bWorkerRunning = ModuleWorkItem::Queue(WorkerRoutine, this);
+
+    if (!m_bWorkerRunning)
+    {
+        m_Queue.clear(); // Holding this fetch only, the worker having emptied it
+        m_RequestedKeys.erase(sKey);
+        m_idle.Set();
+    }
+}
+
+DWORD WINAPI PristineStore::WorkerRoutine(void *p)
+{
+    PristineStore *pStore = static_cast<PristineStore*>(p);
+
+    int nPriority = ::GetThreadPriority(::GetCurrentThread());
+    ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+    for ( ; ; )
+    {
+        Fetch fetch;
+
+        {
+            CSGuard _(pStore->m_cs);
+
+            if (pStore->m_Queue.empty() || pStore->m_bStopping)
+            {
+                pStore->m_Queue.clear();
+                pStore->m_bWorkerRunning = false;
+
+                // Under the lock, so that a worker started right after this one
+                // cannot have its Reset overridden. Shutdown may return before
+                // the lock is released; the work item holds the module until
+                // the routine returns.
+
+                ::SetThreadPriority(::GetCurrentThread(), nPriority);
+                pStore->m_idle.Set();
+                return 0;
+            }
+
+            fetch = pStore->m_Queue.front();
+            pStore->m_Queue.pop_front();
+        }
+
+        if (pStore->Contains(fetch.sKey))
+            continue; // Stored in an earlier session, or fetched on demand meanwhile
+
+        try
+        {
+            TempFile tempFile;
+
+            if (pStore->Run(fetch, tempFile.GetName()))
+                pStore->Put(fetch.sKey, tempFile.GetName());
+        }
+        catch (std::runtime_error&)
+        {
+            // No temporary file; the revision will be fetched on demand
+        }
+    }
+}
+
+bool PristineStore::Run(const Fetch& fetch, const tstring& sOutFile)
+{
+    SECURITY_ATTRIBUTES sa = { sizeof sa, 0, TRUE };
+
+    W32Handle HOutFile = ::CreateFile(sOutFile.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &sa, CREATE_ALWAYS, 0, 0);
+    W32Handle HNul = ::CreateFile(_T("NUL"), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, 0);
+
+    if (!HOutFile || !HNul)
+        return false;
+
+    // Unlike ExecuteConsoleNoWait, does not touch the standard handles of the
+    // process, which may be in use by the main thread
+
+    STARTUPINFOEX si = { { sizeof si } };
+    si.StartupInfo.dwFlags    = STARTF_USESTDHANDLES;
+    si.StartupInfo.hStdInput  = HNul;
+    si.StartupInfo.hStdOutput = HOutFile;
+    si.StartupInfo.hStdError  = HNul;
+
+    // Only these two handles are inherited. The main thread may be creating
+    // the pipes of a foreground cvs meanwhile, and a write end inherited by
+    // this process would keep such a pipe open until the fetch has ended.
+
+    HANDLE handles[] = { HOutFile, HNul };
+
+    SIZE_T nSize = 0;
+    ::InitializeProcThreadAttributeList(0, 1, 0, &nSize);
+
+    vector<BYTE> attributes(nSize);
+    si.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(&attributes[0]);
+
+    if (!::InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &nSize))
+        return false;
+
+    tstring sCmdLine = sformat(_T("cvs -Q up -r %s -p %s"), fetch.sRevision.c_str(), QuoteIfNecessary(fetch.sName).c_str());
+    vector<TCHAR> cmdLine(sCmdLine.begin(), sCmdLine.end());
+    cmdLine.push_back(0);
+
+    PROCESS_INFORMATION pi;
+
+    bool bStarted = ::UpdateProcThreadAttribute(si.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, handles, sizeof handles, 0, 0)
+                    && ::CreateProcess(0, &cmdLine[0], 0, 0, TRUE, CREATE_NO_WINDOW | BELOW_NORMAL_PRIORITY_CLASS | EXTENDED_STARTUPINFO_PRESENT,
+                                       0, fetch.sDir.c_str(), &si.StartupInfo, &pi);
+
+    ::DeleteProcThreadAttributeList(si.lpAttributeList);
+
+    if (!bStarted)
+        return false;
+
+    ::CloseHandle(pi.hThread);
+    W32Handle HProcess = pi.hProcess;
+
+    HOutFile.Close();
+
+    for (DWORD dwWaited = 0; ; dwWaited += 500)
+    {
+        if (::WaitForSingleObject(HProcess, 500) == WAIT_OBJECT_0)
+            break;
+
+        if (m_bStopping || dwWaited >= cdwMaxFetchTime)
+        {
+            ::TerminateProcess(HProcess, 1);
+            return false;
+        }
+    }
+
+    DWORD dwExitCode;
+    return ::GetExitCodeProcess(HProcess, &dwExitCode) && dwExitCode == 0;
+}
+
+void PristineStore::Shutdown(unsigned long dwMilliseconds)
+{
+    ::InterlockedExchange(&m_bStopping, 1);
+
+    // The module stays loaded until the worker returns (see ModuleWorkItem),
+    // but the worker must not go on running cvs once the plugin is closing
+
+    ::WaitForSingleObject(m_idle, dwMilliseconds);
+}
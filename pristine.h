@@ -0,0 +1,86 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Local store of the base revisions of CVS working files
+*****************************************************************************/
+
+#include <deque>
+#include <memory>
+#include <set>
+#include "filecache.h"
+
+/// <summary>
+/// Keeps copies of the committed revisions of the working files, so that a
+/// modified file can be compared with its base revision without asking the
+/// server. CVS, unlike SVN, keeps no such copies in the working copy.
+/// </summary>
+/// <remarks>
+/// <p>
+/// The store is filled with the files just brought up to date by an update,
+/// with the revisions fetched on demand, and in the background with the base
+/// revisions of the files found modified.
+/// </p>
+/// <p>
+/// The keys identify a revision regardless of the working copy, see
+/// <c>CvsData::GetCacheKey</c>.
+/// </p>
+/// </remarks>
+class PristineStore final
+{
+public:
+    PristineStore() : m_bStopping(0), m_bWorkerRunning(false), m_idle(true, true) {}
+    ~PristineStore() { Shutdown(); }
+
+    PristineStore(const PristineStore&) = delete;
+    PristineStore& operator=(const PristineStore&) = delete;
+
+    /// <summary>
+    /// Sets up the store. Until called, the store is empty and ignores the
+    /// files put in it.
+    /// </summary>
+    void Init(const tstring& sDir, unsigned __int64 nMaxBytes);
+
+    bool Contains(const tstring& sKey) const { return m_pCache && m_pCache->Contains(sKey); }
+    bool Get(const tstring& sKey, const tstring& sDestFile) const { return m_pCache && m_pCache->Get(sKey, sDestFile); }
+    void Put(const tstring& sKey, const tstring& sSrcFile) { if (m_pCache) m_pCache->Put(sKey, sSrcFile); }
+    tstring GetStoredFileName(const tstring& sKey) const { return m_pCache ? m_pCache->GetCachedFileName(sKey) : tstring(); }
+
+    /// <summary>
+    /// Queues fetching the revision of the file in the directory by running
+    /// <c>cvs update -p</c> on a background thread. Does nothing if the
+    /// revision has been requested before; whether it is stored already is
+    /// left to the worker, so that a call costs a lookup in memory. May be
+    /// called from any thread.
+    /// </summary>
+    void FetchInBackground(const tstring& sDir, const tstring& sName, const tstring& sRevision, const tstring& sKey);
+
+    /// <summary>
+    /// Drops the queued fetches, stops the one in progress and waits for the
+    /// worker to finish. Must be called before the module is unloaded.
+    /// </summary>
+    void Shutdown(unsigned long dwMilliseconds = 5000);
+
+private:
+    struct Fetch
+    {
+        tstring sDir;
+        tstring sName;
+        tstring sRevision;
+        tstring sKey;
+    };
+
+    static DWORD WINAPI WorkerRoutine(void *pStore);
+    bool Run(const Fetch& fetch, const tstring& sOutFile);
+
+    std::unique_ptr<FileCache> m_pCache;
+
+    CriticalSection m_cs;                           // Guards the members below
+    std::deque<Fetch> m_Queue;
+    std::set<tstring, LessNoCase> m_RequestedKeys;  // Keys queued, fetched or failed to fetch; a failed one is left to the fetch on demand
+    volatile LONG m_bStopping;
+    bool m_bWorkerRunning;
+    W32Event m_idle;                                // Signalled while no worker is running
+};
+
+extern PristineStore Pristine;
@@ -0,0 +1,208 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Always-on counters and timers of the hot paths, shown by the
+             "VCS statistics" dialog
+*****************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "platform.h"
+
+/// <summary>
+/// A counter updated from any thread. Relaxed: only the totals matter.
+/// </summary>
+class StatCounter
+{
+public:
+    StatCounter() : m_n(0) {}
+
+    StatCounter(const StatCounter&) = delete;
+    StatCounter& operator=(const StatCounter&) = delete;
+
+    void Add(unsigned long long n = 1) { m_n.fetch_add(n, std::memory_order_relaxed); }
+    unsigned long long Get() const     { return m_n.load(std::memory_order_relaxed); }
+    void Reset()                       { m_n.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned long long> m_n;
+};
+
+/// <summary>
+/// The number of the timed calls and the time spent in them.
+/// </summary>
+struct StatTimer
+{
+    StatCounter nCalls;
+    StatCounter nMicroseconds;
+
+    void Add(std::chrono::steady_clock::duration d)
+    {
+        nCalls.Add();
+        nMicroseconds.Add(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+    }
+
+    void Reset() { nCalls.Reset(); nMicroseconds.Reset(); }
+};
+
+/// <summary>
+/// Adds the time of the enclosing scope to the timer.
+/// </summary>
+class ScopedStatTimer
+{
+public:
+    explicit ScopedStatTimer(StatTimer& timer) : m_timer(timer), m_tStart(std::chrono::steady_clock::now()) {}
+    ~ScopedStatTimer() { m_timer.Add(std::chrono::steady_clock::now() - m_tStart); }
+
+    ScopedStatTimer(const ScopedStatTimer&) = delete;
+    ScopedStatTimer& operator=(const ScopedStatTimer&) = delete;
+
+private:
+    StatTimer& m_timer;
+    std::chrono::steady_clock::time_point m_tStart;
+};
+
+/// <summary>
+/// All the statistics of the plugin. The host owns the instance and passes
+/// it to the second level plugins through their <c>AttachStatistics</c>
+/// export, so the counters of all the modules add up in one place.
+/// </summary>
+struct VcsStatistics
+{
+    VcsStatistics() : nStructSize(sizeof(VcsStatistics)) {}
+
+    VcsStatistics(const VcsStatistics&) = delete;
+    VcsStatistics& operator=(const VcsStatistics&) = delete;
+
+    size_t nStructSize; // Checked when attaching a module built with another layout
+
+    StatTimer   tLoadEntries;       // LazyLoadEntries, all of it
+    StatTimer   tReadAdminFiles;    // GetVcsEntriesOnly
+    StatCounter nEntriesLoaded;
+    StatCounter nAdminBytesParsed;  // CVS/Entries, Entries.Log, Tag
+    StatCounter nModifiedChecks;    // Timestamp comparisons of the CVS files
+    StatCounter nDirsTraversed;
+    StatCounter nPrefetchHits;      // Panel directories found already loaded
+    StatCounter nPrefetchMisses;
+    StatCounter nEntriesCacheHits;  // Directories reloaded from the retained entries
+    StatCounter nEntriesCacheMisses;
+    StatCounter nProcessesSpawned;
+    StatTimer   tProcesses;         // Waiting for the external processes
+    StatTimer   tSvnLibrary;        // Operations in libsvn_client
+    StatTimer   tLockWait;          // Contended locks of TSFileSet
+
+    void Reset()
+    {
+        tLoadEntries.Reset();
+        tReadAdminFiles.Reset();
+        nEntriesLoaded.Reset();
+        nAdminBytesParsed.Reset();
+        nModifiedChecks.Reset();
+        nDirsTraversed.Reset();
+        nPrefetchHits.Reset();
+        nPrefetchMisses.Reset();
+        nEntriesCacheHits.Reset();
+        nEntriesCacheMisses.Reset();
+        nProcessesSpawned.Reset();
+        tProcesses.Reset();
+        tSvnLibrary.Reset();
+        tLockWait.Reset();
+    }
+
+    /// <summary>
+    /// One line per counter, for the dialog and the logs.
+    /// </summary>
+    std::vector<tstring> Format() const
+    {
+        std::vector<tstring> v;
+
+        v.push_back(FormatTimer(_T("Directories loaded"), tLoadEntries));
+        v.push_back(FormatTimer(_T("  reading admin files"), tReadAdminFiles));
+        v.push_back(FormatCounter(_T("Entries loaded"), nEntriesLoaded));
+        v.push_back(FormatCounter(_T("Admin file bytes parsed"), nAdminBytesParsed));
+        v.push_back(FormatCounter(_T("Modification checks"), nModifiedChecks));
+        v.push_back(FormatCounter(_T("Directories traversed"), nDirsTraversed));
+        v.push_back(FormatCounter(_T("Prefetch hits"), nPrefetchHits));
+        v.push_back(FormatCounter(_T("Prefetch misses"), nPrefetchMisses));
+        v.push_back(FormatCounter(_T("Entries cache hits"), nEntriesCacheHits));
+        v.push_back(FormatCounter(_T("Entries cache misses"), nEntriesCacheMisses));
+        v.push_back(FormatCounter(_T("Processes spawned"), nProcessesSpawned));
+        v.push_back(FormatTimer(_T("Process runs"), tProcesses));
+        v.push_back(FormatTimer(_T("SVN library calls"), tSvnLibrary));
+        v.push_back(FormatTimer(_T("TSFileSet lock waits"), tLockWait));
+
+        return v;
+    }
+
+private:
+    static tstring FormatCounter(const TCHAR *szName, const StatCounter& counter)
+    {
+        return sformat(_T("%-24s %12llu"), szName, counter.Get());
+    }
+
+    static tstring FormatTimer(const TCHAR *szName, const StatTimer& timer)
+    {
+        return sformat(_T("%-24s %12llu %10.1f ms"), szName, timer.nCalls.Get(), timer.nMicroseconds.Get() / 1000.0);
+    }
+};
+
+/// <summary>
+/// The statistics the current module updates: its own until attached to
+/// the ones of the host.
+/// </summary>
+/// <remarks>
+/// Defined in a header file because it is used in both projects with static
+/// and dynamic runtimes; each module gets its own pair of statics.
+/// </remarks>
+inline VcsStatistics& LocalStatistics()
+{
+    static VcsStatistics local;
+    return local;
+}
+
+inline VcsStatistics*& StatisticsPtr()
+{
+    static VcsStatistics *p = &LocalStatistics();
+    return p;
+}
+
+inline VcsStatistics& Statistics()
+{
+    return *StatisticsPtr();
+}
+
+/// <summary>
+/// Makes the module update the given statistics, or its own ones if null
+/// or of another layout.
+/// </summary>
+inline void AttachStatisticsTo(VcsStatistics *pStatistics)
+{
+    StatisticsPtr() = pStatistics && pStatistics->nStructSize == sizeof(VcsStatistics) ? pStatistics : &LocalStatistics();
+}
+
+/// <summary>
+/// <c>CSGuard</c> counting the time spent waiting when the lock is taken.
+/// </summary>
+class TimedCSGuard
+{
+public:
+    explicit TimedCSGuard(CriticalSection& cs) : m_cs(cs)
+    {
+        if (m_cs.TryEnter())
+            return;
+
+        ScopedStatTimer _(Statistics().tLockWait);
+        m_cs.Enter();
+    }
+
+    ~TimedCSGuard() { m_cs.Leave(); }
+
+    TimedCSGuard(const TimedCSGuard&) = delete;
+    TimedCSGuard& operator=(const TimedCSGuard&) = delete;
+
+private:
+    CriticalSection& m_cs;
+};
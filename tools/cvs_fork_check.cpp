@@ -0,0 +1,215 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    farvcs-cvs-check: runs "cvs -n update" over a :fork: repository
+             both as a subprocess and through the server session of the
+             plugin, and compares the two outputs
+*****************************************************************************/
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include "cvsclient.h"
+#include "cvsentries.h"
+#include "vcs.h"
+
+using namespace std;
+
+namespace
+{
+    const char cszUsage[] =
+        "Usage: farvcs-cvs-check [--keep]\n"
+        "Builds a CVS repository and two working copies in a temporary directory\n"
+        "and compares the output of \"cvs -n update\" with the one of the plugin's\n"
+        "server session for the same working copy. The files of the top\n"
+        "directory sort after its subdirectories, so the order the session\n"
+        "describes them in matters. Exits with 77 if cvs is not installed.\n"
+        "  --keep    Leave the temporary directory in place\n";
+
+    bool Shell(const string& sCmdLine)
+    {
+        return system(sCmdLine.c_str()) == 0;
+    }
+
+    void WriteFile(const string& sPath, const string& sText)
+    {
+        ofstream(sPath.c_str()) << sText;
+    }
+
+    // A local change made a day back, so that the timestamp differs from
+    // the one in CVS/Entries even within the second of the checkout
+
+    void ModifyFile(const string& sPath, const string& sText)
+    {
+        ofstream(sPath.c_str(), ios::app) << sText;
+
+        struct utimbuf times;
+        times.actime = times.modtime = time(0) - 86400;
+        utime(sPath.c_str(), &times);
+    }
+
+    bool BuildRepository(const string& sTmp, const string& sRoot)
+    {
+        const string sImport = sTmp + "/import";
+
+        if (!Shell("cvs -Q -d " + sRoot + " init")
+            || !Shell("mkdir -p " + sImport + "/m/k"))
+            return false;
+
+        // "a.txt" sorts before the subdirectory "m", the others after it
+
+        WriteFile(sImport + "/a.txt", "a\n");
+        WriteFile(sImport + "/zz.txt", "zz\n");
+        WriteFile(sImport + "/zzz.txt", "zzz\n");
+        WriteFile(sImport + "/m/b.txt", "b\n");
+        WriteFile(sImport + "/m/n.txt", "n\n");
+        WriteFile(sImport + "/m/k/q.txt", "q\n");
+
+        return Shell("cd " + sImport + " && cvs -Q -d " + sRoot + " import -m import wc vendor start")
+            && Shell("cd " + sTmp + " && cvs -Q -d " + sRoot + " checkout -d wc wc")
+            && Shell("cd " + sTmp + " && cvs -Q -d " + sRoot + " checkout -d other wc");
+    }
+
+    void ChangeWorkingCopies(const string& sTmp)
+    {
+        // Outdated in "wc"
+
+        ModifyFile(sTmp + "/other/zz.txt", "zz2\n");
+        ModifyFile(sTmp + "/other/m/n.txt", "n2\n");
+        Shell("cd " + sTmp + "/other && cvs -Q commit -m change zz.txt m/n.txt");
+
+        // Locally modified in "wc"
+
+        ModifyFile(sTmp + "/wc/zzz.txt", "zzz2\n");
+        ModifyFile(sTmp + "/wc/m/k/q.txt", "q2\n");
+        WriteFile(sTmp + "/wc/unknown.txt", "?\n");
+    }
+
+    // The questionable files are left out: the session does not send the
+    // Questionable requests
+
+    multiset<string> RunSubprocess(const string& sWorkingCopy)
+    {
+        multiset<string> lines;
+        FILE *pipe = popen(("cd " + sWorkingCopy + " && cvs -n -q update 2>/dev/null").c_str(), "r");
+
+        if (!pipe)
+            return lines;
+
+        char szLine[4096];
+
+        while (fgets(szLine, sizeof szLine, pipe))
+        {
+            string sLine = szLine;
+            sLine.erase(sLine.find_last_not_of("\r\n") + 1);
+
+            if (!sLine.empty() && sLine[0] != '?')
+                lines.insert(sLine);
+        }
+
+        pclose(pipe);
+        return lines;
+    }
+
+    bool RunSession(const string& sWorkingCopy, multiset<string>& lines)
+    {
+        CvsSession *pSession = CvsSession::Acquire(ReadCvsAdminLine(sWorkingCopy, "Root"));
+
+        if (!pSession)
+            return false;
+
+        boost::intrusive_ptr<IVcsData> apVcsData = GetVcsData(sWorkingCopy);
+
+        CvsRequest request;
+        request.GlobalOption("-n");
+        request.GlobalOption("-q");
+        DescribeCvsWorkingCopy(request, *pSession, sWorkingCopy, apVcsData->entries(), [](const string& sDir) { return GetVcsData(sDir); });
+        request.Command("update");
+
+        return pSession->Run(request, [&](const char *szLine, bool bStdErr) -> bool
+        {
+            if (szLine && !bStdErr && *szLine && *szLine != '?')
+                lines.insert(szLine);
+
+            return false;
+        }) == CvsSession::rsOk;
+    }
+
+    void PrintMissing(const char *szWhere, const multiset<string>& lines, const multiset<string>& others)
+    {
+        vector<string> vMissing;
+        set_difference(lines.begin(), lines.end(), others.begin(), others.end(), back_inserter(vMissing));
+
+        for (vector<string>::const_iterator p = vMissing.begin(); p != vMissing.end(); ++p)
+            printf("only %s: %s\n", szWhere, p->c_str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool bKeep = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--keep")
+            bKeep = true;
+        else
+        {
+            fputs(cszUsage, stderr);
+            return 2;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!Shell("cvs --version >/dev/null 2>&1"))
+    {
+        puts("farvcs-cvs-check: cvs is not installed, skipped");
+        return 77;
+    }
+
+    char szTmp[] = "/tmp/farvcs-cvs-check.XXXXXX";
+
+    if (!mkdtemp(szTmp))
+    {
+        perror("farvcs-cvs-check");
+        return 2;
+    }
+
+    const string sTmp = szTmp;
+    int nResult = 2;
+
+    if (BuildRepository(sTmp, ":fork:" + sTmp + "/repo"))
+    {
+        ChangeWorkingCopies(sTmp);
+
+        multiset<string> subprocess = RunSubprocess(sTmp + "/wc");
+        multiset<string> session;
+
+        if (!RunSession(sTmp + "/wc", session))
+            fputs("farvcs-cvs-check: the session failed\n", stderr);
+        else
+        {
+            PrintMissing("in the subprocess output", subprocess, session);
+            PrintMissing("in the session output", session, subprocess);
+
+            nResult = subprocess == session && !subprocess.empty() ? 0 : 1;
+            printf("farvcs-cvs-check: %zu lines, %s\n", subprocess.size(), nResult == 0 ? "identical" : "DIFFERENT");
+        }
+
+        CvsSession::CloseAll();
+    }
+    else
+        fputs("farvcs-cvs-check: could not build the repository\n", stderr);
+
+    if (!bKeep)
+        Shell("rm -rf " + sTmp);
+
+    return nResult;
+}
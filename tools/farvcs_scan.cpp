@@ -0,0 +1,403 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    farvcs-scan: the tree-wide status report of the plugin for the
+             command line, CI and pre-commit hooks
+*****************************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "cachefile.h"
+#include "entriescache.h"
+#include "tracefile.h"
+#include "vcs.h"
+
+using namespace std;
+
+namespace
+{
+    const char cszUsage[] =
+        "Usage: farvcs-scan [options] DIR...\n"
+        "Reports the changed files and the directories containing them in the\n"
+        "working copies under DIR, and updates the cache file of the plugin.\n"
+        "  --format json      A JSON object per line, then a summary line (default)\n"
+        "  --format nul       \"<status> <path>\" records terminated by NUL; \"D\" marks\n"
+        "                     a directory with changed files\n"
+        "  --jobs N           Scan N directories at a time (1)\n"
+        "  --untracked        Report the files not under version control as well\n"
+        "  --cache FILE       The cache file (the one of the plugin)\n"
+        "  --no-cache         Neither read nor update the cache file\n"
+        "  --exit-code        Exit with 1 if there are locally changed files\n"
+        "  --slowest N        Report the N directories slowest to load, as recorded\n"
+        "                     by this and the earlier scans and traversals; \"T\"\n"
+        "                     records of the nul format read \"T <ms> <entries> <path>\"\n"
+        "  --trace FILE       Write the spans of the scan as a trace-event file for\n"
+        "                     chrome://tracing or Perfetto\n"
+        "The outdated files (\"*\") come from the last status update made in FAR.\n";
+
+    enum EFormat { fmtJson, fmtNul };
+
+    struct Options
+    {
+        Options() : format(fmtJson), nJobs(1), bUntracked(false), bUseCache(true), bExitCode(false), nSlowest(0) {}
+
+        vector<tstring> vRoots;
+        EFormat format;
+        unsigned nJobs;
+        bool bUntracked;
+        tstring sCacheFile;
+        bool bUseCache;
+        bool bExitCode;
+        size_t nSlowest;
+        tstring sTraceFile;
+    };
+
+    bool ParseOptions(int argc, char *argv[], Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            string sArg = argv[i];
+
+            if (sArg == "--untracked")
+                options.bUntracked = true;
+            else if (sArg == "--no-cache")
+                options.bUseCache = false;
+            else if (sArg == "--exit-code")
+                options.bExitCode = true;
+            else if (sArg == "--format" && i + 1 < argc)
+            {
+                string sFormat = argv[++i];
+
+                if (sFormat == "json")
+                    options.format = fmtJson;
+                else if (sFormat == "nul")
+                    options.format = fmtNul;
+                else
+                    return false;
+            }
+            else if (sArg == "--jobs" && i + 1 < argc)
+                options.nJobs = static_cast<unsigned>(atoi(argv[++i]));
+            else if (sArg == "--cache" && i + 1 < argc)
+                options.sCacheFile = argv[++i];
+            else if (sArg == "--slowest" && i + 1 < argc)
+                options.nSlowest = static_cast<size_t>(atoi(argv[++i]));
+            else if (sArg == "--trace" && i + 1 < argc)
+                options.sTraceFile = argv[++i];
+            else if (sArg.compare(0, 2, "--") == 0)
+                return false;
+            else
+                options.vRoots.push_back(sArg);
+        }
+
+        if (options.sCacheFile.empty())
+            options.sCacheFile = GetDefaultCacheFile();
+
+        return !options.vRoots.empty() && options.nJobs > 0;
+    }
+
+    //==========================================================================>>
+    // Records
+    //==========================================================================>>
+
+    string JsonString(const tstring& s)
+    {
+        string sJson = "\"";
+
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                (sJson += '\\') += c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                sJson += sformat("\\u%04x", static_cast<unsigned char>(c));
+            else
+                sJson += c;
+        }
+
+        return sJson += '"';
+    }
+
+    void AppendRecord(string& sOut, EFormat format, const char *szType, char cStatus, const tstring& sPathName)
+    {
+        if (format == fmtNul)
+        {
+            ((sOut += cStatus) += ' ') += sPathName;
+            sOut += '\0';
+        }
+        else
+            sOut += sformat("{\"type\":\"%s\",\"status\":\"%c\",\"path\":%s}\n", szType, cStatus, JsonString(sPathName).c_str());
+    }
+
+    void AppendSlowDirRecord(string& sOut, EFormat format, const tstring& sDir, const DirCost& cost)
+    {
+        double dMilliseconds = cost.nMicroseconds / 1000.0;
+
+        if (format == fmtNul)
+        {
+            sOut += sformat("T %.1f %lu ", dMilliseconds, cost.nEntries) + sDir;
+            sOut += '\0';
+        }
+        else
+            sOut += sformat("{\"type\":\"slow_dir\",\"ms\":%.1f,\"entries\":%lu,\"path\":%s}\n", dMilliseconds, cost.nEntries, JsonString(sDir).c_str());
+    }
+
+    //==========================================================================>>
+    // The scan: a queue of directories served by the worker threads, each
+    // directory read by GetVcsData as the panel and Traversal read it
+    //==========================================================================>>
+
+    class Scanner
+    {
+    public:
+        explicit Scanner(const Options& options) :
+            m_options(options),
+            m_nBusy(0),
+            m_nDirs(0),
+            m_nDirtyDirs(0),
+            m_nChangedFiles(0),
+            m_nOutdatedFiles(0)
+        {}
+
+        void Run(const vector<tstring>& vRoots)
+        {
+            m_queue.assign(vRoots.begin(), vRoots.end());
+
+            vector<thread> vThreads;
+
+            for (unsigned i = 1; i < m_options.nJobs; ++i)
+                vThreads.emplace_back([this] { Work(); });
+
+            Work();
+
+            for (auto& t : vThreads)
+                t.join();
+        }
+
+        size_t Dirs() const          { return m_nDirs; }
+        size_t DirtyDirs() const     { return m_nDirtyDirs; }
+        size_t ChangedFiles() const  { return m_nChangedFiles; }
+        size_t OutdatedFiles() const { return m_nOutdatedFiles; }
+
+    private:
+        void Work()
+        {
+            for (;;)
+            {
+                tstring sDir;
+
+                {
+                    unique_lock<mutex> lock(m_mutex);
+
+                    m_cvQueue.wait(lock, [this] { return !m_queue.empty() || m_nBusy == 0; });
+
+                    if (m_queue.empty())
+                        return; // Nobody is left to add more
+
+                    sDir = move(m_queue.front());
+                    m_queue.pop_front();
+                    ++m_nBusy;
+                }
+
+                vector<tstring> vSubDirs;
+
+                try
+                {
+                    ScanDir(sDir, vSubDirs);
+                }
+                catch (const exception& e)
+                {
+                    fprintf(stderr, "farvcs-scan: %s: %s\n", sDir.c_str(), e.what());
+                }
+
+                {
+                    lock_guard<mutex> lock(m_mutex);
+
+                    m_queue.insert(m_queue.end(), vSubDirs.begin(), vSubDirs.end());
+                    --m_nBusy;
+                }
+
+                m_cvQueue.notify_all();
+            }
+        }
+
+        void ScanDir(const tstring& sDir, vector<tstring>& vSubDirs)
+        {
+            TraceSpan span("ScanDir", "traversal", sDir);
+
+            chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+            boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(sDir);
+
+            if (!pVcsData || !pVcsData->IsValid())
+                return;
+
+            const VcsEntries& entries = pVcsData->entries();
+
+            if (!pVcsData->EntriesRetained())
+                SlowDirs.Record(sDir, chrono::steady_clock::now() - tStart, entries.size());
+
+            ++m_nDirs;
+
+            string sOut;
+            bool bDirtyFilesExist = false;
+            PathBuilder path(sDir);
+            const size_t nDirMark = sDir.size(); // The name of the previous entry is popped up to here
+
+            for (const auto& entry : entries)
+            {
+                if (entry.first == _T(".."))
+                    continue;
+
+                EVcsStatus fs = entry.second.status;
+
+                path.Pop(nDirMark);
+                path.Push(entry.first);
+                const tstring& sPathName = path.str();
+
+                if ((entry.second.fileFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsVcsDir(sPathName))
+                    vSubDirs.push_back(sPathName);
+
+                if (IsFileDirty(fs))
+                {
+                    bDirtyFilesExist = true;
+                    ++m_nChangedFiles;
+                }
+                else if (fs == fsOutdated || fs == fsAddedRepo)
+                    ++m_nOutdatedFiles;
+                else if (fs != fsGhost && !(fs == fsNonVcs && m_options.bUntracked))
+                    continue;
+
+                AppendRecord(sOut, m_options.format, "file", VcsStatusChar(fs), sPathName);
+            }
+
+            if (bDirtyFilesExist)
+            {
+                ++m_nDirtyDirs;
+                AppendRecord(sOut, m_options.format, "dir", 'D', sDir);
+            }
+
+            if (!sOut.empty())
+            {
+                lock_guard<mutex> lock(m_outputMutex);
+                fwrite(sOut.data(), 1, sOut.size(), stdout);
+            }
+        }
+
+        const Options& m_options;
+
+        mutex m_mutex;                  // Guards the queue and the busy count
+        condition_variable m_cvQueue;
+        deque<tstring> m_queue;
+        unsigned m_nBusy;
+
+        mutex m_outputMutex;            // Keeps the records of a directory together
+
+        atomic<size_t> m_nDirs;
+        atomic<size_t> m_nDirtyDirs;
+        atomic<size_t> m_nChangedFiles;
+        atomic<size_t> m_nOutdatedFiles;
+    };
+
+    int Run(const Options& options)
+    {
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+        int nRetValue = 0;
+
+        // The cache holds the paths as given by realpath, as the plugin does
+        // the full paths from FAR
+
+        vector<tstring> vRoots;
+
+        for (const auto& sRoot : options.vRoots)
+        {
+            char szFullPath[PATH_MAX];
+
+            if (::realpath(sRoot.c_str(), szFullPath) == 0 || !IsVcsDir(szFullPath))
+            {
+                fprintf(stderr, "farvcs-scan: %s: not a working copy\n", sRoot.c_str());
+                nRetValue = 2;
+                continue;
+            }
+
+            vRoots.push_back(szFullPath);
+        }
+
+        AttachTraceTo(&GetTraceFile());
+
+        GetEntriesCacheBudget().nBudgetBytes = 0; // Every directory is read once
+
+        if (!options.sTraceFile.empty() && !GetTraceFile().Open(options.sTraceFile, "farvcs-scan"))
+        {
+            fprintf(stderr, "farvcs-scan: cannot write %s\n", options.sTraceFile.c_str());
+            return 2;
+        }
+
+        RemoteMarkerMap remoteMarkers;
+
+        if (options.bUseCache)
+            LoadCacheFile(options.sCacheFile, ::DirtyDirs, ::OutdatedFiles, remoteMarkers, SlowDirs);
+
+        Scanner scanner(options);
+        scanner.Run(vRoots);
+
+        if (options.bUseCache && !vRoots.empty() && !SaveCacheFile(options.sCacheFile, ::DirtyDirs, ::OutdatedFiles, remoteMarkers, SlowDirs))
+        {
+            fprintf(stderr, "farvcs-scan: cannot write %s\n", options.sCacheFile.c_str());
+            nRetValue = 2;
+        }
+
+        if (options.nSlowest > 0)
+        {
+            vector<pair<tstring, DirCost>> vSlowDirs = SlowDirs.Sorted();
+            string sOut;
+
+            for (size_t i = 0; i < vSlowDirs.size() && i < options.nSlowest; ++i)
+                AppendSlowDirRecord(sOut, options.format, vSlowDirs[i].first, vSlowDirs[i].second);
+
+            fwrite(sOut.data(), 1, sOut.size(), stdout);
+        }
+
+        if (options.format == fmtJson)
+            printf("{\"type\":\"summary\",\"dirs\":%lu,\"dirty_dirs\":%lu,\"changed_files\":%lu,\"outdated_files\":%lu,\"elapsed_ms\":%.1f}\n",
+                   static_cast<unsigned long>(scanner.Dirs()),
+                   static_cast<unsigned long>(scanner.DirtyDirs()),
+                   static_cast<unsigned long>(scanner.ChangedFiles()),
+                   static_cast<unsigned long>(scanner.OutdatedFiles()),
+                   chrono::duration<double, milli>(chrono::steady_clock::now() - tStart).count());
+
+        fflush(stdout);
+        GetTraceFile().Close();
+
+        if (nRetValue == 0 && options.bExitCode && scanner.ChangedFiles() > 0)
+            nRetValue = 1;
+
+        return nRetValue;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        fputs(cszUsage, stderr);
+        return 2;
+    }
+
+    try
+    {
+        return Run(options);
+    }
+    catch (const exception& e)
+    {
+        fprintf(stderr, "farvcs-scan: %s\n", e.what());
+        return 2;
+    }
+}
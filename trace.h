@@ -0,0 +1,114 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Opt-in tracing of the traversals and the backend operations
+             into a trace-event file for chrome://tracing or Perfetto
+*****************************************************************************/
+
+#include <chrono>
+#include "platform.h"
+#ifndef _WIN32
+#include <functional>
+#include <thread>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+/// <summary>
+/// Receiver of the finished spans. The host owns the only implementation
+/// and passes it to the second level plugins through their
+/// <c>AttachTrace</c> export; being an interface, it can be called from a
+/// module with another runtime.
+/// </summary>
+struct ITraceSink
+{
+    /// <summary>
+    /// Cheap check made before timing anything: tracing is off unless a
+    /// trace file is open.
+    /// </summary>
+    virtual bool IsEnabled() const = 0;
+
+    /// <param name="szDetail">Shown in the arguments of the span, e.g. the directory.</param>
+    /// <param name="nStartUs">Microseconds of the steady clock.</param>
+    virtual void WriteSpan(const char *szName, const char *szCategory, const TCHAR *szDetail, long long nStartUs, long long nDurationUs, unsigned long nThreadId) = 0;
+};
+
+/// <summary>
+/// The sink the current module writes to, null until attached.
+/// </summary>
+/// <remarks>
+/// Defined in a header file because it is used in both projects with static
+/// and dynamic runtimes; each module gets its own pointer.
+/// </remarks>
+inline ITraceSink*& TraceSinkPtr()
+{
+    static ITraceSink *p = 0;
+    return p;
+}
+
+inline void AttachTraceTo(ITraceSink *pSink)
+{
+    TraceSinkPtr() = pSink;
+}
+
+inline long long TraceNowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long TraceThreadId()
+{
+#ifdef _WIN32
+    return ::GetCurrentThreadId();
+#elif defined(__linux__)
+    return static_cast<unsigned long>(::syscall(SYS_gettid));
+#else
+    return static_cast<unsigned long>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+#endif
+}
+
+/// <summary>
+/// Writes a complete span of the enclosing scope if tracing is on; does
+/// next to nothing otherwise.
+/// </summary>
+/// <remarks>
+/// The name and the category must be literals: they are kept by pointer.
+/// </remarks>
+class TraceSpan
+{
+public:
+    TraceSpan(const char *szName, const char *szCategory, const tstring& sDetail = tstring()) :
+        m_pSink(TraceSinkPtr()),
+        m_szName(szName),
+        m_szCategory(szCategory),
+        m_nStartUs(0)
+    {
+        if (!m_pSink || !m_pSink->IsEnabled())
+        {
+            m_pSink = 0;
+            return;
+        }
+
+        m_sDetail = sDetail;
+        m_nStartUs = TraceNowUs();
+    }
+
+    ~TraceSpan()
+    {
+        if (m_pSink)
+            m_pSink->WriteSpan(m_szName, m_szCategory, m_sDetail.c_str(), m_nStartUs, TraceNowUs() - m_nStartUs, TraceThreadId());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    ITraceSink *m_pSink;
+    const char *m_szName;
+    const char *m_szCategory;
+    tstring m_sDetail;
+    long long m_nStartUs;
+};
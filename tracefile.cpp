@@ -0,0 +1,129 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Opt-in tracing of the traversals and the backend operations
+             into a trace-event file for chrome://tracing or Perfetto
+*****************************************************************************/
+
+#include <stdio.h>
+#include <string>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "tracefile.h"
+
+using namespace std;
+
+namespace
+{
+    unsigned long ProcessId()
+    {
+#ifdef _WIN32
+        return ::GetCurrentProcessId();
+#else
+        return static_cast<unsigned long>(::getpid());
+#endif
+    }
+
+    string ToUtf8(const TCHAR *sz)
+    {
+#ifdef _UNICODE
+        int len = ::WideCharToMultiByte(CP_UTF8, 0, sz, -1, 0, 0, 0, 0);
+        if (len <= 1)
+            return string();
+
+        string s(len - 1, '\0');
+        ::WideCharToMultiByte(CP_UTF8, 0, sz, -1, &s[0], len, 0, 0);
+        return s;
+#else
+        return sz; // The file system encoding, normally UTF-8 itself
+#endif
+    }
+
+    string JsonString(const string& s)
+    {
+        string sJson = "\"";
+
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                (sJson += '\\') += c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                sJson += sformat("\\u%04x", static_cast<unsigned char>(c));
+            else
+                sJson += c;
+        }
+
+        return sJson += '"';
+    }
+}
+
+bool TraceFile::Open(const tstring& sFile, const char *szProcessName)
+{
+    Close();
+
+    CSGuard _(m_cs);
+
+#ifdef _WIN32
+    FILE *pFile = 0;
+    if (_tfopen_s(&pFile, sFile.c_str(), _T("wb")) != 0)
+        return false;
+#else
+    FILE *pFile = fopen(sFile.c_str(), "wb");
+    if (pFile == 0)
+        return false;
+#endif
+
+    fputs("[\n", pFile);
+    m_bFirstEvent = true;
+    m_pFile = pFile;
+
+    WriteEvent(sformat("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"args\":{\"name\":%s}}",
+                       ProcessId(), JsonString(szProcessName).c_str()));
+    return true;
+}
+
+void TraceFile::Close()
+{
+    CSGuard _(m_cs);
+
+    FILE *pFile = m_pFile.exchange(0);
+
+    if (pFile == 0)
+        return;
+
+    fputs("\n]\n", pFile);
+    fclose(pFile);
+}
+
+void TraceFile::WriteSpan(const char *szName, const char *szCategory, const TCHAR *szDetail, long long nStartUs, long long nDurationUs, unsigned long nThreadId)
+{
+    string sEvent = sformat("{\"name\":%s,\"cat\":%s,\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%lu,\"tid\":%lu",
+                            JsonString(szName).c_str(), JsonString(szCategory).c_str(), nStartUs, nDurationUs, ProcessId(), nThreadId);
+
+    if (szDetail && *szDetail)
+        sEvent += sformat(",\"args\":{\"detail\":%s}", JsonString(ToUtf8(szDetail)).c_str());
+
+    WriteEvent(sEvent += '}');
+}
+
+void TraceFile::WriteEvent(const string& sEvent)
+{
+    CSGuard _(m_cs);
+
+    FILE *pFile = m_pFile;
+
+    if (pFile == 0)
+        return;
+
+    if (!m_bFirstEvent)
+        fputs(",\n", pFile);
+
+    fputs(sEvent.c_str(), pFile);
+    m_bFirstEvent = false;
+}
+
+TraceFile& GetTraceFile()
+{
+    static TraceFile traceFile;
+    return traceFile;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Opt-in tracing of the traversals and the backend operations
+             into a trace-event file for chrome://tracing or Perfetto
+*****************************************************************************/
+
+#include <atomic>
+#include "trace.h"
+
+/// <summary>
+/// Writes the spans as the JSON array trace-event format. The closing
+/// bracket is optional in that format, so the file of a crashed session
+/// still loads.
+/// </summary>
+class TraceFile : public ITraceSink
+{
+public:
+    TraceFile() : m_pFile(0), m_bFirstEvent(true) {}
+    ~TraceFile() { Close(); }
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    /// <summary>
+    /// Starts tracing into the file, replacing its contents.
+    /// </summary>
+    bool Open(const tstring& sFile, const char *szProcessName);
+    void Close();
+
+    bool IsEnabled() const override { return m_pFile.load(std::memory_order_relaxed) != 0; }
+    void WriteSpan(const char *szName, const char *szCategory, const TCHAR *szDetail, long long nStartUs, long long nDurationUs, unsigned long nThreadId) override;
+
+private:
+    void WriteEvent(const std::string& sEvent);
+
+    CriticalSection m_cs;
+    std::atomic<FILE*> m_pFile;
+    bool m_bFirstEvent;
+};
+
+/// <summary>
+/// The trace file of the process, closed until opened.
+/// </summary>
+TraceFile& GetTraceFile();
@@ -29,61 +29,13 @@ protected:
 
     virtual bool DoExecute()
     {
-        static int cnPreCountedDepth = 2;
-        int nPreCountedDirs = CountVcsDirs(m_szDir, cnPreCountedDepth);
-
-        unsigned long dirCount = 0; // Accumulates the number of the visited directories
-
-        return Traverse(m_szDir, nPreCountedDirs, cnPreCountedDepth, 0, dirCount);
-    }
-
-private:
-    bool Traverse(const tstring& sDir, int nPreCountedDirs, int nPreCountedDepth, int nLevel, unsigned long& dirCount)
-    {
-        // Read the VCS data (does nothing if not in a VCS-controlled directory)
-
-        if (!IsVcsDir(sDir))
-            return true;
-
-        boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(sDir);
-
-        // Enumerate all the entries in the current directory
-
-        bool bDirtyFilesExist = false;
-        bool bRetValue = true;
-
-        for (const auto& entry : pVcsData->entries())
+        return TraverseDirtyDirs(m_szDir, [this](const tstring& sDir, unsigned short nPercent)
         {
-            if (entry.first == _T(".."))
-                continue;
-
-            bDirtyFilesExist |= IsFileDirty(entry.second.status);
-
-            tstring sPathName = CatPath(sDir.c_str(), entry.first.c_str());
-
-            if ((entry.second.fileFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && IsVcsDir(sPathName))
-            {
-                if (nLevel < nPreCountedDepth)
-                    ++dirCount;
-
-                if (UserInteraction(sPathName.c_str(), static_cast<unsigned short>(dirCount * 100 / nPreCountedDirs)) && (bRetValue = false, true))
-                    break;
-
-                bRetValue = Traverse(sPathName.c_str(), nPreCountedDirs, nPreCountedDepth, nLevel + 1, dirCount);
-
-                if (!bRetValue)
-                    break;
-            }
-        }
-
-        if (bDirtyFilesExist)
-            DirtyDirs.Add(sDir);
-        else
-            DirtyDirs.Remove(sDir);
-
-        return bRetValue;
+            return UserInteraction(sDir.c_str(), nPercent);
+        });
     }
 
+private:
     const TCHAR *m_szDir;
     TCHAR m_szTruncatedDir[MAX_PATH]; // Used in DoGetInitialInfo method only, but stored here because of lifetime
 };
@@ -1,53 +1,562 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/serialization/set.hpp>
-#include "miscutil.h"
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/version.hpp>
+#include "platform.h"
+#include "stats.h"
 
 /// <summary>
-/// Thread-safe set of full file names.
+/// Thread-safe set of full file names, with the number of the files below
+/// every directory.
 /// </summary>
+/// <remarks>
+/// The paths are interned: every directory is a node with a compact id,
+/// its parent's id and its own name, and a member is the id of its
+/// directory and its name. A long prefix is stored once however many files
+/// share it, a lookup compares a path component by component in the small
+/// maps of the children, and the subtree of a directory is found by
+/// following the ids rather than by comparing the prefixes.
+/// The directories are kept until the set is cleared or reloaded, even when
+/// no file is left below them. The names given back use the platform's
+/// separator.
+/// </remarks>
 class TSFileSet
 {
 public:
-    typedef std::set<tstring, LessNoCase> UnderlyingSetType;
-    typedef UnderlyingSetType::iterator iterator;
-    typedef UnderlyingSetType::const_iterator const_iterator;
+    TSFileSet() : count(0), lastDir(cnNoDir), version(0), cleared(0) {}
 
-    iterator begin() { return cont.begin(); }
-    iterator end()   { return cont.end(); }
+    void Add(const tstring& sFile)               { TimedCSGuard _(cs); Insert(sFile); ++version; }
+    void Remove(const tstring& sFile)            { TimedCSGuard _(cs); Erase(sFile); ++version; }
+    bool Contains(const tstring& sFile) const    { TimedCSGuard _(cs); return Find(sFile); }
+    bool ContainsDown(const tstring& sDir) const { TimedCSGuard _(cs); return Find(DirKey(sDir)) || CountBelowLocked(sDir) != 0; }
+    void Clear()                                 { TimedCSGuard _(cs); ClearLocked(); ++version; }
+    size_t Size() const                          { TimedCSGuard _(cs); return count; }
 
-    const_iterator begin() const { return cont.begin(); }
-    const_iterator end()   const { return cont.end(); }
+    /// <summary>
+    /// The number of the files at any depth below the directory, kept up to
+    /// date along the parents of every added and removed file.
+    /// </summary>
+    size_t CountBelow(const tstring& sDir) const { TimedCSGuard _(cs); return CountBelowLocked(sDir); }
 
-public:
-    void Add(const tstring& sFile)               { CSGuard _(cs); cont.insert(sFile); }
-    void Remove(const tstring& sFile)            { CSGuard _(cs); cont.erase(sFile); }
-    bool Contains(const tstring& sFile) const    { CSGuard _(cs); return cont.find(sFile) != cont.end(); }
-    bool ContainsDown(const tstring& sDir) const { CSGuard _(cs); return std::find_if(cont.begin(), cont.end(), std::bind2nd(StartsWithDir(), sDir)) != cont.end(); }
-    void Merge(const TSFileSet& rhs)             { CSGuard _(cs); cont.insert(rhs.cont.begin(), rhs.cont.end()); }
-    void Clear()                                 { CSGuard _(cs); cont.clear(); }
+    void Merge(const TSFileSet& rhs)
+    {
+        std::vector<tstring> vFiles = rhs.Elements(); // The other set has its own ids
 
-    void RemoveFilesOfDir(const tstring& sDir, bool bRecursive)
+        TimedCSGuard _(cs);
+
+        for (const auto& sFile : vFiles)
+            Insert(sFile);
+
+        ++version;
+    }
+
+    /// <summary>
+    /// The names of the files directly in the directory, sorted as the set
+    /// is. Looked up by the directory, so the cost does not depend on the
+    /// size of the set.
+    /// </summary>
+    std::vector<tstring> FilesOfDir(const tstring& sDir) const
+    {
+        TimedCSGuard _(cs);
+
+        DirId id = FindDir(DirKey(sDir));
+
+        return id != cnNoDir ? std::vector<tstring>(dirs[id].files.begin(), dirs[id].files.end()) : std::vector<tstring>();
+    }
+
+    /// <summary>
+    /// The members that are the directory itself or are below it: the
+    /// subtree of its node, skipping the branches without files.
+    /// </summary>
+    std::vector<tstring> ElementsDown(const tstring& sDir) const
+    {
+        TimedCSGuard _(cs);
+
+        std::vector<tstring> v;
+        tstring sKey = DirKey(sDir);
+
+        if (Find(sKey))
+            v.push_back(sKey);
+
+        DirId id = FindDir(sKey);
+
+        if (id != cnNoDir)
+            Collect(id, DirPath(id), v);
+
+        return v;
+    }
+
+    /// <summary>
+    /// All the members, a directory after another.
+    /// </summary>
+    std::vector<tstring> Elements() const
+    {
+        TimedCSGuard _(cs);
+
+        std::vector<tstring> v;
+
+        for (const auto& root : roots)
+            Collect(root.second, root.first, v);
+
+        return v;
+    }
+
+    /// <summary>
+    /// Changes whenever the files directly in the directory change, so that
+    /// whatever has been computed from them can tell it is out of date. The
+    /// changes elsewhere in the set leave it as it is.
+    /// </summary>
+    unsigned long long DirVersion(const tstring& sDir) const
     {
-        CSGuard _(cs);
+        TimedCSGuard _(cs);
 
-        for (UnderlyingSetType::iterator p = cont.begin(); p != cont.end(); )
+        DirId id = FindDir(DirKey(sDir));
+        return id != cnNoDir ? dirs[id].changed : cleared;
+    }
+
+    /// <summary>
+    /// Applies a sequence of additions (<c>true</c>) and removals (<c>false</c>)
+    /// in the given order, taking the lock once.
+    /// </summary>
+    void Apply(std::vector<std::pair<bool, tstring>>& ops)
+    {
+        TimedCSGuard _(cs);
+
+        for (const auto& op : ops)
         {
-            if (bRecursive ? std::bind2nd(StartsWithDir(), sDir)(*p) : std::bind2nd(IsFileFromDir(), sDir)(*p))
-                cont.erase(p++);
+            if (op.first)
+                Insert(op.second);
             else
-                ++p;
+                Erase(op.second);
         }
+
+        ++version;
+    }
+
+    void RemoveFilesOfDir(const tstring& sDir, bool bRecursive)
+    {
+        TimedCSGuard _(cs);
+
+        tstring sKey = DirKey(sDir);
+        DirId id = FindDir(sKey);
+
+        if (bRecursive)
+        {
+            Erase(sKey);
+
+            if (id != cnNoDir)
+                AddBelow(dirs[id].parent, -static_cast<long long>(ClearSubtree(id)));
+        }
+        else if (id != cnNoDir && !dirs[id].files.empty())
+        {
+            size_t nFiles = dirs[id].files.size();
+
+            dirs[id].files.clear();
+            dirs[id].changed = NextVersion();
+            AddBelow(id, -static_cast<long long>(nFiles));
+        }
+
+        ++version;
     }
 
 private:
-    UnderlyingSetType cont;
+    typedef unsigned DirId;
+    typedef std::set<tstring, LessNoCase> NameSet;
+
+    enum : DirId { cnNoDir = ~0u }; // The parent of the first components, e.g. "C:"
+
+    // A component of a path being looked up, compared in place
+
+    struct NameRef
+    {
+        const TCHAR *pName;
+        size_t nLength;
+    };
+
+    struct NameRefLess
+    {
+        typedef void is_transparent;
+
+        bool operator()(const tstring& left, const tstring& right) const { return Less(left.c_str(), left.size(), right.c_str(), right.size()); }
+        bool operator()(const tstring& left, const NameRef& right) const { return Less(left.c_str(), left.size(), right.pName, right.nLength); }
+        bool operator()(const NameRef& left, const tstring& right) const { return Less(left.pName, left.nLength, right.c_str(), right.size()); }
+
+        // The order of LessNoCase
+
+        static bool Less(const TCHAR *pLeft, size_t nLeft, const TCHAR *pRight, size_t nRight)
+        {
+            int nCompared = ComparePaths(pLeft, pRight, nLeft < nRight ? nLeft : nRight);
+            return nCompared != 0 ? nCompared < 0 : nLeft < nRight;
+        }
+    };
+
+    typedef std::map<tstring, DirId, NameRefLess> ChildMap; // Name -> the directory
+
+    struct DirNode
+    {
+        DirNode(DirId parent_, const tstring *pName_, unsigned long long changed_) : parent(parent_), pName(pName_), nBelow(0), changed(changed_) {}
+
+        DirId parent;
+        const tstring *pName;       // The key of the node in its parent's children
+        ChildMap children;
+        NameSet files;              // The members directly in the directory
+        size_t nBelow;              // The members at any depth below
+        unsigned long long changed; // The version the files have last changed in
+    };
+
+    // The key of a directory: without the trailing separator, as the
+    // directory part of its files is
+
+    static tstring DirKey(const tstring& sDir)
+    {
+        size_t nLength = sDir.find_last_not_of(_T("\\/"));
+        return nLength == tstring::npos ? tstring() : sDir.substr(0, nLength + 1);
+    }
+
+    // Where the name of a member starts, past its last separator, and the
+    // length of its directory part
+
+    static size_t NameOffset(const tstring& sFile)
+    {
+        size_t i = sFile.find_last_of(_T("\\/"));
+        return i == tstring::npos ? 0 : i + 1;
+    }
+
+    static size_t DirLength(const tstring& sFile)
+    {
+        size_t nName = NameOffset(sFile);
+        return nName != 0 ? nName - 1 : 0;
+    }
+
+    const ChildMap& ChildrenOf(DirId id) const { return id != cnNoDir ? dirs[id].children : roots; }
+    ChildMap& ChildrenOf(DirId id)             { return id != cnNoDir ? dirs[id].children : roots; }
+
+    DirId InternChild(DirId parent, const tstring& sName)
+    {
+        std::pair<ChildMap::iterator, bool> result = ChildrenOf(parent).insert(std::make_pair(sName, static_cast<DirId>(dirs.size())));
+
+        if (result.second)
+            dirs.push_back(DirNode(parent, &result.first->first, cleared)); // No files yet, as before the node
+
+        return result.first->second;
+    }
+
+    // Walk the components of the first nLength characters of the path; the
+    // interning variant creates the missing nodes, the other gives up. Runs
+    // of lookups in the same directory, as the batches and the loads make,
+    // are answered by comparing with the last one. The empty path (the
+    // parent of a POSIX root) is left out, as it is the value of the
+    // empty cache.
+
+    DirId FindDir(const tstring& sPath, size_t nLength) const
+    {
+        if (nLength != 0 && nLength == sLastDir.size() && ComparePaths(sPath.c_str(), sLastDir.c_str(), nLength) == 0)
+            return lastDir;
+
+        DirId id = cnNoDir;
+
+        for (size_t nStart = 0; ; )
+        {
+            size_t nEnd = std::min(sPath.find_first_of(_T("\\/"), nStart), nLength);
+
+            const ChildMap& children = ChildrenOf(id);
+            ChildMap::const_iterator p = children.find(NameRef{ sPath.c_str() + nStart, nEnd - nStart });
+
+            if (p == children.end())
+                return cnNoDir;
+
+            id = p->second;
+
+            if (nEnd == nLength)
+                break;
+
+            nStart = nEnd + 1;
+        }
+
+        if (nLength != 0)
+        {
+            sLastDir.assign(sPath, 0, nLength);
+            lastDir = id;
+        }
+
+        return id;
+    }
+
+    DirId FindDir(const tstring& sDir) const { return FindDir(sDir, sDir.size()); }
+
+    DirId InternDir(const tstring& sPath, size_t nLength)
+    {
+        DirId id = FindDir(sPath, nLength);
+
+        if (id != cnNoDir)
+            return id;
+
+        for (size_t nStart = 0; ; )
+        {
+            size_t nEnd = std::min(sPath.find_first_of(_T("\\/"), nStart), nLength);
+
+            ChildMap& children = ChildrenOf(id);
+            ChildMap::const_iterator p = children.find(NameRef{ sPath.c_str() + nStart, nEnd - nStart });
+
+            id = p != children.end() ? p->second : InternChild(id, sPath.substr(nStart, nEnd - nStart));
+
+            if (nEnd == nLength)
+                return id;
+
+            nStart = nEnd + 1;
+        }
+    }
+
+    tstring DirPath(DirId id) const
+    {
+        tstring sPath = *dirs[id].pName;
+
+        for (id = dirs[id].parent; id != cnNoDir; id = dirs[id].parent)
+            sPath = *dirs[id].pName + cPathSeparator + sPath;
+
+        return sPath;
+    }
+
+    bool Find(const tstring& sFile) const
+    {
+        DirId id = FindDir(sFile, DirLength(sFile));
+        return id != cnNoDir && dirs[id].files.count(sFile.substr(NameOffset(sFile))) != 0;
+    }
+
+    void Insert(const tstring& sFile)
+    {
+        DirId id = InternDir(sFile, DirLength(sFile));
+
+        if (dirs[id].files.insert(sFile.substr(NameOffset(sFile))).second)
+        {
+            dirs[id].changed = NextVersion();
+            AddBelow(id, 1);
+        }
+    }
+
+    void Erase(const tstring& sFile)
+    {
+        DirId id = FindDir(sFile, DirLength(sFile));
+
+        if (id != cnNoDir && dirs[id].files.erase(sFile.substr(NameOffset(sFile))) != 0)
+        {
+            dirs[id].changed = NextVersion();
+            AddBelow(id, -1);
+        }
+    }
+
+    // The version a modification made under the lock ends in: every
+    // modifying call increments the version once, when it is done
+
+    unsigned long long NextVersion() const { return version + 1; }
+
+    // Updates the counts of the directory and of all its parents
+
+    void AddBelow(DirId id, long long nDelta)
+    {
+        count += static_cast<size_t>(nDelta);
+
+        for (; id != cnNoDir; id = dirs[id].parent)
+            dirs[id].nBelow += static_cast<size_t>(nDelta);
+    }
+
+    // Empties the subtree, leaving the counts of the parents to the caller;
+    // returns the number of the removed files
+
+    size_t ClearSubtree(DirId id)
+    {
+        size_t nRemoved = dirs[id].nBelow;
+
+        if (nRemoved == 0)
+            return 0;
+
+        if (!dirs[id].files.empty())
+        {
+            dirs[id].files.clear();
+            dirs[id].changed = NextVersion();
+        }
+
+        dirs[id].nBelow = 0;
+
+        for (const auto& child : dirs[id].children)
+            ClearSubtree(child.second);
+
+        return nRemoved;
+    }
+
+    void Collect(DirId id, const tstring& sPath, std::vector<tstring>& v) const
+    {
+        if (dirs[id].nBelow == 0)
+            return;
+
+        for (const auto& sName : dirs[id].files)
+            v.push_back(sPath + cPathSeparator + sName);
+
+        for (const auto& child : dirs[id].children)
+            Collect(child.second, sPath + cPathSeparator + child.first, v);
+    }
+
+    size_t CountBelowLocked(const tstring& sDir) const
+    {
+        DirId id = FindDir(DirKey(sDir));
+        return id != cnNoDir ? dirs[id].nBelow : 0;
+    }
+
+    void ClearLocked()
+    {
+        roots.clear();
+        dirs.clear();
+        count = 0;
+        cleared = NextVersion(); // The directories found later start from here
+
+        sLastDir.clear();
+        lastDir = cnNoDir;
+    }
+
+    ChildMap roots;
+    std::deque<DirNode> dirs; // By id; a parent comes before its children. Never moved, being pointed to.
+    size_t count;
+
+    mutable tstring sLastDir; // The last directory found and its id
+    mutable DirId lastDir;
+
+    unsigned long long version; // Incremented by every modification
+    unsigned long long cleared; // The version of the directories without a node
     mutable CriticalSection cs;
 
 private:
+    //==========================================================================>>
+    // Serialization. Version 0 is the set of the full names. Version 1 is
+    // the directories having files below them, each as its parent's index
+    // and its name, followed by the names of its files.
+    //==========================================================================>>
+
     friend class boost::serialization::access;
-    template <class Archive> void serialize(Archive& ar, const unsigned int) { CSGuard _(cs); ar & cont; }
+
+    template <class Archive> void save(Archive& ar, const unsigned int) const
+    {
+        TimedCSGuard _(cs);
+
+        std::vector<DirId> indices(dirs.size(), cnNoDir);
+        unsigned nDirs = 0;
+
+        for (DirId id = 0; id < dirs.size(); ++id)
+            if (dirs[id].nBelow != 0)
+                indices[id] = nDirs++;
+
+        ar & nDirs;
+
+        for (DirId id = 0; id < dirs.size(); ++id)
+        {
+            if (dirs[id].nBelow == 0)
+                continue;
+
+            DirId parent = dirs[id].parent != cnNoDir ? indices[dirs[id].parent] : cnNoDir;
+            size_t nFiles = dirs[id].files.size();
+
+            ar & parent & *dirs[id].pName & nFiles;
+
+            for (const auto& sName : dirs[id].files)
+                ar & sName;
+        }
+    }
+
+    template <class Archive> void load(Archive& ar, const unsigned int nVersion)
+    {
+        TimedCSGuard _(cs);
+
+        ClearLocked();
+
+        if (nVersion == 0)
+        {
+            NameSet files;
+            ar & files;
+
+            for (const auto& sFile : files)
+                Insert(sFile);
+        }
+        else
+        {
+            unsigned nDirs = 0;
+            ar & nDirs;
+
+            std::vector<DirId> ids; // By the index in the archive
+            ids.reserve(nDirs);
+
+            for (unsigned i = 0; i < nDirs; ++i)
+            {
+                DirId parent;
+                tstring sName;
+                size_t nFiles;
+
+                ar & parent & sName & nFiles;
+
+                DirId id = InternChild(parent != cnNoDir ? ids.at(parent) : cnNoDir, sName);
+                ids.push_back(id);
+
+                for (size_t j = 0; j < nFiles; ++j)
+                {
+                    ar & sName;
+
+                    if (dirs[id].files.insert(sName).second)
+                    {
+                        dirs[id].changed = NextVersion();
+                        AddBelow(id, 1);
+                    }
+                }
+            }
+        }
+
+        ++version;
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+BOOST_CLASS_VERSION(TSFileSet, 1)
+
+/// <summary>
+/// Collects the changes to a shared <c>TSFileSet</c> made by a single
+/// operation and commits them all at once, so that an operation reporting
+/// many files does not take the lock of the set for every one of them.
+/// </summary>
+/// <remarks>
+/// Owned by the thread running the operation. The changes are not visible
+/// in the target set until <c>Commit</c> is called.
+/// </remarks>
+class TSFileSetBatch
+{
+public:
+    explicit TSFileSetBatch(TSFileSet& target) : m_target(target) {}
+    ~TSFileSetBatch() { Commit(); }
+
+    TSFileSetBatch(const TSFileSetBatch&) = delete;
+    TSFileSetBatch& operator=(const TSFileSetBatch&) = delete;
+
+    void Add(tstring sFile)    { m_ops.emplace_back(true, std::move(sFile)); }
+    void Remove(tstring sFile) { m_ops.emplace_back(false, std::move(sFile)); }
+
+    void Commit()
+    {
+        if (m_ops.empty())
+            return;
+
+        m_target.Apply(m_ops);
+        m_ops.clear();
+    }
+
+private:
+    TSFileSet& m_target;
+    std::vector<std::pair<bool, tstring>> m_ops;
 };
@@ -1,7 +1,7 @@
 /*****************************************************************************
  File name:  vcs.cpp
  Project:    FarVCS plugin
- Purpose:    Common VCS utilities
+ Purpose:    Loading of the VCS plugins (the second level DLLs)
  Compiler:   MS Visual C++ 8.0
  Authors:    Michael Steinhaus
  Dependencies: STL
@@ -9,31 +9,13 @@
 
 #include "vcs.h"
 #include "plugutil.h"
+#include "tracefile.h"
+#include "entriescache.h"
+#include "dirrollup.h"
 
 using namespace std;
 using namespace boost;
 
-//==========================================================================>>
-// Count the number of VCS directories down to a given level. Level 0 means
-// only the directory itself (i.e. returns 1 if the directory is
-// VCS-controlled or 0 otherwise)
-//==========================================================================>>
-
-int CountVcsDirs( const string& sCurDir, int nDownToLevel )
-{
-    if ( !IsVcsDir(sCurDir) )
-        return 0;
-
-    int s = 1;
-
-    if ( nDownToLevel > 0 )
-        for ( dir_iterator p(sCurDir); p != dir_iterator(); ++p )
-            if ( p->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
-                s += CountVcsDirs( CatPath(sCurDir.c_str(),p->cFileName), nDownToLevel-1 );
-
-    return s;
-}
-
 //==========================================================================>>
 // Support for second level plugins
 //==========================================================================>>
@@ -53,9 +35,33 @@ public:
         Uninitialize     = (void (*)())::GetProcAddress( m_hModule, "Uninitialize" );
         IsPluginDir      = (bool (*)( const string& sDir ))::GetProcAddress( m_hModule, "IsPluginDir" );
         GetPluginDirData = (IVcsData *(*)( const string& sDir,TSFileSet& DirtyDirs, TSFileSet& OutdatedFiles ))::GetProcAddress( m_hModule, "GetPluginDirData" );
+        AttachStatistics = (void (*)( VcsStatistics *pStatistics ))::GetProcAddress( m_hModule, "AttachStatistics" );
+        AttachTrace      = (void (*)( ITraceSink *pSink ))::GetProcAddress( m_hModule, "AttachTrace" );
+        AttachEntriesCache = (void (*)( EntriesCacheBudget *pBudget ))::GetProcAddress( m_hModule, "AttachEntriesCache" );
+        AttachDirCounts  = (void (*)( IDirCountsSink *pSink ))::GetProcAddress( m_hModule, "AttachDirCounts" );
 
         if ( Initialize )
             Initialize( StartupInfo, cszPluginName, hInstance );
+
+        // The counters of the plugin add up with ours
+
+        if ( AttachStatistics )
+            AttachStatistics( &Statistics() );
+
+        // And so do the spans, written while a trace file is open
+
+        if ( AttachTrace )
+            AttachTrace( &GetTraceFile() );
+
+        // The retained entries of all the plugins share our budget
+
+        if ( AttachEntriesCache )
+            AttachEntriesCache( &GetEntriesCacheBudget() );
+
+        // And the counts of the loaded directories add up in our rollup
+
+        if ( AttachDirCounts )
+            AttachDirCounts( &GetDirRollup() );
     }
 
     virtual ~PluginDll()
@@ -75,6 +81,10 @@ public:
     void (*Uninitialize)();
     bool (*IsPluginDir)( const string& sDir );
     IVcsData *(*GetPluginDirData)( const string& sDir, TSFileSet& DirtyDirs, TSFileSet& OutdatedFiles );
+    void (*AttachStatistics)( VcsStatistics *pStatistics );
+    void (*AttachTrace)( ITraceSink *pSink );
+    void (*AttachEntriesCache)( EntriesCacheBudget *pBudget );
+    void (*AttachDirCounts)( IDirCountsSink *pSink );
 
 private:
     HMODULE m_hModule;
@@ -4,8 +4,11 @@
 #include <vector>
 #include <map>
 #include <memory.h>
-#include <windows.h>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include "platform.h"
 #include "tsset.h"
+#include "trace.h"
 
 enum EVcsStatus
 {
@@ -93,6 +96,19 @@ struct VcsEntry
 
 typedef std::map<tstring, VcsEntry, LessNoCase> VcsEntries;
 
+//==========================================================================>>
+// Result of a status query for a single file
+//==========================================================================>>
+
+struct VcsFileStatus
+{
+    tstring sWorkingRevision;
+    tstring sRepositoryRevision;
+    tstring sStatus;             // As reported by VCS, e.g. "Needs Patch"
+};
+
+typedef std::map<tstring, VcsFileStatus, LessNoCase> VcsFileStatuses; // Keyed by full pathname
+
 struct IVcsData : public ref_countable<IVcsData>
 {
     virtual const VcsEntries& entries() const = 0;
@@ -101,6 +117,10 @@ struct IVcsData : public ref_countable<IVcsData>
     virtual const TCHAR *getTag() const = 0;
     virtual const TCHAR *getDir() const = 0;
 
+    // True if entries() has reused the ones retained from an earlier load
+    // rather than read the directory
+    virtual bool EntriesRetained() const = 0;
+
     // This pair of methods is used instead of virtual destructor.
     // Indirection is necessary because a descendant can reside is
     // a dll with incompatible runtime.
@@ -109,10 +129,25 @@ struct IVcsData : public ref_countable<IVcsData>
     virtual void self_destroy() = 0;                      // Dynamically polymorphic, overridden in descendants
 
     virtual bool UpdateStatus(bool bLocal) = 0;
+
+    // Recursive UpdateStatus querying the repository only for the changes
+    // committed since sMarker, which is the marker returned by the previous
+    // call for the same directory. An empty marker means a full status. On
+    // success, sMarker receives the marker to pass next time, or is left
+    // empty if the repository provides none. bFull receives whether the whole
+    // subtree has been queried (no or an invalid marker); otherwise only the
+    // directories with changes committed have been, and their dirty state is
+    // brought up to date by the call whatever ReportsDirtyDirs says.
+    virtual bool UpdateStatusSince(tstring& sMarker, bool& bFull) = 0;
     virtual bool Update(bool bLocal) = 0;
     virtual bool Annotate(const tstring& sFileName, const tstring& sTempFile) = 0;
     virtual bool GetRevisionTemp(const tstring& sFileName, const tstring& sRevision, const tstring& sTempFile) = 0;
     virtual bool Status(const tstring& sFileName, tstring& sWorkingRevision) = 0;
+    virtual bool Status(const std::vector<tstring>& vFileNames, VcsFileStatuses& statuses) = 0;
+
+    // True if UpdateStatus and Update bring DirtyDirs up to date for the whole
+    // subtree they have processed, so that it need not be traversed afterwards
+    virtual bool ReportsDirtyDirs() const = 0;
 };
 
 bool IsVcsDir(const tstring& sDir);
@@ -120,6 +155,38 @@ boost::intrusive_ptr<IVcsData> GetVcsData(const tstring& sDir);
 
 int CountVcsDirs(const tstring& sCurDir, int nDownToLevel);
 
+// Walks the VCS-controlled tree bringing DirtyDirs up to date. The progress
+// callback gets each subdirectory about to be visited and the estimated
+// percentage done, and returns true to cancel. Returns false if cancelled.
+
+typedef boost::function<bool(const tstring& sDir, unsigned short nPercent)> TraversalProgress;
+
+bool TraverseDirtyDirs(const tstring& sDir, const TraversalProgress& fProgress);
+
+// Brings the counts of DirRollup below the directory in line with DirtyDirs
+// after a command has rebuilt the latter without a traversal: forgets them
+// and reloads the dirty directories.
+
+void RebuildDirCounts(const tstring& sRoot);
+
+// A dirty or outdated file below the root of CollectChanges
+
+struct VcsChange
+{
+    tstring sRelativePathName;
+    tstring sTag;
+    VcsEntry entry;
+};
+
+typedef std::vector<VcsChange> VcsChanges;
+
+// Lists the dirty and outdated files below the directory, ordered by their
+// directories. Loads only the directories in DirtyDirs and those of the
+// files in OutdatedFiles, so it is as good as the last traversal or status
+// update, and never walks the tree itself.
+
+VcsChanges CollectChanges(const tstring& sRoot);
+
 inline bool IsFileDirty(EVcsStatus fs)
 {
     return fs == fsModified ||
@@ -141,6 +208,23 @@ inline bool IsVcsFile(EVcsStatus fs)
            fs != fsIgnored;
 }
 
+// The one-letter status shown in the panel column and by the command line
+// tools; a space for the unmodified files
+
+inline char VcsStatusChar(EVcsStatus fs)
+{
+    return fs == fsAdded     ? 'A' :
+           fs == fsRemoved   ? 'R' :
+           fs == fsConflict  ? 'C' :
+           fs == fsModified  ? 'M' :
+           fs == fsOutdated  ? '*' :
+           fs == fsNonVcs    ? '?' :
+           fs == fsIgnored   ? '|' :
+           fs == fsAddedRepo ? 'a' :
+           fs == fsGhost     ? '!' :
+                               ' ';
+}
+
 inline bool IsVcsFile(const WIN32_FIND_DATA& findData, const IVcsData& vcsData)
 {
     VcsEntries::const_iterator p = vcsData.entries().find( ExtractFileName(findData.cFileName).c_str() );
@@ -0,0 +1,200 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Platform-independent part of the status engine: walking the
+             VCS-controlled tree
+*****************************************************************************/
+
+#include <set>
+#include "vcs.h"
+#include "dirlist.h"
+#include "dircosts.h"
+#include "dirrollup.h"
+
+using namespace std;
+
+namespace
+{
+    int CountVcsDirs(PathBuilder& path, int nDownToLevel)
+    {
+        if (!IsVcsDir(path.str()))
+            return 0;
+
+        int s = 1;
+
+        if (nDownToLevel > 0)
+        {
+            FileInfos files;
+            ListDirectory(path.str(), files);
+
+            for (const auto& file : files)
+            {
+                if (file.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    size_t nMark = path.Push(file.sName);
+                    s += CountVcsDirs(path, nDownToLevel - 1);
+                    path.Pop(nMark);
+                }
+            }
+        }
+
+        return s;
+    }
+}
+
+/// <summary>
+/// Counts the VCS directories down to the given level. Level 0 means only
+/// the directory itself, i.e. returns 1 if the directory is VCS-controlled
+/// or 0 otherwise.
+/// </summary>
+int CountVcsDirs(const tstring& sCurDir, int nDownToLevel)
+{
+    PathBuilder path(sCurDir);
+    return CountVcsDirs(path, nDownToLevel);
+}
+
+namespace
+{
+    const int cnPreCountedDepth = 2; // The progress is estimated by the directories down to this level
+
+    // The path holds the directory, known to be VCS-controlled, and gets the
+    // names of its subdirectories pushed in turn: apart from loading the
+    // entries, visiting them allocates nothing
+
+    bool Traverse(PathBuilder& path, const TraversalProgress& fProgress, int nPreCountedDirs, int nLevel, unsigned long& dirCount)
+    {
+        const tstring& sDir = path.str(); // Changes while a subdirectory is visited
+
+        TraceSpan span("Traverse", "traversal", sDir);
+
+        // The entries are loaded on the first access; that is what is measured.
+        // A reuse of the retained ones says nothing of the cost of the directory.
+
+        chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+        boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(sDir);
+        const VcsEntries& entries = pVcsData->entries();
+
+        if (!pVcsData->EntriesRetained())
+            SlowDirs.Record(sDir, chrono::steady_clock::now() - tStart, entries.size());
+        Statistics().nDirsTraversed.Add();
+
+        // Enumerate all the entries in the current directory
+
+        bool bDirtyFilesExist = false;
+        bool bRetValue = true;
+
+        for (const auto& entry : entries)
+        {
+            if (entry.first == _T(".."))
+                continue;
+
+            bDirtyFilesExist |= IsFileDirty(entry.second.status);
+
+            if (!(entry.second.fileFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                continue;
+
+            size_t nMark = path.Push(entry.first);
+
+            if (IsVcsDir(path.str()))
+            {
+                if (nLevel < cnPreCountedDepth)
+                    ++dirCount;
+
+                if (fProgress && fProgress(path.str(), static_cast<unsigned short>(dirCount * 100 / nPreCountedDirs)))
+                    bRetValue = false;
+                else
+                    bRetValue = Traverse(path, fProgress, nPreCountedDirs, nLevel + 1, dirCount);
+            }
+
+            path.Pop(nMark);
+
+            if (!bRetValue)
+                break;
+        }
+
+        if (bDirtyFilesExist)
+            DirtyDirs.Add(sDir);
+        else
+            DirtyDirs.Remove(sDir);
+
+        return bRetValue;
+    }
+}
+
+bool TraverseDirtyDirs(const tstring& sDir, const TraversalProgress& fProgress)
+{
+    int nPreCountedDirs = CountVcsDirs(sDir, cnPreCountedDepth);
+
+    unsigned long dirCount = 0; // Accumulates the number of the visited directories
+
+    // Read the VCS data (does nothing if not in a VCS-controlled directory)
+
+    if (!IsVcsDir(sDir))
+        return true;
+
+    // Every directory below is reloaded, the ones gone are forgotten
+
+    GetDirRollup().ClearBelow(sDir);
+
+    PathBuilder path(sDir);
+    return Traverse(path, fProgress, nPreCountedDirs, 0, dirCount);
+}
+
+void RebuildDirCounts(const tstring& sRoot)
+{
+    GetDirRollup().ClearBelow(sRoot);
+
+    for (const auto& sDir : DirtyDirs.ElementsDown(sRoot))
+    {
+        if (IsVcsDir(sDir))
+            GetVcsData(sDir)->entries();
+    }
+}
+
+VcsChanges CollectChanges(const tstring& sRoot)
+{
+    TraceSpan span("CollectChanges", "traversal", sRoot);
+
+    // The directories to load: both sets are ordered, so what is below the
+    // root is a range of each
+
+    set<tstring, LessNoCase> dirs;
+
+    for (auto& sDir : DirtyDirs.ElementsDown(sRoot))
+        dirs.insert(move(sDir));
+
+    for (const auto& sFile : OutdatedFiles.ElementsDown(sRoot))
+        dirs.insert(ExtractPath(sFile));
+
+    // The path of every change is relative to the root
+
+    size_t nRootLength = sRoot.find_last_not_of(_T("\\/")) + 1;
+
+    VcsChanges changes;
+
+    for (const auto& sDir : dirs)
+    {
+        if (!IsVcsDir(sDir))
+            continue;
+
+        boost::intrusive_ptr<IVcsData> pVcsData = GetVcsData(sDir);
+        tstring sRelativeDir = sDir.size() > nRootLength ? sDir.substr(nRootLength + 1) : tstring();
+
+        for (const auto& entry : pVcsData->entries())
+        {
+            EVcsStatus fs = entry.second.status;
+
+            if (entry.first == _T("..") || !(IsFileDirty(fs) || fs == fsOutdated || fs == fsAddedRepo))
+                continue;
+
+            VcsChange change;
+            change.sRelativePathName = sRelativeDir.empty() ? entry.first : CatPath(sRelativeDir.c_str(), entry.first.c_str());
+            change.sTag = pVcsData->getTag();
+            change.entry = entry.second;
+
+            changes.push_back(move(change));
+        }
+    }
+
+    return changes;
+}
@@ -11,7 +11,12 @@
 #ifndef __VCSDATA_H
 #define __VCSDATA_H
 
+#include <algorithm>
+#include <boost/noncopyable.hpp>
 #include "vcs.h"
+#include "dirlist.h"
+#include "entriescache.h"
+#include "dirrollup.h"
 
 //==========================================================================>>
 // Reusable implementation for VcsData descendants
@@ -21,11 +26,12 @@ template <typename D> class VcsData : public IVcsData, private boost::noncopyabl
 {
 public:
     explicit VcsData( const std::string& sDir, TSFileSet& DirtyDirs, TSFileSet& OutdatedFiles ) :
+        m_DirtyDirs( DirtyDirs ),
+        m_OutdatedFiles( OutdatedFiles ),
         m_bValid( D::IsVcsDir( sDir ) ),
-        m_sDir( sDir ),
         m_bEntriesLoaded( false ),
-        m_DirtyDirs( DirtyDirs ),
-        m_OutdatedFiles( OutdatedFiles )
+        m_bEntriesRetained( false ),
+        m_sDir( sDir )
     {}
 
     const VcsEntries& entries() const { return LazyLoadEntries(); }
@@ -35,26 +41,36 @@ public:
     const char *getDir() const { return m_sDir.c_str(); }
 
     bool IsValid() const { return m_bValid; }
+    bool EntriesRetained() const { return m_bEntriesRetained; }
 
 protected:
     virtual void GetVcsEntriesOnly() const = 0;
     virtual void AdjustVcsEntry( VcsEntry&, const WIN32_FIND_DATA& ) const {}
+    virtual bool AdjustVcsEntries() const { return true; } // Called once all the entries have been adjusted one by one; false if they must not be retained
 
     mutable VcsEntries m_Entries;
 
     TSFileSet& m_DirtyDirs;
     TSFileSet& m_OutdatedFiles;
 
+    // For AdjustVcsEntry: whether the file of this directory is in OutdatedFiles.
+    // Answered from a copy of the directory's part taken once per load.
+
+    bool IsOutdatedEntry( const std::string& sName ) const { return std::binary_search( m_vOutdatedNames.begin(), m_vOutdatedNames.end(), sName, LessNoCase() ); }
+
     void setTag( const char *szTag ) { m_sTag = szTag; }
 
 private:
     bool m_bValid;
     mutable bool m_bEntriesLoaded;
+    mutable bool m_bEntriesRetained;
+    mutable std::vector<std::string> m_vOutdatedNames; // Sorted as OutdatedFiles is
 
     std::string m_sDir;
     std::string m_sTag;
 
     VcsEntries& LazyLoadEntries() const;
+    void LoadEntries( const FileInfos& files, bool bRetain, unsigned long long nSignature ) const;
 };
 
 template <typename D> VcsEntries& VcsData<D>::LazyLoadEntries() const
@@ -66,44 +82,93 @@ template <typename D> VcsEntries& VcsData<D>::LazyLoadEntries() const
 
     m_bEntriesLoaded = true; // Do that immediately to prevent infinite recursion
 
-    GetVcsEntriesOnly();
+    ScopedStatTimer _( Statistics().tLoadEntries );
+    TraceSpan span( "LazyLoadEntries", "backend", m_sDir );
 
-    for ( dir_iterator p(m_sDir,true); p != dir_iterator(); ++p )
-    {
-        VcsEntries::iterator pEntry = m_Entries.find( p->cFileName );
-        
-        if ( pEntry != m_Entries.end() )
-            AdjustVcsEntry( pEntry->second, pEntry->second.fileFindData = *p );
-        else
-            if ( strcmp( p->cFileName, "." ) != 0 )
-                m_Entries.insert( make_pair( p->cFileName,
-                                             VcsEntry( p->cFileName, *p, strcmp(p->cFileName,D::GetAdminDirName()) == 0 ? fsNormal : fsNonVcs ) ) );
-    }
+    // The whole directory is read at once. The entries retained from an earlier
+    // load are reused if nothing they depend on has changed since; otherwise
+    // they are loaded from scratch, the find data filled in place, straight in
+    // the entry.
 
-    // Add as "added in repository" the files/directories that are in outdated files but not existing locally
-    // and not mentioned by VCS
+    FileInfos files;
+    ListDirectory( m_sDir, files, true );
 
-    for ( TSFileSet::const_iterator p = m_OutdatedFiles.begin(); p != m_OutdatedFiles.end(); ++p )
-    {
-        string sFileName = ExtractFileName( *p );
+    bool bCacheEnabled = EntriesCache::IsEnabled();
+    unsigned long long nSignature = bCacheEnabled ? EntriesCache::Signature( m_sDir, files, D::GetAdminDirName(), m_OutdatedFiles ) : 0;
 
-        if ( IsFileFromDir()(*p,m_sDir.c_str()) && m_Entries.find(sFileName) == m_Entries.end() )
-            m_Entries.insert( make_pair( sFileName, VcsEntry(false,sFileName,"","","",m_sTag,fsAddedRepo) ) );
-    }
+    m_bEntriesRetained = bCacheEnabled && ModuleEntriesCache().Get( m_sDir, nSignature, m_Entries );
+
+    if ( !m_bEntriesRetained )
+        LoadEntries( files, bCacheEnabled, nSignature );
 
-    // Add/remove the current directory in the list of the directories containing dirty files
+    // Add/remove the current directory in the list of the directories containing dirty files,
+    // and report its counts for the totals shown on the rows of the parent directories
 
-    bool bDirtyFilesExist = false;
-    
-    for ( VcsEntries::const_iterator pEntry = m_Entries.begin(); pEntry != m_Entries.end() && !bDirtyFilesExist; ++pEntry )
-    	bDirtyFilesExist |= IsFileDirty( pEntry->second.status );
+    unsigned nDirty = 0, nConflicts = 0;
 
-    if ( bDirtyFilesExist )
+    for ( VcsEntries::const_iterator pEntry = m_Entries.begin(); pEntry != m_Entries.end(); ++pEntry )
+    {
+        nDirty += IsFileDirty( pEntry->second.status );
+        nConflicts += pEntry->second.status == fsConflict;
+    }
+
+    if ( nDirty != 0 )
         m_DirtyDirs.Add( m_sDir.c_str() );
     else
         m_DirtyDirs.Remove( m_sDir.c_str() );
 
+    if ( IDirCountsSink *pSink = DirCountsSinkPtr() )
+        pSink->SetDirCounts( m_sDir.c_str(), nDirty, nConflicts );
+
     return m_Entries;
 }
 
+template <typename D> void VcsData<D>::LoadEntries( const FileInfos& files, bool bRetain, unsigned long long nSignature ) const
+{
+    m_vOutdatedNames = m_OutdatedFiles.FilesOfDir( m_sDir );
+
+    {
+        ScopedStatTimer _( Statistics().tReadAdminFiles );
+        TraceSpan span( "GetVcsEntriesOnly", "backend", m_sDir );
+        GetVcsEntriesOnly();
+    }
+
+    for ( FileInfos::const_iterator p = files.begin(); p != files.end(); ++p )
+    {
+        VcsEntries::iterator pEntry = m_Entries.find( p->sName );
+        
+        if ( pEntry != m_Entries.end() )
+        {
+            p->ToFindData( pEntry->second.fileFindData );
+            AdjustVcsEntry( pEntry->second, pEntry->second.fileFindData );
+        }
+        else if ( p->sName != "." )
+        {
+            pEntry = m_Entries.insert( std::make_pair( p->sName, VcsEntry() ) ).first;
+
+            VcsEntry& entry = pEntry->second;
+            p->ToFindData( entry.fileFindData );
+            entry.bDir = ( p->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0;
+            entry.sName = p->sName;
+            entry.status = strcmp( p->sName.c_str(), D::GetAdminDirName() ) == 0 ? fsNormal : fsNonVcs;
+        }
+    }
+
+    bool bRetainable = AdjustVcsEntries();
+
+    Statistics().nEntriesLoaded.Add( m_Entries.size() );
+
+    // Add as "added in repository" the files/directories that are in outdated files but not existing locally
+    // and not mentioned by VCS
+
+    for ( std::vector<std::string>::const_iterator p = m_vOutdatedNames.begin(); p != m_vOutdatedNames.end(); ++p )
+    {
+        if ( m_Entries.find(*p) == m_Entries.end() )
+            m_Entries.insert( std::make_pair( *p, VcsEntry(false,*p,"","","",m_sTag,fsAddedRepo) ) );
+    }
+
+    if ( bRetain && bRetainable )
+        ModuleEntriesCache().Put( m_sDir, nSignature, m_Entries );
+}
+
 #endif // __VCSDATA_H
@@ -0,0 +1,158 @@
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Confirms by the contents that the files whose timestamps do not
+             match the VCS records are really modified
+*****************************************************************************/
+
+#include "verify.h"
+
+using namespace std;
+
+ContentVerifier Verifier;
+
+namespace
+{
+    const LONG cnMaxWorkers = 4; // Including the calling thread; hashing is mostly I/O bound anyway
+
+    unsigned __int64 GetFileSize(const WIN32_FIND_DATA& findData)
+    {
+        return (static_cast<unsigned __int64>(findData.nFileSizeHigh) << 32) + findData.nFileSizeLow;
+    }
+}
+
+/// <summary>
+/// The items of a single <c>Verify</c> call, shared by the calling thread
+/// and the pool workers helping it. Lives on the stack of the caller, which
+/// waits for the workers to finish.
+/// </summary>
+struct ContentVerifier::Job
+{
+    Job(ContentVerifier *_pVerifier, vector<Item>& _items) : pVerifier(_pVerifier), items(_items), nNext(0), nWorkers(0) {}
+
+    void Run()
+    {
+        for (LONG i; (i = ::InterlockedIncrement(&nNext) - 1) < static_cast<LONG>(items.size()); )
+            items[i].bModified = pVerifier->IsModified(items[i], items[i].bVerified);
+    }
+
+    ContentVerifier *pVerifier;
+    vector<Item>& items;
+    volatile LONG nNext;     // Index of the next item to verify
+    volatile LONG nWorkers;  // Number of the pool workers still running
+    W32Event done;           // Signalled when the last pool worker has finished
+};
+
+void ContentVerifier::Verify(vector<Item>& items)
+{
+    if (items.empty())
+        return;
+
+    Job job(this, items);
+
+    LONG nWorkers = min(cnMaxWorkers, static_cast<LONG>(items.size())) - 1;
+    job.nWorkers = nWorkers;
+
+    for (LONG i = 0; i < nWorkers; ++i)
+        if (!::QueueUserWorkItem(WorkerRoutine, &job, 0) && ::InterlockedDecrement(&job.nWorkers) == 0)
+            job.done.Set();
+
+    job.Run(); // The calling thread does its share as well, so nothing depends on the pool being free
+
+    if (nWorkers > 0)
+        ::WaitForSingleObject(job.done, INFINITE);
+}
+
+DWORD WINAPI ContentVerifier::WorkerRoutine(void *p)
+{
+    Job *pJob = static_cast<Job*>(p);
+
+    pJob->Run();
+
+    if (::InterlockedDecrement(&pJob->nWorkers) == 0)
+        pJob->done.Set();
+
+    return 0;
+}
+
+bool ContentVerifier::LookUp(const Item& item, bool& bModified)
+{
+    CSGuard _(m_cs);
+
+    auto p = m_Verdicts.find(item.sFileName);
+
+    if (p == m_Verdicts.end() ||
+        ::CompareFileTime(&p->second.ftLastWriteTime, &item.findData.ftLastWriteTime) != 0 ||
+        p->second.nSize != GetFileSize(item.findData) ||
+        p->second.sKey != item.sKey)
+        return false;
+
+    bModified = p->second.bModified;
+    return true;
+}
+
+bool ContentVerifier::IsModified(const Item& item, bool& bVerified)
+{
+    bool bModified;
+
+    bVerified = false;
+
+    if (LookUp(item, bModified))
+    {
+        bVerified = true;
+        return bModified;
+    }
+
+    tstring sBaseFile = Pristine.GetStoredFileName(item.sKey);
+
+    if (sBaseFile.empty())
+        return true; // Not verified, and not remembered: the base revision may be fetched meanwhile
+
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+
+    if (!::GetFileAttributesEx(sBaseFile.c_str(), GetFileExInfoStandard, &fad))
+        return true;
+
+    if ((static_cast<unsigned __int64>(fad.nFileSizeHigh) << 32) + fad.nFileSizeLow != GetFileSize(item.findData))
+        bModified = true;
+    else
+    {
+        tstring sBaseDigest = GetBaseDigest(item.sKey, sBaseFile);
+        tstring sDigest = Sha1File(item.sFileName);
+
+        if (sBaseDigest.empty() || sDigest.empty())
+            return true;
+
+        bModified = sDigest != sBaseDigest;
+    }
+
+    Verdict verdict = { item.findData.ftLastWriteTime, GetFileSize(item.findData), item.sKey, bModified };
+
+    CSGuard _(m_cs);
+    m_Verdicts[item.sFileName] = verdict;
+
+    bVerified = true;
+    return bModified;
+}
+
+tstring ContentVerifier::GetBaseDigest(const tstring& sKey, const tstring& sBaseFile)
+{
+    {
+        CSGuard _(m_cs);
+
+        auto p = m_BaseDigests.find(sKey);
+        if (p != m_BaseDigests.end())
+            return p->second;
+    }
+
+    // The stored revisions never change, so a digest once computed stays valid
+
+    tstring sDigest = Sha1File(sBaseFile);
+
+    if (!sDigest.empty())
+    {
+        CSGuard _(m_cs);
+        m_BaseDigests[sKey] = sDigest;
+    }
+
+    return sDigest;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+/*****************************************************************************
+ Project:    FarVCS plugin
+ Purpose:    Confirms by the contents that the files whose timestamps do not
+             match the VCS records are really modified
+*****************************************************************************/
+
+#include <map>
+#include <vector>
+#include "pristine.h"
+
+/// <summary>
+/// Compares working files with their base revisions from the pristine store.
+/// </summary>
+/// <remarks>
+/// <p>
+/// A branch switch, a <c>touch</c> or a build tool rewriting identical files
+/// changes the timestamps only. Such files are told from the really modified
+/// ones by their SHA-1 digests, computed on the thread pool.
+/// </p>
+/// <p>
+/// The verdicts are remembered along with the timestamp and size of the
+/// file, so an unchanged file is hashed only once per session. The digests
+/// of the base revisions are remembered by their keys.
+/// </p>
+/// </remarks>
+class ContentVerifier final
+{
+public:
+    struct Item
+    {
+        tstring sFileName;         // Full name of the working file
+        tstring sKey;              // Key of its base revision in the pristine store
+        WIN32_FIND_DATA findData;  // Attributes of the working file
+        bool bModified;            // Out: false if the contents match the base revision
+        bool bVerified;            // Out: false if the base revision could not be compared with, bModified being a guess
+    };
+
+    ContentVerifier() {}
+
+    ContentVerifier(const ContentVerifier&) = delete;
+    ContentVerifier& operator=(const ContentVerifier&) = delete;
+
+    /// <summary>
+    /// Sets <c>bModified</c> and <c>bVerified</c> of each item. The items
+    /// whose base revision is not in the store are considered modified, but
+    /// not verified. May be called from any thread.
+    /// </summary>
+    void Verify(std::vector<Item>& items);
+
+private:
+    struct Verdict
+    {
+        FILETIME ftLastWriteTime;
+        unsigned __int64 nSize;
+        tstring sKey;
+        bool bModified;
+    };
+
+    struct Job;
+
+    static DWORD WINAPI WorkerRoutine(void *pJob);
+
+    bool IsModified(const Item& item, bool& bVerified);
+    bool LookUp(const Item& item, bool& bModified);
+    tstring GetBaseDigest(const tstring& sKey, const tstring& sBaseFile);
+
+    CriticalSection m_cs;                                 // Guards the members below
+    std::map<tstring, Verdict, LessNoCase> m_Verdicts;    // By the full file name
+    std::map<tstring, tstring> m_BaseDigests;             // By the pristine store key
+};
+
+extern ContentVerifier Verifier;
@@ -19,6 +19,7 @@ public:
     CriticalSection& operator=(const CriticalSection&) = delete;
 
     void Enter() { ::EnterCriticalSection(&cs); }
+    bool TryEnter() { return ::TryEnterCriticalSection(&cs) != FALSE; }
     void Leave() { ::LeaveCriticalSection(&cs); }
 
 private:
@@ -69,34 +70,56 @@ private:
 };
 
 //==========================================================================>>
-// STL-compliant iterator wrapper around ::FindFirstFile/::FindNextFile
+// Thread pool work item that holds a reference to the module of its routine
+// until the routine has returned, so that the module cannot be unloaded
+// under a worker that is still running its code
 //==========================================================================>>
 
-// ref_countable CRTP base
-
-template <typename T> class ref_countable
+class ModuleWorkItem final
 {
-private:
-    friend void intrusive_ptr_add_ref( ref_countable<T> *p )
+public:
+    /// <summary>
+    /// Like <c>::QueueUserWorkItem</c> with <c>WT_EXECUTELONGFUNCTION</c>.
+    /// </summary>
+    static bool Queue(LPTHREAD_START_ROUTINE pRoutine, void *pContext)
     {
-        ++static_cast<T*>(p)->ref_counter;
+        HMODULE hModule;
+
+        if (!::GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCTSTR>(pRoutine), &hModule))
+            return false;
+
+        ModuleWorkItem *pItem = new ModuleWorkItem(pRoutine, pContext, hModule);
+
+        if (::TrySubmitThreadpoolCallback(Callback, pItem, 0))
+            return true;
+
+        delete pItem;
+        ::FreeLibrary(hModule);
+        return false;
     }
 
-    friend void intrusive_ptr_release( ref_countable<T> *p )
+private:
+    ModuleWorkItem(LPTHREAD_START_ROUTINE pRoutine, void *pContext, HMODULE hModule) : m_pRoutine(pRoutine), m_pContext(pContext), m_hModule(hModule) {}
+
+    static void CALLBACK Callback(PTP_CALLBACK_INSTANCE pInstance, void *p)
     {
-        if ( --static_cast<T*>(p)->ref_counter == 0 )
-            static_cast<T*>(p)->ref_countable_self_destroy();
-    }
+        ModuleWorkItem item = *static_cast<ModuleWorkItem*>(p);
+        delete static_cast<ModuleWorkItem*>(p);
 
-protected:
-    ref_countable() : ref_counter(0) {}
-    void ref_countable_self_destroy() { delete static_cast<T*>(this); }
+        ::CallbackMayRunLong(pInstance);
+        ::FreeLibraryWhenCallbackReturns(pInstance, item.m_hModule);
 
-private:
-    int ref_counter;
+        item.m_pRoutine(item.m_pContext);
+    }
+
+    LPTHREAD_START_ROUTINE m_pRoutine;
+    void *m_pContext;
+    HMODULE m_hModule;
 };
 
-// The directory iterator proper
+//==========================================================================>>
+// STL-compliant iterator wrapper around ::FindFirstFile/::FindNextFile
+//==========================================================================>>
 
 class dir_iterator : public boost::iterator_facade<dir_iterator, WIN32_FIND_DATA, boost::single_pass_traversal_tag>
 {
@@ -128,7 +151,12 @@ private:
     {
         explicit dir_accessor(const tstring& sDir, bool bWithDots) : bWithDots_(bWithDots)
         {
-            hFind_ = ::FindFirstFile(CatPath(sDir.c_str(), _T("*")).c_str(), &findData_);
+            // No short names, and the entries fetched in large blocks (Windows 7 and later)
+
+            tstring sPattern = CatPath(sDir.c_str(), _T("*"));
+            hFind_ = ::FindFirstFileEx(sPattern.c_str(), FindExInfoBasic, &findData_, FindExSearchNameMatch, 0, FIND_FIRST_EX_LARGE_FETCH);
+            if (hFind_ == INVALID_HANDLE_VALUE && ::GetLastError() == ERROR_INVALID_PARAMETER)
+                hFind_ = ::FindFirstFile(sPattern.c_str(), &findData_);
             if (hFind_ == INVALID_HANDLE_VALUE && ::GetLastError() != ERROR_NO_MORE_FILES )
                 throw std::runtime_error("::FindFirstFile failed");
             if (!bWithDots_ && is_dot_entry(findData_.cFileName))